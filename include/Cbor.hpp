@@ -0,0 +1,51 @@
+/*
+ * Minimal CBOR (RFC 8949) encoder for push and mqtt payloads.
+ * */
+
+#ifndef __cbor_hpp_
+#define __cbor_hpp_
+
+#include <cstdint>
+#include <string>
+
+// appends CBOR data items to a string. Containers are definite length so the number of
+// entries has to be known in advance.
+class CborWriter {
+  public:
+	// float32: encode all values as float32 even if precision is lost. Otherwise float32 is
+	// only used if the value can be represented exactly.
+	CborWriter(std::string &out, bool float32 = false) : _out(out), _float32(float32) {}
+
+	void map(uint64_t entries) { head(5, entries); }
+	void array(uint64_t items) { head(4, items); }
+	void string(const char *str, size_t len);
+	void string(const std::string &str) { string(str.data(), str.size()); }
+	void integer(int64_t v);
+	void number(double v);
+
+	// a series of tuples is written as the two map entries
+	//   "t": [t0, t1 - t0, t2 - t1, ...], "v": [v0, v1, ...]
+	// with timestamps in ms. The caller writes the map header, counting these as 2 entries.
+	// Iterator value_type has to be a pair<int64_t, double>.
+	template <class It> void tuples(It begin, It end, size_t n) {
+		string("t", 1);
+		array(n);
+		int64_t last = 0;
+		for (It it = begin; it != end; ++it) {
+			integer(it->first - last);
+			last = it->first;
+		}
+		string("v", 1);
+		array(n);
+		for (It it = begin; it != end; ++it)
+			number(it->second);
+	}
+
+  protected:
+	void head(uint8_t major, uint64_t v);
+
+	std::string &_out;
+	bool _float32;
+};
+
+#endif
@@ -73,6 +73,7 @@ class Channel {
 	bool running() const { return _thread_running; }
 
 	const char *name() const { return _name.c_str(); }
+	int index() const { return id; } // dense, unique and constant for the life time
 	std::list<Option> &options() { return _options; }
 	std::string mqttTopic() const { return _mqttTopic; }
 
@@ -71,7 +71,13 @@ class Config_Options {
 	const int &verbosity() const { return _verbosity; }
 	const int &comet_timeout() const { return _comet_timeout; }
 	const int &buffer_length() const { return _buffer_length; }
+	int local_threads() const { return _local_threads; }
 	int retry_pause() const { return _retry_pause; }
+	int push_window() const { return _push_window; }
+	int push_tuples() const { return _push_tuples; }
+	int curl_handles() const { return _curl_handles; }
+	int curl_idle() const { return _curl_idle; }
+	bool curl_prewarm() const { return _curl_prewarm; }
 
 	bool channel_index() const { return _channel_index; }
 	bool local() const { return _local; }
@@ -90,6 +96,7 @@ class Config_Options {
 		if (v >= 0)
 			_verbosity = v;
 	}
+	void retry_pause(int v) { _retry_pause = v; }
 
 	void local(const bool v) { _local = v; }
 
@@ -111,7 +118,13 @@ class Config_Options {
 	int _verbosity;     // verbosity level
 	int _comet_timeout; // in seconds;
 	int _buffer_length; // in seconds; how long to buffer readings for local interfalce
+	int _local_threads; // thread pool size for the local interface, 0 = one thread per connection
 	int _retry_pause;   // in seconds; how long to pause after an unsuccessful HTTP request
+	int _push_window;   // in ms; how long to coalesce readings for push notifications
+	int _push_tuples;   // max. readings to coalesce for push notifications
+	int _curl_handles;  // max. parallel curl sessions per middleware
+	int _curl_idle;     // in seconds; when to close unused curl sessions and connections
+	bool _curl_prewarm; // connect to the middlewares at startup
 
 	// boolean bitfields, padding at the end of struct
 	int _channel_index : 1;  // give a index of all available channels via local interface
@@ -1,42 +1,84 @@
 #ifndef __CURL_SESSION_PROVIDER_
 #define __CURL_SESSION_PROVIDER_
 
+#include <atomic>
+#include <condition_variable>
 #include <curl/curl.h>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <pthread.h>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 class CurlSessionProvider {
   public:
 	// non thread safe:
-	CurlSessionProvider();
+	// handlesPerKey: max. parallel sessions per key
+	// idleTimeout: in s. unused handles and connections are closed after that time
+	// prewarm: prewarm() resolves and connects in the background. otherwise it's a no-op
+	CurlSessionProvider(int handlesPerKey = 2, int idleTimeout = 120, bool prewarm = true);
 	~CurlSessionProvider();
 
 	// thread-safe functions:
 	CURL *get_easy_session(std::string key,
-						   int timeout = 0); // this is intended to block if the handle for the
-											 // current key is in use and single_session_per_key
+						   int timeout = 0); // this is intended to block if all handles for the
+											 // current key are in use. timeout in s, 0 = forever.
+											 // returns 0 on timeout
 	void return_session(std::string key, CURL *&); // return a handle. this unblocks another pending
-												   // request for this key if single_session_per_key
-	bool inUse(std::string key); // check whether a key is in use (does not guarantee that get...
-								 // will not block)
+												   // request for this key
+	bool inUse(std::string key); // check whether a handle for key is in use (does not guarantee
+								 // that get... will not block)
+	// resolve and connect to url with a session for key in the background. This fills the
+	// shared DNS and TLS session caches. Only the first call per key has an effect.
+	void prewarm(const std::string &key, const std::string &url);
 
   protected:
 	class CurlUsage {
 	  public:
-		CurlUsage() : eh(0), inUse(false) { mutex = PTHREAD_MUTEX_INITIALIZER; };
+		CurlUsage() : eh(0), inUse(false), lastUsed(0){};
 		CURL *eh;
 		bool inUse;
-		pthread_mutex_t mutex;
+		time_t lastUsed;
 	};
 
-	typedef std::map<std::string, CurlUsage>::iterator map_it;
-	typedef std::map<std::string, CurlUsage>::const_iterator cmap_it;
+	class Pool {
+	  public:
+		Pool() { cond = PTHREAD_COND_INITIALIZER; };
+		std::vector<CurlUsage> handles;
+		pthread_cond_t cond; // signalled when a handle is returned
+	};
 
-	std::map<std::string, CurlUsage> _easy_handle_map;
+	typedef std::map<std::string, Pool>::iterator map_it;
+	typedef std::map<std::string, Pool>::const_iterator cmap_it;
+
+	std::map<std::string, Pool> _easy_handle_map;
 
   private:
-	pthread_mutex_t _map_mutex;
+	CURL *new_session(); // with _map_mutex held
+	void setup(CURL *eh);
+	void expire(Pool &pool, time_t now); // with _map_mutex held
+	void prewarm_run();
+
+	static void share_lock(CURL *, curl_lock_data data, curl_lock_access, void *userptr);
+	static void share_unlock(CURL *, curl_lock_data data, void *userptr);
+
+	pthread_mutex_t _map_mutex; // protects _easy_handle_map
+	const size_t _handlesPerKey;
+	const int _idleTimeout;
+	const bool _prewarm;
+
+	CURLSH *_share; // DNS and TLS session cache for all handles
+	std::mutex _shareMutex[CURL_LOCK_DATA_LAST];
+
+	std::thread _warmThread;
+	std::atomic<bool> _warmStop;
+	std::mutex _warmMutex; // protects the following members
+	std::condition_variable _warmCond;
+	std::deque<std::pair<std::string, std::string>> _warmQueue;
+	std::set<std::string> _warmKeys;
 };
 
 // var to a global/single instance. needs to be initialzed e.g. in main()
@@ -0,0 +1,74 @@
+/*
+ * Per channel storage of the tuples served by the local interface.
+ * */
+
+#ifndef __local_buffer_hpp_
+#define __local_buffer_hpp_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+class ChannelData {
+  public:
+	ChannelData() : _t(0), _v(0.0) {};
+	ChannelData(const int64_t &t, const double &v) : _t(t), _v(v) {};
+	int64_t _t;
+	double _v;
+};
+
+/**
+ * Ring of tuples sorted by time. A size based buffer has a fixed capacity and overwrites the
+ * oldest tuple when full. A time based one grows as needed and is trimmed by expire().
+ * All methods are thread safe, each ring has its own lock.
+ */
+class LocalBuffer {
+  public:
+	LocalBuffer(size_t capacity, bool fixed);
+	LocalBuffer(const LocalBuffer &) = delete; // no copy constructor!
+
+	void add(const int64_t &t, const double &v);
+	size_t expire(const int64_t &minT); // remove tuples older than minT, returns their number
+
+	// copy the tuples with from <= _t <= to. With limit > 0 only the newest limit ones.
+	size_t range(const int64_t &from, const int64_t &to, size_t limit,
+				 std::vector<ChannelData> &out) const;
+	// number of tuples range() would return
+	size_t count(const int64_t &from, const int64_t &to, size_t limit) const;
+	// write at most max of the tuples range() would return as little endian columns: n int64
+	// timestamps followed by n doubles. buf needs 16 * max bytes. Returns n.
+	size_t columns(const int64_t &from, const int64_t &to, size_t limit, char *buf,
+				   size_t max) const;
+
+	size_t size() const;
+	size_t capacity() const;
+	uint64_t version() const; // changes with each add() and expire() removing tuples
+
+  protected:
+	const ChannelData &at(size_t i) const { return _ring[(_head + i) % _ring.size()]; }
+	ChannelData &at(size_t i) { return _ring[(_head + i) % _ring.size()]; }
+	size_t lower_bound(const int64_t &t) const; // first index with _t >= t
+	void bounds(const int64_t &from, const int64_t &to, size_t limit, size_t &first,
+				size_t &last) const; // [first, last) of a range
+	void grow();
+
+	mutable std::mutex _mutex; // protects the following members
+	std::vector<ChannelData> _ring;
+	size_t _head; // index of the oldest tuple in _ring
+	size_t _size;
+	bool _fixed;
+	uint64_t _version;
+};
+
+enum DownsampleMethod {
+	DOWNSAMPLE_LTTB,   // largest triangle three buckets, keeps the shape of the curve
+	DOWNSAMPLE_MINMAX, // min and max of each bucket, keeps spikes
+	DOWNSAMPLE_AVG     // mean time and value of each bucket
+};
+
+// reduce the time sorted tuples in to at most points tuples in one pass
+void downsample(const std::vector<ChannelData> &in, size_t points, DownsampleMethod method,
+				std::vector<ChannelData> &out);
+
+#endif
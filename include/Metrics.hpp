@@ -0,0 +1,39 @@
+/*
+ * State of the /metrics endpoint of the local interface and its prometheus text rendering.
+ * */
+
+#ifndef __metrics_hpp_
+#define __metrics_hpp_
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+class MetricsChannel {
+  public:
+	MetricsChannel() : _t(0), _v(0.0), _tuples(0), _valid(false) {};
+	std::string _meter;
+	std::string _protocol;
+	std::string _identifier;
+	int64_t _t;
+	double _v;
+	uint64_t _tuples; // number of tuples added to the local buffer
+	bool _valid;      // _t/_v are set
+};
+
+class MetricsMeter {
+  public:
+	MetricsMeter() : _readings(0), _periods(0) {};
+	std::string _protocol;
+	uint64_t _readings; // number of readings returned by the meter
+	uint64_t _periods;  // number of finished aggregation periods
+};
+
+// escape a label value according to the prometheus text format
+std::string metrics_label(const std::string &str);
+
+// render the channels (by uuid) and meters (by name) in the prometheus text format
+std::string metrics_render(const std::map<std::string, MetricsChannel> &channels,
+						   const std::map<std::string, MetricsMeter> &meters);
+
+#endif
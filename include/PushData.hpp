@@ -5,30 +5,72 @@
 #ifndef __push_data_hpp_
 #define __push_data_hpp_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <pthread.h>
 #include <queue>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility> // for std::pair
+#include <vector>
 
-// PushDataList provides a thread safe list
+// PushDataList provides a thread safe list.
+// Producers (the reading threads) push lock free onto a stack keyed by an interned channel id.
+// The consumer takes the whole stack at once after a coalescing window and hands the nodes back
+// to a free stack. Producers take that whole stack into a thread local cache, so in the steady
+// state add() does not allocate.
 class PushDataList {
   public:
 	typedef std::pair<int64_t, double> DataTuple;
 	typedef std::queue<DataTuple> DataQueue;
 	typedef std::unordered_map<std::string, DataQueue> DataMap;
 
-	PushDataList();
+	// window_ms: time to collect more data after the first new tuple. 0 returns immediately
+	// max_tuples: return earlier if that many tuples are pending
+	PushDataList(int window_ms = 200, size_t max_tuples = 500);
 	~PushDataList();
+	uint32_t intern(const std::string &uuid); // id for add(). ids are never reused.
+	void add(uint32_t id, const int64_t &time_ms, const double &value); // lock free
 	void add(const std::string &uuid, const int64_t &time_ms, const double &value);
-	DataMap *waitForData(); // blocks infinite until data is available. returned object is owned by
+	DataMap *waitForData(); // blocks max 5s until data is available. returned object is owned by
 							// caller! must be deleted after usage!
   protected:
-	DataMap *_next;
-	pthread_mutex_t _map_mutex;
-	pthread_cond_t _cond;
+	struct Node {
+		Node *next;
+		uint32_t id;
+		int64_t time_ms;
+		double value;
+	};
+	struct NodeCache { // nodes owned by one producer thread
+		NodeCache() : free(0) {}
+		~NodeCache();
+		Node *free;
+	};
+	Node *allocNode();
+
+	std::atomic<Node *> _head;
+	std::atomic<Node *> _free; // nodes given back by the consumer
+	static thread_local NodeCache _cache;
+	// pending tuples. incremented before the push, so it's never below the tuples in the
+	// list, but might be above for a moment. it just decides about waking the consumer early.
+	std::atomic<size_t> _count;
+
+	std::chrono::milliseconds _window;
+	size_t _maxTuples;
+
+	std::mutex _waitMutex; // only used to sleep/wake the consumer
+	std::condition_variable _cond;
+
+	std::mutex _internMutex;
+	std::unordered_map<std::string, uint32_t> _ids;
+	std::vector<std::string> _uuids;
 };
 
 // var to a global/single instance. needs to be initialzed e.g. in main()
@@ -39,7 +81,9 @@ class PushDataServer {
 	PushDataServer(struct json_object *option);
 	PushDataServer(const PushDataServer &) = delete; // no copy constructor!
 	~PushDataServer();
+	// waits for new data and queues it for each middleware. Doesn't wait for the delivery.
 	bool waitAndSendOnceToAll();
+	void stop(); // stops and joins the per middleware threads
 
   protected:
 	typedef struct {
@@ -47,15 +91,56 @@ class PushDataServer {
 		size_t size;
 	} CURLresponse;
 
+	// each middleware is served by its own thread with own queue, timeout and retry state
+	// so that one slow or unreachable middleware doesn't delay the others.
+	class Target {
+	  public:
+		Target(PushDataServer &server, const std::string &url)
+			: _server(server), _url(url), _timeout(30), _maxQueue(100), _retries(2), _cbor(false),
+			  _float32(false), _stop(false), _failures(0), _attempt(0), _sent(0), _failed(0),
+			  _dropped(0) {}
+		~Target() { stop(); }
+
+		bool enqueue(const std::string &data); // false if an old entry had to be dropped
+		void start();
+		void stop();
+
+		PushDataServer &_server;
+		std::string _url;
+		long _timeout;    // in s for one request
+		size_t _maxQueue; // pending requests, the oldest are dropped if exceeded
+		int _retries;     // additional attempts per request
+		bool _cbor;       // send application/cbor instead of application/json
+		bool _float32;    // cbor: values as float32 even if not exact
+
+		std::atomic<bool> _stop;
+		std::mutex _mutex;
+		std::condition_variable _cond;
+		std::thread _thread;
+		std::deque<std::string> _queue;
+		int _failures; // consecutive failures, used for the backoff
+		int _attempt;  // failed attempts of the request at the queue front
+		std::chrono::steady_clock::time_point _nextAttempt;
+		unsigned long _sent, _failed, _dropped; // statistics
+
+	  protected:
+		void run();
+	};
+
 	std::string generateJson(PushDataList::DataMap &dataMap);
-	bool send(const std::string &middleware, const std::string &datastr);
+	// {"data": [{"uuid": <uuid>, "t": [<ms>, <delta ms>, ...], "v": [<value>, ...]}, ...]}
+	std::string generateCbor(const PushDataList::DataMap &dataMap, bool float32);
+	bool send(const std::string &middleware, const std::string &datastr, long timeout = 30,
+			  const std::atomic<bool> *abort = 0, bool cbor = false);
 	friend class PushDataServerTest;
 
 	static size_t curl_custom_write_callback(void *ptr, size_t size, size_t nmemb, void *data);
 
-	typedef std::list<std::string> MiddlewareList;
+	typedef std::vector<std::unique_ptr<Target>> MiddlewareList;
 	MiddlewareList _middlewareList;
 	struct curl_slist *_headers;
+	struct curl_slist *_cborHeaders;
+	bool _started;
 };
 
 void *push_data_thread(void *arg);
@@ -106,6 +106,7 @@ class StringIdentifier : public ReadingIdentifier {
 	void parse(const char *buffer);
 	size_t unparse(char *buffer, size_t n);
 	bool operator==(StringIdentifier const &other) const { return _string == other._string; }
+	const std::string &string() const { return _string; }
 	const std::string toString() {
 		std::ostringstream oss;
 		oss << "StringIdentifier:";
@@ -190,6 +191,7 @@ class Reading {
 	void time_from_double(double const &d);
 
 	void identifier(ReadingIdentifier *rid) { _identifier.reset(rid); }
+	void identifier(const ReadingIdentifier::Ptr &rid) { _identifier = rid; } // shared, no copy
 	const ReadingIdentifier::Ptr identifier() { return _identifier; }
 
 	/**
@@ -0,0 +1,68 @@
+/*
+ * Serial devices shared by several meters, e.g. a RS-485 bus with many D0 or SML meters that
+ * answer addressed pull requests.
+ * */
+
+#ifndef __serial_bus_hpp_
+#define __serial_bus_hpp_
+
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <pthread.h>
+#include <string>
+
+/**
+ * Bus master for one device. Meters with the same device get the same bus and acquire() it for
+ * each poll, so only one request and its answer are on the wire at a time. The bus is granted in
+ * request order as soon as the previous poll is released. Each meter has to apply its own port
+ * settings (baudrate, parity) after acquire() as the previous one might have changed them.
+ */
+class SerialBus {
+  public:
+	typedef std::shared_ptr<SerialBus> Ptr;
+
+	class Stats {
+	  public:
+		Stats() : _polls(0), _waitMs(0.0), _maxWaitMs(0.0), _pollMs(0.0), _maxPollMs(0.0) {}
+		unsigned long _polls;
+		double _waitMs; // sum over all polls
+		double _maxWaitMs;
+		double _pollMs; // sum over all polls
+		double _maxPollMs;
+	};
+
+	// the bus for device. It exists as long as a meter holds a Ptr to it.
+	static Ptr get(const std::string &device);
+
+	explicit SerialBus(const std::string &device);
+	SerialBus(const SerialBus &) = delete;
+	~SerialBus();
+
+	// wait until meter has the bus exclusively. Cancellation point.
+	void acquire(const std::string &meter);
+	// end the poll of the current owner. With completed == false it is not counted.
+	void release(bool completed = true);
+
+	Stats stats(const std::string &meter) const;
+	const std::string &device() const { return _device; }
+
+  protected:
+	typedef std::chrono::steady_clock Clock;
+	class Waiter; // pthread cleanup state of acquire()
+	static void abandon(void *waiter);
+
+	std::string _device;
+	mutable pthread_mutex_t _mutex; // protects the following members
+	pthread_cond_t _cond;
+	std::list<unsigned long> _queue; // tickets of the waiting meters, first one is next
+	unsigned long _ticket;
+	bool _busy;
+	std::string _owner;
+	Clock::time_point _granted;
+	double _waitMs; // of the current owner
+	std::map<std::string, Stats> _stats; // by meter name
+};
+
+#endif
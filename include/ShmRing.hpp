@@ -0,0 +1,49 @@
+/*
+ * Shared memory ring for local consumers. See vzlogger_shm.h for the layout
+ * and the reader side.
+ * */
+
+#ifndef __shm_ring_hpp_
+#define __shm_ring_hpp_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Channel.hpp"
+#include "vzlogger_shm.h"
+
+struct json_object;
+
+class ShmRing {
+  public:
+	ShmRing(struct json_object *option);
+	ShmRing(const ShmRing &) = delete; // no copy constructor!
+	~ShmRing();
+
+	bool isConfigured() const { return _enabled; }
+	const std::string &name() const { return _name; }
+
+	// create the shm object with the channel table. channels unknown here are ignored by add()
+	bool open(const std::vector<Channel::Ptr> &channels);
+	void add(const Channel *ch, const int64_t &time_ms, const double &value); // thread safe
+
+  protected:
+	bool _enabled;
+	std::string _name; // shm_open name, e.g. /vzlogger
+	uint32_t _capacity;
+	int _mode;
+
+	struct vz_shm_header *_hdr;
+	struct vz_shm_record *_ring;
+	size_t _size;
+	std::unordered_map<const Channel *, uint32_t> _index; // channel -> index into channel table
+	std::mutex _writeMutex;                                // readers are lock free
+};
+
+// var to a global/single instance. initialized by Config_Options::config_parse
+extern ShmRing *shmRing;
+
+#endif
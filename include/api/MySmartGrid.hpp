@@ -38,6 +38,8 @@
 #include <Reading.hpp>
 #include <api/CurlIF.hpp>
 #include <api/CurlResponse.hpp>
+#include <memory>
+#include <mutex>
 
 namespace vz {
 namespace api {
@@ -58,7 +60,27 @@ class MySmartGrid : public ApiIF {
 	const std::string middleware() const { return _middleware; }
 
   private:
-	void _send(const std::string &url, json_object *json_obj);
+	/**
+	 * State shared by all channels of one device in batch mode
+	 */
+	class Device {
+	  public:
+		Device() : last(0), registered(false) {}
+		std::mutex mutex; // serializes send() of all members
+		std::list<MySmartGrid *> members;
+		time_t last;     // time of the last batch request
+		bool registered; // device registration sent
+	};
+	static std::shared_ptr<Device> _sharedDevice(const std::string &key);
+
+	// pause: call _retryPause() after a failure before returning
+	bool _send(const std::string &url, json_object *json_obj, bool pause = true);
+	void _retryPause();
+
+	/**
+	 * batch mode: one signed request with the heartbeat and the measurements of all sensors
+	 */
+	void _sendBatch();
 
 	/**
 	 * Parses JSON encoded exception and stores describtion in err
@@ -109,9 +131,12 @@ class MySmartGrid : public ApiIF {
 	std::list<Reading> _values;
 
 	time_t _first_ts;
+	time_t _sent_ts; // newest timestamp of the measurements sent, becomes _first_ts after a 200
 	long _first_counter;
 	long _last_counter;
 
+	std::shared_ptr<Device> _device; // only in batch mode
+
 }; // class MySmartGrid
 
 } // namespace api
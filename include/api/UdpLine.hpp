@@ -0,0 +1,72 @@
+/***********************************************************************/
+/** @file UdpLine.hpp
+ * Header file for the fire-and-forget UDP line protocol api
+ * (InfluxDB line protocol, Graphite plaintext or StatsD gauges)
+ *
+ * @copyright Copyright (c) 2026, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ **/
+/*---------------------------------------------------------------------*/
+
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UdpLine_hpp_
+#define _UdpLine_hpp_
+
+#include <ApiIF.hpp>
+#include <Options.hpp>
+
+namespace vz {
+namespace api {
+
+class UdpLine : public ApiIF {
+  public:
+	typedef vz::shared_ptr<ApiIF> Ptr;
+	typedef enum { FORMAT_INFLUXDB, FORMAT_GRAPHITE, FORMAT_STATSD } format_t;
+
+	UdpLine(const Channel::Ptr &ch, const std::list<Option> &options);
+	~UdpLine();
+
+	void send();
+
+	void register_device();
+
+  private:
+	bool open_socket();
+	void append_line(std::string &line, const Reading &r);
+	void send_datagram(const std::string &datagram);
+
+  private:
+	std::string _host;
+	int _port;
+	format_t _format;
+	std::string _measurement_name;
+	std::string _tags;
+	bool _send_uuid;
+	size_t _mtu; // max. payload per datagram
+	int _fd;
+
+	int64_t _last_timestamp; // remember last timestamp
+	double _last_value;      // duplicates support
+	bool _have_last;
+}; // class UdpLine
+
+} // namespace api
+} // namespace vz
+#endif // _UdpLine_hpp_
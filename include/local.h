@@ -43,7 +43,24 @@ MHD_RESULT handle_request(void *cls, struct MHD_Connection *connection, const ch
 						  size_t *upload_data_size, void **con_cls);
 
 class Channel;
+class MeterMap;
+class MapContainer;
 void shrink_localbuffer(); // remove old data in the local buffer
+// start/stop a thread calling shrink_localbuffer() every second for a time based local buffer
+// and answering comet requests after comet_timeout
+void start_local_housekeeping();
+void stop_local_housekeeping();
+// answer all comet requests and end all event streams. call before stopping the httpd
+void stop_local_waiters();
+// MHD_OPTION_NOTIFY_COMPLETED callback, frees the state of comet requests
+void request_completed(void *cls, struct MHD_Connection *connection, void **con_cls,
+					   enum MHD_RequestTerminationCode toe);
+// index the channels by uuid for handle_request and create their local buffers. needs to be
+// called before the meters and the httpd start, the buffers are not locked against it.
+// suspend: the httpd allows suspending connections (no thread per connection)
+void init_local_index(MapContainer &mappings, bool suspend);
 void add_ch_to_localbuffer(Channel &ch);
+// update the counters of this meter and publish a new snapshot for the /metrics endpoint
+void update_local_metrics(MeterMap &mapping, size_t readings);
 
 #endif /* _LOCAL_H_ */
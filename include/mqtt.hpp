@@ -8,6 +8,9 @@
 
 #include "Channel.hpp"
 #include "Reading.hpp"
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
@@ -23,13 +26,67 @@ class MqttClient {
 	~MqttClient();
 	bool isConfigured() const;
 
+	// precomputes the topics of all channels. Not thread safe, to be called before the
+	// reading threads are started. Channels not known here take the slower locked path.
+	void init(const std::vector<Channel::Ptr> &channels);
+
 	void publish(Channel::Ptr ch, Reading &rds,
 				 bool aggregate = false); // thread safe, non blocking
+
+	// batch mode: the reading thread collects the values of one period and publishes them
+	// with a single message per meter
+	struct BatchEntry {
+		BatchEntry(Channel::Ptr ch, const Reading &r)
+			: _ch(ch), _time_ms(r.time_ms()), _value(r.value()) {}
+		Channel::Ptr _ch;
+		int64_t _time_ms;
+		double _value;
+	};
+	typedef std::vector<BatchEntry> Batch;
+	bool batch() const { return _batch; }
+	void publish(const char *meterName, const Batch &batch,
+				 bool aggregate = false); // thread safe, non blocking
+	// end of a period: publish() the collected values, if any, and start a new batch
+	void flush(const char *meterName, Batch &batch, bool aggregate = false);
+
+	// outbound queue counters
+	struct Stats {
+		size_t _depth;             // messages queued now
+		size_t _maxDepth;          // high water mark
+		int _inflight;             // passed to libmosquitto but not confirmed yet
+		unsigned long _sent;       // passed to libmosquitto
+		unsigned long _dropped;    // dropped because the queue was full
+		unsigned long _superseded; // replaced by a newer message for the same topic
+	};
+	Stats stats();
+
   protected:
 	friend void *mqtt_client_thread(void *);
 	void connect_callback(struct mosquitto *mosq, int result);
 	void disconnect_callback(struct mosquitto *mosq, int result);
 	void message_callback(struct mosquitto *mosq, const struct mosquitto_message *msg);
+	void publish_callback(struct mosquitto *mosq, int mid);
+	void connect_v5_callback(struct mosquitto *mosq, int result, const void *props);
+
+	// publish() only queues the messages. The mqtt_client_thread sends them
+	// while connected and less than _maxInflight messages are unconfirmed.
+	enum class QueuePolicy {
+		DropOldest,  // drop the oldest message if the queue is full
+		DropNewest,  // don't queue new messages if the queue is full
+		LastPerTopic // replace a queued message with the same topic, else drop the oldest
+	};
+	struct ChannelEntry;
+	struct Message {
+		std::string _topic;
+		std::string _payload;
+		bool _retain;
+		bool _raw;                   // expires after _messageExpiry (v5)
+		const ChannelEntry *_entry;  // for user properties (v5), entries are never deleted
+	};
+	void enqueue(const std::string &topic, const char *payload, size_t len, bool retain,
+				 bool raw = false, const ChannelEntry *entry = nullptr);
+	void drain(); // mqtt_client_thread only
+	int publish_v5(const Message &m);
 
 	bool _enabled;
 	std::string _host;
@@ -48,23 +105,63 @@ class MqttClient {
 	std::string _id;
 	int _qos = 0;
 	bool _timestamp = false;
+	bool _cbor = false;    // payload encoding, json otherwise
+	bool _float32 = false; // cbor: values as float32 even if not exact
+	bool _batch = false;
+	std::string _batchTopic = "%m"; // relative to _topic, %m is replaced by the meter name
+	bool _batchRetain = false;
+
+	// MQTT v5 only:
+	bool _v5 = false;
+	int _messageExpiry = 0;      // in s for raw values, 0 = never
+	bool _topicAlias = true;     // use topic aliases as far as the broker allows
+	bool _userProperties = true; // uuid/id as user properties instead of announce messages
+	std::unordered_map<std::string, uint16_t> _aliases; // mqtt_client_thread only
+	uint16_t _aliasMax = 0;                             // announced by the broker in CONNACK
+	uint16_t _nextAlias = 1;                            // never reused within a connection
+
+	size_t _queueSize = 1000;
+	QueuePolicy _queuePolicy = QueuePolicy::DropOldest;
+	int _maxInflight = 20;
 
 	bool _isConnected = false;
 
+	std::mutex _queueMutex; // protects the following members
+	std::deque<Message> _queue;
+	std::unordered_map<std::string, Message *> _queuedTopics; // LastPerTopic only
+	size_t _maxDepth = 0;
+	unsigned long _sent = 0;
+	unsigned long _dropped = 0;
+	unsigned long _superseded = 0;
+	std::atomic<int> _inflight{0};
+
 	struct mosquitto *_mcs = nullptr; // mosquitto client session data
 
 	struct ChannelEntry {
-		bool _announced = false;
+		std::atomic<bool> _announced{false};
 		bool _sendRaw = true;
 		bool _sendAgg = true;
+		std::string _name; // channel part of the topic, key in batch messages
 		std::string _fullTopicRaw;
 		std::string _fullTopicAgg;
 		std::string _announceName;
 		std::vector<std::pair<std::string, std::string>> _announceValues;
 		void generateNames(const std::string &prefix, Channel &ch);
 	};
+	void setupEntry(ChannelEntry &entry, Channel &ch);
+	void announce(ChannelEntry &entry);
+	ChannelEntry &channelEntry(Channel &ch); // needs _chMapMutex to be locked
+
+	// entries by Channel::index(). Filled by init() and read only afterwards, so no lock needed
+	std::vector<std::unique_ptr<ChannelEntry>> _slots;
+	ChannelEntry *slot(const Channel &ch) const {
+		size_t idx = ch.index();
+		return idx < _slots.size() ? _slots[idx].get() : nullptr;
+	}
+
+	// fallback for channels not passed to init()
 	std::mutex _chMapMutex;
-	std::unordered_map<std::string, ChannelEntry> _chMap;
+	std::unordered_map<std::string, std::unique_ptr<ChannelEntry>> _chMap;
 };
 
 extern MqttClient *mqttClient;
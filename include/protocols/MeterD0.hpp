@@ -31,8 +31,11 @@
 
 #define D0_BUFFER_LENGTH 1024
 
+#include <string>
 #include <termios.h>
+#include <unordered_map>
 
+#include <SerialBus.hpp>
 #include <protocols/Protocol.hpp>
 
 class MeterD0 : public vz::protocol::Protocol {
@@ -66,9 +69,25 @@ class MeterD0 : public vz::protocol::Protocol {
 	int _baudrate_change_delay_ms;
 	int _reaction_time_ms; // reaction time t_r according to 62056-21
 
+	// identifiers by the raw OBIS code of a telegram line. A meter sends the same few codes in
+	// every telegram, so they are parsed once and the readings share the identifier.
+	std::unordered_map<std::string, ReadingIdentifier::Ptr> _obisCache; // null if invalid
+	ReadingIdentifier::Ptr _obisIdentifier(const char *obis_code);
+
 	int _fd; /* file descriptor of port */
+	// input is read in chunks, the state machine takes it byte by byte from here. Bytes behind
+	// the end of a telegram are kept for the next read(), in pull mode they are dropped with
+	// the pending input before the request is sent.
+	char _rbuf[D0_BUFFER_LENGTH];
+	size_t _rpos; // next byte to parse
+	size_t _rlen; // bytes in _rbuf
 	FILE *_dump_fd;
 	struct termios _oldtio; /* required to reset port */
+	struct termios _tio;    /* our settings, reapplied for each poll on a shared bus */
+	// pull meters on a device share it with the other meters on the same device
+	SerialBus::Ptr _bus;
+
+	ssize_t _read(std::vector<Reading> &rds, size_t n);
 
 	/**
 	 * Open socket
@@ -80,6 +99,25 @@ class MeterD0 : public vz::protocol::Protocol {
 	int _openSocket(const char *node, const char *service);
 	int _openDevice(struct termios *old_tio, speed_t baudrate);
 
+	/**
+	 * Fill _rbuf with what arrives within timeout_ms (one read() call)
+	 * @return number of bytes added, 0 on timeout, -1 on error or closed connection
+	 */
+	ssize_t _fill(int timeout_ms);
+	/**
+	 * Next input byte, waits up to timeout_ms if none is buffered
+	 * @return 1 with byte set, 0 on timeout, -1 on error or closed connection
+	 */
+	int _readByte(char &byte, int timeout_ms) {
+		if (_rpos == _rlen) {
+			ssize_t res = _fill(timeout_ms);
+			if (res <= 0)
+				return res;
+		}
+		byte = _rbuf[_rpos++];
+		return 1;
+	}
+
 	enum DUMP_MODE { NONE, CTRL, DUMP_IN, DUMP_OUT };
 	DUMP_MODE _old_mode;
 	int _dump_pos;
@@ -0,0 +1,117 @@
+/**
+ * Subscribe to topics on a MQTT broker
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2026, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _METER_MQTT_H_
+#define _METER_MQTT_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <protocols/Protocol.hpp>
+
+struct mosquitto;
+struct mosquitto_message;
+struct json_object;
+struct json_tokener;
+
+/**
+ * Readings are received by the libmosquitto network thread and queued until read() picks
+ * them up. Topics without a "map" entry give readings with the topic as identifier. JSON
+ * payloads give one reading per numeric field, "<topic>/<field>" (nested fields separated
+ * by "/").
+ */
+class MeterMQTT : public vz::protocol::Protocol {
+
+  public:
+	MeterMQTT(std::list<Option> options);
+	virtual ~MeterMQTT();
+
+	int open();
+	int close();
+	ssize_t read(std::vector<Reading> &rds, size_t n);
+	bool allowInterval() const { return false; } // values come when they are published
+
+	const std::vector<std::string> &topics() const { return _topics; }
+	size_t dropped() const;
+
+  protected:
+	// parse one message and queue its readings. returns the number of readings queued.
+	size_t handle(const char *topic, const char *payload, size_t len);
+
+  private:
+	struct Mapping {
+		std::string identifier; // for plain numbers and as prefix for JSON fields
+		std::unordered_map<std::string, std::string> fields; // JSON path -> identifier, if
+															  // set only these fields are used
+	};
+	struct Sample {
+		ReadingIdentifier::Ptr identifier; // shared with _identifiers and the readings
+		double value;
+		int64_t time_ms;
+	};
+
+	void parse_map(struct json_object *jso);
+	void add_json(const Mapping *mapping, const std::string &topic, std::string &path,
+				  struct json_object *jso, int64_t time_ms, std::vector<Sample> &out);
+	ReadingIdentifier::Ptr intern(const std::string &identifier);
+	int64_t json_time(struct json_object *jso, int64_t now_ms) const;
+	void connect_callback(int result);
+	void message_callback(const struct mosquitto_message *msg);
+
+	std::string _host;
+	int _port;
+	std::string _user;
+	std::string _pass;
+	std::string _id;
+	std::string _cafile;
+	std::string _capath;
+	std::string _certfile;
+	std::string _keyfile;
+	int _keepalive;
+	int _qos;
+	std::vector<std::string> _topics; // subscriptions, might contain + and # wildcards
+	std::unordered_map<std::string, Mapping> _map; // topic -> identifiers
+	bool _unmapped;       // accept topics without _map entry
+	std::string _timeField; // JSON field with the timestamp (s or ms), default is receive time
+	size_t _queueSize;
+
+	struct mosquitto *_mosq;
+	struct json_tokener *_tok; // network thread only
+
+	// identifiers are interned once so that samples and readings don't allocate.
+	// network thread only.
+	std::unordered_map<std::string, ReadingIdentifier::Ptr> _identifiers;
+
+	mutable std::mutex _mutex; // protects the following members
+	std::condition_variable _cond;
+	std::deque<Sample> _queue;
+	size_t _dropped;
+};
+
+#endif /* _METER_MQTT_H_ */
@@ -48,6 +48,13 @@ class MeterS0 : public vz::protocol::Protocol {
 		virtual bool waitForImpulse(bool &timeout) = 0; // blocking interface
 		virtual int status() = 0; // non blocking IO status (<0 = ERR, 0 = low, 1 = high)
 		virtual bool is_blocking() const = 0;
+
+		// batched blocking interface of HWIFs with timestamped events (has_timestamps()):
+		// waits up to 1s and stores the CLOCK_REALTIME times of up to max impulses in ts.
+		// Returns their number, 0 on timeout, <0 on error.
+		virtual int waitForImpulses(struct timespec *ts, int max) { return -1; }
+		virtual bool has_timestamps() const { return false; }
+		virtual bool is_debounced() const { return false; } // the hw debounces already
 	};
 
 	class HWIF_UART : public HWIF {
@@ -85,6 +92,32 @@ class MeterS0 : public vz::protocol::Protocol {
 		std::string _device;
 	};
 
+	// GPIO character device (/dev/gpiochipN) with v2 line requests
+	class HWIF_GPIOCDEV : public HWIF {
+	  public:
+		HWIF_GPIOCDEV(const std::string &chip, int line, const std::list<Option> &options,
+					  bool edges = true);
+		virtual ~HWIF_GPIOCDEV();
+
+		virtual bool _open();
+		virtual bool _close();
+		virtual bool waitForImpulse(bool &timeout);
+		virtual int status();
+		virtual bool is_blocking() const { return true; }
+		virtual int waitForImpulses(struct timespec *ts, int max);
+		virtual bool has_timestamps() const { return _edges; }
+		virtual bool is_debounced() const { return _debounced; }
+
+	  protected:
+		std::string _chip;
+		int _line;
+		bool _edges; // request rising edge events, false for a line that is only read (gpio_dir)
+		int _debounce_ms;
+		int _fd;         // line request
+		bool _debounced; // the kernel debounces the line
+		bool _realtime;  // event timestamps are CLOCK_REALTIME, else CLOCK_MONOTONIC
+	};
+
 	class HWIF_MMAP : public HWIF {
 	  public:
 		HWIF_MMAP(int gpiopin, const std::string &hw);
@@ -1,5 +1,5 @@
 /**
- * Wrapper around libsml
+ * SML meter, the frames are decoded in place by SmlDecoder
  *
  * @package vzlogger
  * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
@@ -30,13 +30,16 @@
 #ifndef _SML_H_
 #define _SML_H_
 
-#include <sml/sml_file.h>
-#include <sml/sml_value.h>
+#define SML_BUFFER_LEN 8096
 
+#include <sys/time.h>
 #include <termios.h>
+#include <unordered_map>
 
 #include "Obis.hpp"
+#include <SerialBus.hpp>
 #include <protocols/Protocol.hpp>
+#include <protocols/SmlDecoder.hpp>
 
 class MeterSML : public vz::protocol::Protocol {
 
@@ -68,23 +71,55 @@ class MeterSML : public vz::protocol::Protocol {
 
 	int _fd;                 /* file descriptor of port */
 	struct termios _old_tio; /* required to reset port */
+	struct termios _tio;     /* our settings, reapplied for each poll on a shared bus */
+	// pull meters on a device share it with the other meters on the same device
+	SerialBus::Ptr _bus;
 
 	const int BUFFER_LEN;
 
+	// received data, the frames are decoded in place. A TCP gateway might send several
+	// frames at once, the ones behind the first are kept for the next read().
+	unsigned char _rbuf[SML_BUFFER_LEN];
+	size_t _rlen;           // bytes in _rbuf
+	SmlDecoder::Held _held; // a frame at the start of _rbuf that did not fit into rds
+
+	// identifiers by the 6 byte objName, shared by the readings of all frames
+	std::unordered_map<uint64_t, ReadingIdentifier::Ptr> _obisCache;
+	ReadingIdentifier::Ptr _obisIdentifier(const Obis &obis, uint64_t key);
+
 	/**
 	 * @brief reopen the underlying device. We do this to workaround issue #362
 	 * @return true if reopen was successful. False otherwise.
 	 * */
 	bool reopen();
 
+	ssize_t _read(std::vector<Reading> &rds, size_t n);
+
+	/**
+	 * Fill _rbuf with what arrives (one read() call), blocks until there is data
+	 * @return number of bytes added, 0 if interrupted, -1 on error or closed connection
+	 */
+	ssize_t _fill();
+
+	/**
+	 * Decode the complete frames in _rbuf and remove them. A frame is only started if all
+	 * its entries fit into rds, the others are left in _rbuf for the next call.
+	 *
+	 * @param m number of readings in rds so far, incremented for each new one
+	 * @return number of frames
+	 */
+	size_t _decode(std::vector<Reading> &rds, size_t &m, size_t n);
+	class FrameVisitor;
+
 	/**
 	 * Parses SML list entry and stores it in reading pointed by rd
 	 *
-	 * @param list the list entry
+	 * @param e the list entry
 	 * @param rd the reading to store to
+	 * @param now local time of the frame, set on first use
 	 * @return true if it is a valid entry
 	 */
-	bool _parse(sml_list *list, Reading *rd);
+	bool _parse(const SmlDecoder::Entry &e, Reading *rd, struct timeval &now);
 
 	/**
 	 * Open serial port by device
@@ -0,0 +1,100 @@
+/**
+ * Read SML from many TCP sources (e.g. IR heads with a network interface) in one thread
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2026, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _METER_SML_GATEWAY_H_
+#define _METER_SML_GATEWAY_H_
+
+#include <memory>
+#include <string>
+#include <sys/time.h>
+#include <unordered_map>
+#include <vector>
+
+#include <protocols/MeterSML.hpp>
+#include <protocols/Protocol.hpp>
+#include <protocols/SmlDecoder.hpp>
+
+/**
+ * All sources are non-blocking connections in one epoll set. A source that fails to connect,
+ * closes the connection or stays silent for read_timeout is reconnected after a delay that
+ * doubles up to reconnect_max_delay. Readings get a StringIdentifier
+ * "<source id>/<OBIS code>", e.g. "flat12/1-0:1.8.0*255".
+ */
+class MeterSMLGateway : public vz::protocol::Protocol {
+
+  public:
+	MeterSMLGateway(std::list<Option> options);
+	virtual ~MeterSMLGateway();
+
+	int open();
+	int close();
+	ssize_t read(std::vector<Reading> &rds, size_t n);
+	bool allowInterval() const { return false; } // values come when the meters send them
+
+	size_t sources() const { return _sources.size(); }
+	const std::string &source(size_t i) const { return _sources[i]->_id; }
+	bool connected(size_t i) const { return _sources[i]->_state == Source::CONNECTED; }
+
+  protected:
+	class Source {
+	  public:
+		enum State { IDLE, CONNECTING, CONNECTED };
+
+		Source(const std::string &id, const std::string &host);
+
+		std::string _id; // identifier prefix
+		std::string _node;
+		std::string _service;
+		int _fd;
+		State _state;
+		int64_t _retry;    // IDLE: time of the next connect, ms
+		int64_t _deadline; // CONNECTING, CONNECTED: connect or read timeout, ms
+		int _delay;        // next reconnect delay, ms
+		bool _pending;     // _buf has frames that did not fit into the last read()
+		unsigned char _buf[SML_BUFFER_LEN];
+		size_t _len;
+		SmlDecoder::Held _held; // a frame at the start of _buf that did not fit into rds
+		std::unordered_map<uint64_t, ReadingIdentifier::Ptr> _ids; // by objName
+	};
+	class FrameVisitor;
+
+	void parse_sources(struct json_object *jso);
+	int timers(int64_t now); // returns the epoll_wait timeout
+	void connect_source(Source &s, int64_t now);
+	void established(Source &s, int64_t now);
+	void disconnect(Source &s, int64_t now, const char *reason);
+	void receive(Source &s, int64_t now);
+	void decode(Source &s, std::vector<Reading> &rds, size_t &m, size_t n);
+	bool parse(Source &s, const SmlDecoder::Entry &e, Reading *rd, struct timeval &now);
+
+	std::vector<std::unique_ptr<Source>> _sources;
+	int _reconnectDelay;    // ms
+	int _reconnectMaxDelay; // ms
+	int _connectTimeout;    // s
+	int _readTimeout;       // s
+	bool _use_local_time;
+	int _epfd;
+};
+
+#endif /* _METER_SML_GATEWAY_H_ */
@@ -0,0 +1,110 @@
+/**
+ * Streaming decoder for SML (Smart Message Language) as sent by electricity meters
+ *
+ * Frames are located and checked in the receive buffer and the GetListResponse entries are
+ * visited in place, without building an object tree.
+ *
+ * @copyright Copyright (c) 2026, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SML_DECODER_H_
+#define _SML_DECODER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+class SmlDecoder {
+  public:
+	enum Result {
+		NONE,     // no complete frame yet
+		FRAME,    // a complete frame
+		BAD_FRAME // a complete frame with a wrong checksum or an invalid escape sequence
+	};
+
+	// one entry of the valList of a GetListResponse. Pointers refer to the decoded frame.
+	class Entry {
+	  public:
+		enum ValueType { VALUE_NONE, VALUE_NUMBER, VALUE_OCTETS };
+
+		const unsigned char *_objName;
+		size_t _objNameLen;
+		bool _hasUnit;
+		uint8_t _unit;
+		bool _hasScaler;
+		int8_t _scaler;
+		bool _hasTime;
+		uint32_t _time; // seconds, a timestamp or a sensor time (secIndex)
+		ValueType _valueType;
+		double _number;
+		const unsigned char *_octets;
+		size_t _octetsLen;
+	};
+
+	class Visitor {
+	  public:
+		virtual ~Visitor() {}
+		// called for each entry, return false to skip the rest of the frame
+		virtual bool entry(const Entry &e) = 0;
+	};
+
+	// a frame found by frame() that the caller keeps for later. frame() has unescaped it in
+	// place, so it can't be found again. Offsets are relative to the buffer passed to frame().
+	class Held {
+	  public:
+		Held() : _used(0), _body(0), _len(0) {}
+		size_t _used; // 0: none
+		size_t _body;
+		size_t _len;
+	};
+
+	/**
+	 * Find the next frame in buf. The escape sequences in it are removed in place.
+	 *
+	 * @param used set to the number of bytes that are done with: the frame and anything before
+	 *  it. With NONE the bytes before a possible start of a frame.
+	 * @param body set to the messages of the frame (inside buf) with FRAME
+	 * @param body_len set to their length, without padding
+	 */
+	static Result frame(unsigned char *buf, size_t len, size_t &used, const unsigned char *&body,
+						size_t &body_len);
+
+	/**
+	 * Visit the entries of all GetListResponse messages in body
+	 * @return false if the messages are malformed. Entries before the error have been visited.
+	 */
+	static bool parse(const unsigned char *body, size_t len, Visitor &visitor);
+
+	// number of entries parse() visits in body, at most max_entries(len)
+	static size_t entries(const unsigned char *body, size_t len);
+	// a list entry has 7 elements with at least one byte each plus its own type-length byte
+	static size_t max_entries(size_t len) { return len / 8; }
+
+	// 10^scaler from a table
+	static double scale(int8_t scaler) { return _scale[scaler + 128]; }
+
+	// CRC16 (X.25) as used for the frame checksum
+	static uint16_t crc16(const unsigned char *buf, size_t len);
+
+  private:
+	static const double *const _scale;
+};
+
+#endif /* _SML_DECODER_H_ */
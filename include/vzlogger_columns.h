@@ -0,0 +1,98 @@
+/***********************************************************************/
+/** @file vzlogger_columns.h
+ * Layout of the binary columnar format served by the local interface with
+ * ?format=binary. This header is plain C and has no dependencies on the rest
+ * of vzlogger.
+ *
+ * The response body is a sequence of frames, one per channel. Each frame is
+ *   struct vz_columns_frame
+ *   uuid                 uuid_len bytes, zero padded to a multiple of 8
+ *   int64_t time_ms[count]
+ *   double value[count]  IEEE 754 binary64
+ * All integers and doubles are little endian, so a reader on a little endian
+ * host can use the columns in place (they are 8 byte aligned relative to the
+ * start of the body):
+ *
+ *   const char *p = body, *end = body + len;
+ *   while (p + sizeof(struct vz_columns_frame) <= end) {
+ *       const struct vz_columns_frame *f = (const struct vz_columns_frame *)p;
+ *       if (f->magic != VZ_COLUMNS_MAGIC || f->version != VZ_COLUMNS_VERSION)
+ *           break;
+ *       const int64_t *t = (const int64_t *)vz_columns_time(f);
+ *       const double *v = (const double *)vz_columns_value(f);
+ *       use(vz_columns_uuid(f), f->uuid_len, t, v, f->count);
+ *       p += vz_columns_size(f);
+ *   }
+ *
+ * @copyright Copyright (c) 2026, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ **/
+/*---------------------------------------------------------------------*/
+
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _VZLOGGER_COLUMNS_H_
+#define _VZLOGGER_COLUMNS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VZ_COLUMNS_MAGIC 0x46435a56u /* "VZCF" */
+#define VZ_COLUMNS_VERSION 1u
+
+struct vz_columns_frame {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t uuid_len; /* without padding */
+	uint64_t count;    /* tuples in the frame */
+};
+
+/* uuid_len rounded up to the next multiple of 8 */
+static inline size_t vz_columns_uuid_size(uint16_t uuid_len) { return (uuid_len + 7u) & ~7u; }
+
+/* size of a frame with the given uuid length and number of tuples */
+static inline size_t vz_columns_frame_size(uint16_t uuid_len, uint64_t count) {
+	return sizeof(struct vz_columns_frame) + vz_columns_uuid_size(uuid_len) + 16 * count;
+}
+
+static inline size_t vz_columns_size(const struct vz_columns_frame *f) {
+	return vz_columns_frame_size(f->uuid_len, f->count);
+}
+
+static inline const char *vz_columns_uuid(const struct vz_columns_frame *f) {
+	return (const char *)(f + 1);
+}
+
+static inline const char *vz_columns_time(const struct vz_columns_frame *f) {
+	return vz_columns_uuid(f) + vz_columns_uuid_size(f->uuid_len);
+}
+
+static inline const char *vz_columns_value(const struct vz_columns_frame *f) {
+	return vz_columns_time(f) + 8 * f->count;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _VZLOGGER_COLUMNS_H_ */
@@ -0,0 +1,187 @@
+/***********************************************************************/
+/** @file vzlogger_shm.h
+ * Layout of the shared memory ring written by vzlogger ("shm" section in
+ * vzlogger.conf) and inline helpers for local readers. This header is
+ * plain C (gnu99 or later, needs GCC/clang __atomic builtins) and has no
+ * dependencies on the rest of vzlogger.
+ *
+ * The object is created with shm_open(3) under the configured name (default
+ * "/vzlogger", i.e. /dev/shm/vzlogger). Readers map it read-only, also to block
+ * in vz_shm_wait(). They only need read permission, the "mode" of the object
+ * (default 0644) decides which users can read it.
+ *
+ *   int fd = shm_open("/vzlogger", O_RDONLY, 0);
+ *   struct stat st; fstat(fd, &st);
+ *   const struct vz_shm_header *h = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+ *   uint64_t pos = vz_shm_head(h); // start with new readings only
+ *   for (;;) {
+ *       struct vz_shm_record r;
+ *       uint32_t f = vz_shm_futex(h);
+ *       while (pos < vz_shm_head(h)) {
+ *           int res = vz_shm_read(h, pos, &r);
+ *           if (res == -2)
+ *               break; // being written, try again after waiting
+ *           if (res == 0)
+ *               use(vz_shm_channels(h)[r.channel].uuid, r.time_ms, r.value);
+ *           else
+ *               ; // overwritten, the reader was too slow
+ *           pos++;
+ *       }
+ *       if (!vz_shm_valid(h))
+ *           break; // vzlogger stopped, map the object again
+ *       vz_shm_wait(h, f, 1000);
+ *   }
+ *
+ * @copyright Copyright (c) 2026, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ **/
+/*---------------------------------------------------------------------*/
+
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _VZLOGGER_SHM_H_
+#define _VZLOGGER_SHM_H_
+
+#include <stdint.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VZ_SHM_MAGIC 0x525a5a56u /* "VZZR", cleared when vzlogger stops */
+#define VZ_SHM_VERSION 2u
+#define VZ_SHM_UUID_LEN 40
+#define VZ_SHM_NAME_LEN 24
+#define VZ_SHM_READ_RETRIES 1000 /* vz_shm_read() attempts on a record being written */
+
+/*
+ * The mapping consists of
+ *   struct vz_shm_header
+ *   struct vz_shm_channel[channels]  at channel_offset
+ *   struct vz_shm_record[capacity]   at ring_offset, capacity is a power of two
+ * All offsets are in bytes from the start of the mapping. Integers are in host byte order.
+ */
+struct vz_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t record_size;
+	uint32_t capacity;       /* number of records in the ring */
+	uint32_t channels;       /* number of entries in the channel table */
+	uint32_t channel_offset; /* offset of the channel table */
+	uint32_t ring_offset;    /* offset of the ring */
+	uint64_t head;           /* records written so far. record n is in slot n & (capacity - 1) */
+	uint32_t futex;          /* incremented and woken (FUTEX_WAKE) after each record */
+	uint32_t reserved0;
+	int64_t start_time; /* unix time the ring was created */
+	uint64_t reserved;
+}; /* 64 bytes */
+
+struct vz_shm_channel {
+	char uuid[VZ_SHM_UUID_LEN]; /* NUL terminated */
+	char name[VZ_SHM_NAME_LEN]; /* NUL terminated, might be truncated */
+}; /* 64 bytes */
+
+struct vz_shm_record {
+	uint32_t seq;     /* seqlock, odd while the record is being written */
+	uint32_t channel; /* index into the channel table */
+	uint64_t pos;     /* absolute number of this record */
+	int64_t time_ms;  /* timestamp in ms since the epoch */
+	double value;
+}; /* 32 bytes */
+
+static inline int vz_shm_valid(const struct vz_shm_header *h) {
+	return __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) == VZ_SHM_MAGIC &&
+		   h->version == VZ_SHM_VERSION;
+}
+
+static inline const struct vz_shm_channel *vz_shm_channels(const struct vz_shm_header *h) {
+	return (const struct vz_shm_channel *)((const char *)h + h->channel_offset);
+}
+
+static inline const struct vz_shm_record *vz_shm_ring(const struct vz_shm_header *h) {
+	return (const struct vz_shm_record *)((const char *)h + h->ring_offset);
+}
+
+static inline uint64_t vz_shm_head(const struct vz_shm_header *h) {
+	return __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t vz_shm_futex(const struct vz_shm_header *h) {
+	return __atomic_load_n(&h->futex, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Copy record pos to *out.
+ * Returns 0 on success, 1 if it is not written yet, -1 if it was overwritten already and -2 if
+ * it stayed inconsistent for VZ_SHM_READ_RETRIES attempts (the writer was preempted or died).
+ */
+static inline int vz_shm_read(const struct vz_shm_header *h, uint64_t pos,
+							  struct vz_shm_record *out) {
+	const struct vz_shm_record *r = vz_shm_ring(h) + (pos & (h->capacity - 1));
+	uint32_t s1, s2;
+	int retries = VZ_SHM_READ_RETRIES;
+
+	if (pos >= vz_shm_head(h))
+		return 1;
+	for (;;) {
+		if (!retries--)
+			return -2;
+		s1 = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+		if (!(s1 & 1)) {
+			out->channel = __atomic_load_n(&r->channel, __ATOMIC_RELAXED);
+			out->pos = __atomic_load_n(&r->pos, __ATOMIC_RELAXED);
+			out->time_ms = __atomic_load_n(&r->time_ms, __ATOMIC_RELAXED);
+			__atomic_load(&r->value, &out->value, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			s2 = __atomic_load_n(&r->seq, __ATOMIC_RELAXED);
+			if (s1 == s2)
+				break;
+		}
+	}
+	out->seq = s1;
+	return out->pos == pos ? 0 : -1;
+}
+
+#ifdef __linux__
+/*
+ * Block until the futex counter differs from val (as returned by vz_shm_futex() before
+ * checking vz_shm_head()) or timeout_ms elapsed. Returns immediately if a record was
+ * written in between. Works with a read-only mapping, nothing is written.
+ */
+static inline void vz_shm_wait(const struct vz_shm_header *h, uint32_t val, int timeout_ms) {
+	struct timespec ts;
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+	syscall(SYS_futex, &h->futex, FUTEX_WAIT, val, timeout_ms >= 0 ? &ts : 0, 0, 0);
+}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _VZLOGGER_SHM_H_ */
@@ -0,0 +1,59 @@
+/*
+ * Minimal CBOR (RFC 8949) encoder for push and mqtt payloads.
+ * */
+
+#include "Cbor.hpp"
+#include <cstring>
+
+void CborWriter::head(uint8_t major, uint64_t v) {
+	major <<= 5;
+	if (v < 24) {
+		_out += (char)(major | v);
+		return;
+	}
+	int bytes;
+	if (v <= 0xff) {
+		_out += (char)(major | 24);
+		bytes = 1;
+	} else if (v <= 0xffff) {
+		_out += (char)(major | 25);
+		bytes = 2;
+	} else if (v <= 0xffffffffULL) {
+		_out += (char)(major | 26);
+		bytes = 4;
+	} else {
+		_out += (char)(major | 27);
+		bytes = 8;
+	}
+	for (int i = bytes - 1; i >= 0; i--) // network byte order
+		_out += (char)((v >> (8 * i)) & 0xff);
+}
+
+void CborWriter::string(const char *str, size_t len) {
+	head(3, len);
+	_out.append(str, len);
+}
+
+void CborWriter::integer(int64_t v) {
+	if (v >= 0)
+		head(0, v);
+	else
+		head(1, -1 - v);
+}
+
+void CborWriter::number(double v) {
+	float f = v;
+	if (_float32 || (double)f == v || v != v) { // NaN has no exact comparison but fits as well
+		uint32_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		_out += (char)0xfa; // major type 7, float32
+		for (int i = 3; i >= 0; i--)
+			_out += (char)((bits >> (8 * i)) & 0xff);
+	} else {
+		uint64_t bits;
+		memcpy(&bits, &v, sizeof(bits));
+		_out += (char)0xfb; // major type 7, float64
+		for (int i = 7; i >= 0; i--)
+			_out += (char)((bits >> (8 * i)) & 0xff);
+	}
+}
@@ -29,6 +29,7 @@
 #include <stdio.h>
 
 #include "Channel.hpp"
+#include "ShmRing.hpp"
 #include "config.hpp"
 #include <Config_Options.hpp>
 #include <VZException.hpp>
@@ -41,14 +42,16 @@ static const char *option_type_str[] = {"null",   "boolean", "double", "int",
 
 Config_Options::Config_Options()
 	: _config("/etc/vzlogger.conf"), _log(""), _pds(0), _port(8080), _verbosity(0),
-	  _comet_timeout(30), _buffer_length(-1), _retry_pause(15), _local(false), _foreground(false),
-	  _time_machine(false) {
+	  _comet_timeout(30), _buffer_length(-1), _local_threads(4), _retry_pause(15),
+	  _push_window(200), _push_tuples(500), _curl_handles(2), _curl_idle(120), _curl_prewarm(true),
+	  _local(false), _foreground(false), _time_machine(false) {
 	_logfd = NULL;
 }
 
 Config_Options::Config_Options(const std::string filename)
 	: _config(filename), _log(""), _pds(0), _port(8080), _verbosity(0), _comet_timeout(30),
-	  _buffer_length(-1), _retry_pause(15), _local(false), _foreground(false),
+	  _buffer_length(-1), _local_threads(4), _retry_pause(15), _push_window(200), _push_tuples(500),
+	  _curl_handles(2), _curl_idle(120), _curl_prewarm(true), _local(false), _foreground(false),
 	  _time_machine(false) {
 	_logfd = NULL;
 }
@@ -146,6 +149,10 @@ void Config_Options::config_parse(MapContainer &mappings) {
 								-1; // 0 makes no sense, use size based mode with 1 element
 					} else if (strcmp(key, "index") == 0 && local_type == json_type_boolean) {
 						_channel_index = json_object_get_boolean(local_value);
+					} else if (strcmp(key, "threads") == 0 && local_type == json_type_int) {
+						_local_threads = json_object_get_int(local_value);
+						if (_local_threads < 0)
+							_local_threads = 0;
 					} else {
 						print(log_alert, "Ignoring invalid field or type: %s=%s (%s)", NULL, key,
 							  json_object_get_string(local_value), option_type_str[local_type]);
@@ -165,6 +172,27 @@ void Config_Options::config_parse(MapContainer &mappings) {
 				} else
 					print(log_error, "Ignoring push entry due to empty array or duplicate section",
 						  "push");
+			} else if ((strcmp(key, "push_window") == 0) && type == json_type_int) {
+				_push_window = json_object_get_int(value);
+			} else if ((strcmp(key, "push_tuples") == 0) && type == json_type_int) {
+				_push_tuples = json_object_get_int(value);
+			} else if ((strcmp(key, "curl_handles") == 0) && type == json_type_int) {
+				_curl_handles = json_object_get_int(value);
+			} else if ((strcmp(key, "curl_idle") == 0) && type == json_type_int) {
+				_curl_idle = json_object_get_int(value);
+			} else if ((strcmp(key, "curl_prewarm") == 0) && type == json_type_boolean) {
+				_curl_prewarm = json_object_get_boolean(value);
+			}
+			else if ((strcmp(key, "shm") == 0) && type == json_type_object) {
+				if (!shmRing) {
+					shmRing = new ShmRing(value);
+					if (!shmRing->isConfigured()) {
+						delete shmRing;
+						shmRing = 0;
+						print(log_debug, "shared memory ring not enabled.", "shm");
+					}
+				} else
+					print(log_error, "Ignoring duplicate shm section", "shm");
 			}
 #ifdef ENABLE_MQTT
 			else if ((strcmp(key, "mqtt") == 0) && type == json_type_object) {
@@ -1,5 +1,9 @@
 /**
- * CurlSessionProvider - provides one curl session (easy handle) for a key
+ * CurlSessionProvider - provides a pool of curl sessions (easy handles) per key
+ *
+ * All handles share the DNS cache and the TLS session cache, so a new connection only costs
+ * an abbreviated TLS handshake. Connections stay with their handle: libcurl doesn't support
+ * sharing the connection cache between handles used by concurrent threads.
  *
  * @author Matthias Behr <mbehr@mcbehr.de>
  * @copyright Copyright (c) 2015 - 2023, The volkszaehler.org project
@@ -8,16 +12,36 @@
  */
 
 #include "CurlSessionProvider.hpp"
+#include "common.h"
 #include <assert.h>
 #include <time.h>
 #include <unistd.h>
 
-CurlSessionProvider::CurlSessionProvider() {
+CurlSessionProvider::CurlSessionProvider(int handlesPerKey, int idleTimeout, bool prewarm)
+	: _handlesPerKey(handlesPerKey > 0 ? handlesPerKey : 1),
+	  _idleTimeout(idleTimeout > 0 ? idleTimeout : 120), _prewarm(prewarm), _warmStop(false) {
 	_map_mutex = PTHREAD_MUTEX_INITIALIZER;
 	curl_global_init(CURL_GLOBAL_ALL);
+
+	_share = curl_share_init();
+	if (_share) {
+		curl_share_setopt(_share, CURLSHOPT_LOCKFUNC, share_lock);
+		curl_share_setopt(_share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+		curl_share_setopt(_share, CURLSHOPT_USERDATA, this);
+		curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	}
 }
 
 CurlSessionProvider::~CurlSessionProvider() {
+	{
+		std::lock_guard<std::mutex> lock(_warmMutex);
+		_warmStop = true; // aborts a running prewarm request as well
+	}
+	_warmCond.notify_all();
+	if (_warmThread.joinable())
+		_warmThread.join();
+
 	// curl_easy_cleanup for each CURL*
 	unsigned inUseRetry = 5;
 	do {
@@ -30,17 +54,22 @@ CurlSessionProvider::~CurlSessionProvider() {
 		// check whether any is still inUse:
 		bool inUse = false;
 		for (map_it it = _easy_handle_map.begin(); it != _easy_handle_map.end(); ++it) {
-			CurlUsage cu = (*it).second;
-			if (cu.inUse) {
-				inUse = true;
+			for (auto &cu : (*it).second.handles) {
+				if (cu.inUse) {
+					inUse = true;
+				}
 			}
 		}
 		if (!inUse or inUseRetry == 1) {
 			inUseRetry = 0;
 			for (map_it it = _easy_handle_map.begin(); it != _easy_handle_map.end(); ++it) {
-				CurlUsage cu = (*it).second;
-				curl_easy_cleanup(cu.eh);
+				for (auto &cu : (*it).second.handles)
+					curl_easy_cleanup(cu.eh);
+				(*it).second.handles.clear();
 			}
+			if (_share)
+				curl_share_cleanup(_share); // only after all handles using it
+			_share = 0;
 			curl_global_cleanup();
 		}
 		pthread_mutex_unlock(&_map_mutex);
@@ -52,68 +81,178 @@ CurlSessionProvider::~CurlSessionProvider() {
 	pthread_mutex_destroy(&_map_mutex);
 }
 
+void CurlSessionProvider::share_lock(CURL *, curl_lock_data data, curl_lock_access,
+									 void *userptr) {
+	static_cast<CurlSessionProvider *>(userptr)->_shareMutex[data].lock();
+}
+
+void CurlSessionProvider::share_unlock(CURL *, curl_lock_data data, void *userptr) {
+	static_cast<CurlSessionProvider *>(userptr)->_shareMutex[data].unlock();
+}
+
+void CurlSessionProvider::setup(CURL *eh) {
+	if (_share)
+		curl_easy_setopt(eh, CURLOPT_SHARE, _share);
+	// keep idle connections alive (e.g. in NAT tables) until they expire:
+	curl_easy_setopt(eh, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(eh, CURLOPT_TCP_KEEPIDLE, 60L);
+	curl_easy_setopt(eh, CURLOPT_TCP_KEEPINTVL, 60L);
+#if LIBCURL_VERSION_NUM >= 0x074100
+	curl_easy_setopt(eh, CURLOPT_MAXAGE_CONN, (long)_idleTimeout);
+#endif
+}
+
+CURL *CurlSessionProvider::new_session() {
+	CURL *eh = curl_easy_init();
+	if (eh)
+		setup(eh);
+	return eh;
+}
+
+void CurlSessionProvider::expire(Pool &pool, time_t now) {
+	for (auto it = pool.handles.begin(); it != pool.handles.end();) {
+		if (!(*it).inUse && now - (*it).lastUsed > _idleTimeout) {
+			curl_easy_cleanup((*it).eh);
+			it = pool.handles.erase(it);
+		} else
+			++it;
+	}
+}
+
+static void unlock_mutex(void *m) { pthread_mutex_unlock(static_cast<pthread_mutex_t *>(m)); }
+
 // thread-safe functions:
 CURL *CurlSessionProvider::get_easy_session(
-	std::string key, int timeout) // this is intended to block if the handle for the current key is
-								  // in use and single_session_per_key
+	std::string key, int timeout) // this is intended to block if all handles for the current key
+								  // are in use
 {
 	CURL *toRet = 0;
+	const time_t start = time(NULL);
 	// thread safe lock here to access the map:
-	assert(0 == pthread_mutex_lock(&_map_mutex));
-	map_it it = _easy_handle_map.find(key);
-	if (it != _easy_handle_map.end()) {
-		CurlUsage &cur = (*it).second;
-		pthread_mutex_unlock(
-			&_map_mutex); // we unlock here already but access the current element anyhow assuming
-						  // an insert doesnt invalidate the reference
-		int err;
-		do {
+	pthread_mutex_lock(&_map_mutex);
+	// we might get cancelled while waiting:
+	pthread_cleanup_push(unlock_mutex, &_map_mutex);
+	Pool &pool = _easy_handle_map[key]; // map elements are not moved by inserts
+	expire(pool, start);
+	while (!toRet) {
+		for (auto &cu : pool.handles) {
+			if (!cu.inUse) {
+				cu.inUse = true;
+				toRet = cu.eh;
+				break;
+			}
+		}
+		if (!toRet && pool.handles.size() < _handlesPerKey) {
+			// create new one:
+			CurlUsage cu;
+			cu.eh = new_session();
+			if (!cu.eh)
+				break;
+			cu.inUse = true;
+			pool.handles.push_back(cu);
+			toRet = cu.eh;
+		}
+		if (!toRet) {
+			if (timeout > 0 && time(NULL) - start >= timeout)
+				break;
 			timespec abs_time;
 			clock_gettime(CLOCK_REALTIME, &abs_time);
 			abs_time.tv_sec += 1;
-			pthread_testcancel(); // to check whether the thread shall end here!
-			err = pthread_mutex_timedlock(&cur.mutex, &abs_time);
-		} while ((err == EAGAIN) || (err == ETIMEDOUT));
-		assert(!cur.inUse);
-		cur.inUse = true;
-		toRet = cur.eh;
-	} else {
-		// create new one:
-		CurlUsage cu;
-		cu.eh = curl_easy_init();
-		cu.inUse = true;
-		pthread_mutex_lock(&cu.mutex);
-		_easy_handle_map.insert(std::make_pair(key, cu));
-		toRet = cu.eh;
-		pthread_mutex_unlock(&_map_mutex);
+			pthread_cond_timedwait(&pool.cond, &_map_mutex, &abs_time); // cancellation point
+		}
 	}
+	pthread_cleanup_pop(1);
 
 	return toRet;
 }
 
 void CurlSessionProvider::return_session(
 	std::string key, CURL *&eh) // return a handle. this unblocks another pending request for this
-								// key if single_session_per_key
+								// key
 {
 	// thread safe lock here:
-	assert(0 == pthread_mutex_lock(&_map_mutex));
-	CurlUsage &cu = _easy_handle_map[key];
-	assert(eh == cu.eh);
+	pthread_mutex_lock(&_map_mutex);
+	Pool &pool = _easy_handle_map[key];
+	const time_t now = time(NULL);
+	bool found = false;
+	for (auto &cu : pool.handles) {
+		if (cu.eh == eh) {
+			cu.inUse = false;
+			cu.lastUsed = now;
+			found = true;
+			break;
+		}
+	}
+	assert(found);
+	(void)found;
 	eh = 0;
-	cu.inUse = false;
-	pthread_mutex_unlock(&cu.mutex);
+	expire(pool, now); // the one just returned stays
+	pthread_cond_signal(&pool.cond);
 	pthread_mutex_unlock(&_map_mutex);
 }
 
 bool CurlSessionProvider::inUse(std::string key) {
+	bool toRet = false;
 	pthread_mutex_lock(&_map_mutex);
 	cmap_it it = _easy_handle_map.find(key);
 	if (it != _easy_handle_map.end()) {
-		pthread_mutex_unlock(&_map_mutex);
-		return (*it).second.inUse;
+		for (auto &cu : (*it).second.handles)
+			if (cu.inUse)
+				toRet = true;
 	}
 	pthread_mutex_unlock(&_map_mutex);
-	return false;
+	return toRet;
+}
+
+void CurlSessionProvider::prewarm(const std::string &key, const std::string &url) {
+	if (!_prewarm || url.empty())
+		return;
+	std::lock_guard<std::mutex> lock(_warmMutex);
+	if (_warmStop || !_warmKeys.insert(key).second)
+		return;
+	_warmQueue.push_back(std::make_pair(key, url));
+	// started on first use and not in the constructor as we might daemonize in between
+	if (!_warmThread.joinable())
+		_warmThread = std::thread(&CurlSessionProvider::prewarm_run, this);
+	_warmCond.notify_one();
+}
+
+static int prewarm_xferinfo(void *p, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+	return static_cast<std::atomic<bool> *>(p)->load() ? 1 : 0; // non zero aborts
+}
+
+void CurlSessionProvider::prewarm_run() {
+	std::unique_lock<std::mutex> lock(_warmMutex);
+	while (!_warmStop) {
+		if (_warmQueue.empty()) {
+			_warmCond.wait(lock);
+			continue;
+		}
+		std::pair<std::string, std::string> job = _warmQueue.front();
+		_warmQueue.pop_front();
+		lock.unlock();
+
+		CURL *eh = get_easy_session(job.first, 10);
+		if (eh) {
+			// a HEAD request resolves the name, connects and does the TLS handshake. The
+			// response doesn't matter.
+			curl_easy_setopt(eh, CURLOPT_URL, job.second.c_str());
+			curl_easy_setopt(eh, CURLOPT_NOBODY, 1L);
+			curl_easy_setopt(eh, CURLOPT_NOSIGNAL, 1L);
+			curl_easy_setopt(eh, CURLOPT_TIMEOUT, 10L);
+			curl_easy_setopt(eh, CURLOPT_NOPROGRESS, 0L);
+			curl_easy_setopt(eh, CURLOPT_XFERINFOFUNCTION, prewarm_xferinfo);
+			curl_easy_setopt(eh, CURLOPT_XFERINFODATA, &_warmStop);
+			CURLcode res = curl_easy_perform(eh);
+			print(log_debug, "prewarmed %s: %s", "curl", job.second.c_str(),
+				  curl_easy_strerror(res));
+			// keeps the connection and the caches but not our HEAD options:
+			curl_easy_reset(eh);
+			setup(eh);
+			return_session(job.first, eh);
+		}
+		lock.lock();
+	}
 }
 
 // global var:
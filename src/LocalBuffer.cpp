@@ -0,0 +1,228 @@
+/*
+ * Per channel storage of the tuples served by the local interface.
+ *
+ * Tuples normally arrive in time order and are appended. Older ones are moved to their place
+ * so that range queries can use a binary search.
+ * */
+
+#include "LocalBuffer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <endian.h>
+
+LocalBuffer::LocalBuffer(size_t capacity, bool fixed)
+	: _ring(capacity > 0 ? capacity : 1), _head(0), _size(0), _fixed(fixed), _version(0) {}
+
+void LocalBuffer::grow() {
+	std::vector<ChannelData> ring(_ring.size() * 2);
+	for (size_t i = 0; i < _size; i++)
+		ring[i] = at(i);
+	_ring.swap(ring);
+	_head = 0;
+}
+
+void LocalBuffer::add(const int64_t &t, const double &v) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_size == _ring.size()) {
+		if (_fixed) { // drop the oldest one
+			_head = (_head + 1) % _ring.size();
+			_size--;
+		} else
+			grow();
+	}
+	size_t i = _size++;
+	while (i > 0 && at(i - 1)._t > t) { // out of order, keep sorted
+		at(i) = at(i - 1);
+		i--;
+	}
+	at(i) = ChannelData(t, v);
+	_version++;
+}
+
+size_t LocalBuffer::expire(const int64_t &minT) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	const size_t n = lower_bound(minT);
+	if (n) {
+		_head = (_head + n) % _ring.size();
+		_size -= n;
+		_version++;
+	}
+	return n;
+}
+
+size_t LocalBuffer::lower_bound(const int64_t &t) const {
+	size_t lo = 0, hi = _size;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (at(mid)._t < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+void LocalBuffer::bounds(const int64_t &from, const int64_t &to, size_t limit, size_t &first,
+						 size_t &last) const {
+	first = lower_bound(from);
+	last = first; // one behind the last tuple with _t <= to
+	size_t hi = _size;
+	while (last < hi) {
+		const size_t mid = last + (hi - last) / 2;
+		if (at(mid)._t <= to)
+			last = mid + 1;
+		else
+			hi = mid;
+	}
+	if (limit > 0 && last - first > limit)
+		first = last - limit;
+}
+
+size_t LocalBuffer::range(const int64_t &from, const int64_t &to, size_t limit,
+						  std::vector<ChannelData> &out) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	size_t first, last;
+	bounds(from, to, limit, first, last);
+
+	out.reserve(out.size() + last - first);
+	for (size_t i = first; i < last; i++)
+		out.push_back(at(i));
+	return last - first;
+}
+
+size_t LocalBuffer::count(const int64_t &from, const int64_t &to, size_t limit) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	size_t first, last;
+	bounds(from, to, limit, first, last);
+	return last - first;
+}
+
+size_t LocalBuffer::columns(const int64_t &from, const int64_t &to, size_t limit, char *buf,
+							size_t max) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	size_t first, last;
+	bounds(from, to, limit, first, last);
+	if (last - first > max) // added since count(), keep the newest
+		first = last - max;
+
+	const size_t n = last - first;
+	char *v = buf + 8 * n;
+	for (size_t i = first; i < last; i++) {
+		const ChannelData &d = at(i);
+		uint64_t u = htole64(static_cast<uint64_t>(d._t));
+		memcpy(buf, &u, 8);
+		memcpy(&u, &d._v, 8);
+		u = htole64(u);
+		memcpy(v, &u, 8);
+		buf += 8;
+		v += 8;
+	}
+	return n;
+}
+
+size_t LocalBuffer::size() const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _size;
+}
+
+size_t LocalBuffer::capacity() const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _ring.size();
+}
+
+uint64_t LocalBuffer::version() const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _version;
+}
+
+// tuples are split into buckets of (nearly) equal count, bucket i is [first, last)
+static inline size_t bucket_first(size_t i, size_t n, size_t buckets) { return i * n / buckets; }
+
+static void downsample_lttb(const std::vector<ChannelData> &in, size_t points,
+							std::vector<ChannelData> &out) {
+	const size_t n = in.size();
+	const size_t buckets = points - 2; // first and last tuple are always kept
+	size_t a = 0;                      // the tuple selected in the previous bucket
+	out.push_back(in[0]);
+	for (size_t i = 0; i < buckets; i++) {
+		const size_t first = 1 + bucket_first(i, n - 2, buckets);
+		const size_t last = 1 + bucket_first(i + 1, n - 2, buckets);
+
+		// the third point of the triangle is the average of the next bucket
+		const size_t next_first = last;
+		const size_t next_last = i + 1 < buckets ? 1 + bucket_first(i + 2, n - 2, buckets) : n;
+		double avg_t = 0.0, avg_v = 0.0;
+		for (size_t j = next_first; j < next_last; j++) {
+			avg_t += in[j]._t - in[a]._t; // relative to a to keep the precision
+			avg_v += in[j]._v;
+		}
+		avg_t /= next_last - next_first;
+		avg_v /= next_last - next_first;
+
+		double max_area = -1.0;
+		size_t selected = first;
+		for (size_t j = first; j < last; j++) {
+			const double area = std::fabs((double)(in[j]._t - in[a]._t) * (avg_v - in[a]._v) -
+										  avg_t * (in[j]._v - in[a]._v));
+			if (area > max_area) {
+				max_area = area;
+				selected = j;
+			}
+		}
+		out.push_back(in[selected]);
+		a = selected;
+	}
+	out.push_back(in[n - 1]);
+}
+
+static void downsample_minmax(const std::vector<ChannelData> &in, size_t points,
+							  std::vector<ChannelData> &out) {
+	const size_t n = in.size();
+	const size_t buckets = points / 2;
+	for (size_t i = 0; i < buckets; i++) {
+		const size_t first = bucket_first(i, n, buckets);
+		const size_t last = bucket_first(i + 1, n, buckets);
+		size_t min = first, max = first;
+		for (size_t j = first + 1; j < last; j++) {
+			if (in[j]._v < in[min]._v)
+				min = j;
+			if (in[j]._v > in[max]._v)
+				max = j;
+		}
+		out.push_back(in[std::min(min, max)]);
+		if (min != max)
+			out.push_back(in[std::max(min, max)]);
+	}
+}
+
+static void downsample_avg(const std::vector<ChannelData> &in, size_t points,
+						   std::vector<ChannelData> &out) {
+	const size_t n = in.size();
+	for (size_t i = 0; i < points; i++) {
+		const size_t first = bucket_first(i, n, points);
+		const size_t last = bucket_first(i + 1, n, points);
+		double t = 0.0, v = 0.0;
+		for (size_t j = first; j < last; j++) {
+			t += in[j]._t - in[first]._t;
+			v += in[j]._v;
+		}
+		out.push_back(ChannelData(in[first]._t + (int64_t)llround(t / (last - first)),
+								  v / (last - first)));
+	}
+}
+
+void downsample(const std::vector<ChannelData> &in, size_t points, DownsampleMethod method,
+				std::vector<ChannelData> &out) {
+	if (points == 0 || in.size() <= points) {
+		out.insert(out.end(), in.begin(), in.end());
+		return;
+	}
+	out.reserve(out.size() + points);
+	if (method == DOWNSAMPLE_LTTB && points >= 3)
+		downsample_lttb(in, points, out);
+	else if (method == DOWNSAMPLE_MINMAX && points >= 2)
+		downsample_minmax(in, points, out);
+	else
+		downsample_avg(in, points, out);
+}
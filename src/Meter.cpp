@@ -38,6 +38,7 @@
 #include <protocols/MeterS0.hpp>
 #ifdef SML_SUPPORT
 #include <protocols/MeterSML.hpp>
+#include <protocols/MeterSMLGateway.hpp>
 #endif
 #ifdef OCR_SUPPORT
 #include "protocols/MeterOCR.hpp"
@@ -46,6 +47,9 @@
 #ifdef OMS_SUPPORT
 #include "protocols/MeterOMS.hpp"
 #endif
+#ifdef ENABLE_MQTT
+#include "protocols/MeterMQTT.hpp"
+#endif
 // #include <protocols/.h>
 
 #define METER_DETAIL(NAME, CLASSNAME, DESC, MAX_RDS) {meter_protocol_##NAME, #NAME, DESC, MAX_RDS}
@@ -62,6 +66,7 @@ static const meter_details_t protocols[] = {
 	METER_DETAIL(d0, D0, "DLMS/IEC 62056-21 plaintext protocol", 400),
 #ifdef SML_SUPPORT
 	METER_DETAIL(sml, Sml, "Smart Message Language as used by EDL-21, eHz and SyM²", 32),
+	METER_DETAIL(smlgateway, SmlGateway, "Smart Message Language from many TCP sources", 1024),
 #endif // SML_SUPPORT
 #ifdef OCR_SUPPORT
 	METER_DETAIL(ocr, OCR, "Image processing/recognizing meter", 32),
@@ -69,6 +74,9 @@ static const meter_details_t protocols[] = {
 	METER_DETAIL(w1therm, W1therm, "W1-therm / 1wire temperature devices", 400),
 #ifdef OMS_SUPPORT
 	METER_DETAIL(oms, OMS, "OMS (M-BUS) protocol based devices", 100),
+#endif
+#ifdef ENABLE_MQTT
+	METER_DETAIL(mqtt, MQTT, "Subscribe to topics on a MQTT broker", 256),
 #endif
 	//{} /* stop condition for iterator */
 	METER_DETAIL(none, NULL, NULL, 0),
@@ -165,6 +173,10 @@ Meter::Meter(std::list<Option> pOptions) : _name("meter") {
 		_protocol = vz::protocol::Protocol::Ptr(new MeterSML(pOptions));
 		_identifier = ReadingIdentifier::Ptr(new ObisIdentifier());
 		break;
+	case meter_protocol_smlgateway:
+		_protocol = vz::protocol::Protocol::Ptr(new MeterSMLGateway(pOptions));
+		_identifier = ReadingIdentifier::Ptr(new StringIdentifier());
+		break;
 #endif
 	case meter_protocol_fluksov2:
 		_protocol = vz::protocol::Protocol::Ptr(new MeterFluksoV2(pOptions));
@@ -185,6 +197,12 @@ Meter::Meter(std::list<Option> pOptions) : _name("meter") {
 		_protocol = vz::protocol::Protocol::Ptr(new MeterOMS(pOptions));
 		_identifier = ReadingIdentifier::Ptr(new ObisIdentifier());
 		break;
+#endif
+#ifdef ENABLE_MQTT
+	case meter_protocol_mqtt:
+		_protocol = vz::protocol::Protocol::Ptr(new MeterMQTT(pOptions));
+		_identifier = ReadingIdentifier::Ptr(new StringIdentifier());
+		break;
 #endif
 	default:
 		break;
@@ -41,6 +41,7 @@
 #include <api/InfluxDB.hpp>
 #include <api/MySmartGrid.hpp>
 #include <api/Null.hpp>
+#include <api/UdpLine.hpp>
 #include <api/Volkszaehler.hpp>
 
 extern Config_Options options; /* global application options */
@@ -113,6 +114,9 @@ void MeterMap::registration() {
 		} else if (0 == strcasecmp((*ch)->apiProtocol().c_str(), "influxdb")) {
 			api = vz::ApiIF::Ptr(new vz::api::InfluxDB(*ch, (*ch)->options()));
 			print(log_debug, "Using InfluxDB api", (*ch)->name());
+		} else if (0 == strcasecmp((*ch)->apiProtocol().c_str(), "udp")) {
+			api = vz::ApiIF::Ptr(new vz::api::UdpLine(*ch, (*ch)->options()));
+			print(log_debug, "Using udp api", (*ch)->name());
 		} else if (0 == strcasecmp((*ch)->apiProtocol().c_str(), "null")) {
 			api = vz::ApiIF::Ptr(new vz::api::Null(*ch, (*ch)->options()));
 			print(log_debug, "Using null api - meter data available via local httpd if enabled.",
@@ -0,0 +1,88 @@
+/*
+ * State of the /metrics endpoint of the local interface and its prometheus text rendering.
+ *
+ * Channels without a value yet only show up in the counters. Label values are escaped, the
+ * uuid is used as is.
+ * */
+
+#include "Metrics.hpp"
+#include <cstdio>
+
+std::string metrics_label(const std::string &str) {
+	std::string toRet;
+	toRet.reserve(str.length());
+	for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+		switch (*it) {
+		case '\\':
+			toRet += "\\\\";
+			break;
+		case '"':
+			toRet += "\\\"";
+			break;
+		case '\n':
+			toRet += "\\n";
+			break;
+		default:
+			toRet += *it;
+		}
+	}
+	return toRet;
+}
+
+std::string metrics_render(const std::map<std::string, MetricsChannel> &channels,
+						   const std::map<std::string, MetricsMeter> &meters) {
+	std::string toRet;
+	char buf[64];
+
+	toRet += "# HELP vzlogger_channel_value Last value of the channel.\n"
+			 "# TYPE vzlogger_channel_value gauge\n";
+	for (std::map<std::string, MetricsChannel>::const_iterator it = channels.begin();
+		 it != channels.end(); ++it) {
+		if (!it->second._valid)
+			continue;
+		snprintf(buf, sizeof(buf), " %.15g\n", it->second._v);
+		toRet += "vzlogger_channel_value{uuid=\"" + it->first + "\",meter=\"" +
+				 metrics_label(it->second._meter) + "\",protocol=\"" +
+				 metrics_label(it->second._protocol) + "\",identifier=\"" +
+				 metrics_label(it->second._identifier) + "\"}" + buf;
+	}
+
+	toRet += "# HELP vzlogger_channel_timestamp_seconds Time of the last value of the channel.\n"
+			 "# TYPE vzlogger_channel_timestamp_seconds gauge\n";
+	for (std::map<std::string, MetricsChannel>::const_iterator it = channels.begin();
+		 it != channels.end(); ++it) {
+		if (!it->second._valid)
+			continue;
+		snprintf(buf, sizeof(buf), " %lld.%03lld\n", (long long)(it->second._t / 1000),
+				 (long long)(it->second._t % 1000));
+		toRet += "vzlogger_channel_timestamp_seconds{uuid=\"" + it->first + "\"}" + buf;
+	}
+
+	toRet += "# HELP vzlogger_channel_tuples_total Tuples added to the local buffer.\n"
+			 "# TYPE vzlogger_channel_tuples_total counter\n";
+	for (std::map<std::string, MetricsChannel>::const_iterator it = channels.begin();
+		 it != channels.end(); ++it) {
+		snprintf(buf, sizeof(buf), " %llu\n", (unsigned long long)it->second._tuples);
+		toRet += "vzlogger_channel_tuples_total{uuid=\"" + it->first + "\"}" + buf;
+	}
+
+	toRet += "# HELP vzlogger_meter_readings_total Readings returned by the meter.\n"
+			 "# TYPE vzlogger_meter_readings_total counter\n";
+	for (std::map<std::string, MetricsMeter>::const_iterator it = meters.begin();
+		 it != meters.end(); ++it) {
+		snprintf(buf, sizeof(buf), " %llu\n", (unsigned long long)it->second._readings);
+		toRet += "vzlogger_meter_readings_total{meter=\"" + metrics_label(it->first) +
+				 "\",protocol=\"" + metrics_label(it->second._protocol) + "\"}" + buf;
+	}
+
+	toRet += "# HELP vzlogger_meter_periods_total Finished aggregation periods of the meter.\n"
+			 "# TYPE vzlogger_meter_periods_total counter\n";
+	for (std::map<std::string, MetricsMeter>::const_iterator it = meters.begin();
+		 it != meters.end(); ++it) {
+		snprintf(buf, sizeof(buf), " %llu\n", (unsigned long long)it->second._periods);
+		toRet += "vzlogger_meter_periods_total{meter=\"" + metrics_label(it->first) + "\"}" +
+				 buf;
+	}
+
+	return toRet;
+}
@@ -3,12 +3,14 @@
  * */
 
 #include "PushData.hpp"
+#include "Cbor.hpp"
 #include "CurlSessionProvider.hpp"
 #include "vzlogger.h"
 #include <assert.h>
 #include <time.h>
 
-PushDataServer::PushDataServer(struct json_object *option) : _headers(0) {
+PushDataServer::PushDataServer(struct json_object *option)
+	: _headers(0), _cborHeaders(0), _started(false) {
 	if (option) {
 		// todo parse param option (is a json_type_array with len>0
 		// expected is each array item to be an object with key "url"
@@ -25,7 +27,41 @@ PushDataServer::PushDataServer(struct json_object *option) : _headers(0) {
 			if (json_object_get_type(jv) != json_type_string)
 				throw vz::VZException("config: push url no string");
 			std::string url = json_object_get_string(jv);
-			_middlewareList.push_back(url);
+			std::unique_ptr<Target> target(new Target(*this, url));
+
+			// optional per middleware settings:
+			if (json_object_object_get_ex(jso, "timeout", &jv)) {
+				if (json_object_get_type(jv) != json_type_int || json_object_get_int(jv) <= 0)
+					throw vz::VZException("config: push timeout no positive int");
+				target->_timeout = json_object_get_int(jv);
+			}
+			if (json_object_object_get_ex(jso, "queue", &jv)) {
+				if (json_object_get_type(jv) != json_type_int || json_object_get_int(jv) <= 0)
+					throw vz::VZException("config: push queue no positive int");
+				target->_maxQueue = json_object_get_int(jv);
+			}
+			if (json_object_object_get_ex(jso, "retries", &jv)) {
+				if (json_object_get_type(jv) != json_type_int || json_object_get_int(jv) < 0)
+					throw vz::VZException("config: push retries no int >= 0");
+				target->_retries = json_object_get_int(jv);
+			}
+			if (json_object_object_get_ex(jso, "encoding", &jv)) {
+				std::string encoding =
+					json_object_get_type(jv) == json_type_string ? json_object_get_string(jv) : "";
+				if (encoding == "cbor")
+					target->_cbor = true;
+				else if (encoding != "json")
+					throw vz::VZException("config: push encoding has to be json or cbor");
+			}
+			if (json_object_object_get_ex(jso, "float32", &jv)) {
+				if (json_object_get_type(jv) != json_type_boolean)
+					throw vz::VZException("config: push float32 no boolean");
+				target->_float32 = json_object_get_boolean(jv);
+			}
+			print(log_finest, "push to %s timeout=%lds queue=%zu retries=%d encoding=%s", "push",
+				  target->_url.c_str(), target->_timeout, target->_maxQueue, target->_retries,
+				  target->_cbor ? "cbor" : "json");
+			_middlewareList.push_back(std::move(target));
 		}
 
 	} // else for now assume this as the unit testing case and accept it
@@ -39,11 +75,17 @@ PushDataServer::PushDataServer(struct json_object *option) : _headers(0) {
 	_headers = curl_slist_append(_headers, "Content-type: application/json");
 	_headers = curl_slist_append(_headers, "Accept: application/json");
 	_headers = curl_slist_append(_headers, agent);
+	_cborHeaders = curl_slist_append(_cborHeaders, "Content-type: application/cbor");
+	_cborHeaders = curl_slist_append(_cborHeaders, "Accept: application/json");
+	_cborHeaders = curl_slist_append(_cborHeaders, agent);
 }
 
 PushDataServer::~PushDataServer() {
+	stop(); // the threads use _headers
 	if (_headers)
 		curl_slist_free_all(_headers);
+	if (_cborHeaders)
+		curl_slist_free_all(_cborHeaders);
 }
 
 bool PushDataServer::waitAndSendOnceToAll() {
@@ -51,6 +93,13 @@ bool PushDataServer::waitAndSendOnceToAll() {
 		print(log_error, "waitAndSendOnceToAll empty pushDataList!", "push");
 		return false;
 	}
+	// started before waiting so that the connections are prewarmed for the first data
+	if (!_started) { // started here and not in the constructor as we might daemonize in between
+		for (auto &t : _middlewareList)
+			t->start();
+		_started = true;
+	}
+
 	PushDataList::DataMap *dataMap = pushDataList->waitForData();
 	if (!dataMap) {
 		print(log_finest, "waitAndSendOnceToAll empty dataMap (timeout?)",
@@ -58,23 +107,122 @@ bool PushDataServer::waitAndSendOnceToAll() {
 		return false;
 	}
 
-	std::string json = generateJson(*dataMap);
+	// generate only the encodings used by the middlewares:
+	bool needJson = _middlewareList.empty(), needCbor = false, needCbor32 = false;
+	for (auto &t : _middlewareList) {
+		if (!t->_cbor)
+			needJson = true;
+		else if (t->_float32)
+			needCbor32 = true;
+		else
+			needCbor = true;
+	}
+	std::string cbor, cbor32, json;
+	if (needCbor)
+		cbor = generateCbor(*dataMap, false);
+	if (needCbor32)
+		cbor32 = generateCbor(*dataMap, true);
+	if (needJson)
+		json = generateJson(*dataMap); // empties dataMap
+	delete dataMap;
 
-	// now send this data to all defined push middlewares:
-	print(log_debug, "push: %s", "push", json.c_str());
+	// now queue this data for all defined push middlewares:
+	print(log_debug, "push: %s (cbor: %zu/%zu bytes)", "push", json.c_str(), cbor.size(),
+		  cbor32.size());
 
 	bool toRet = true;
-	// iterate through list of push middlewares:
-	for (auto it = _middlewareList.begin(); it != _middlewareList.end(); ++it) {
-		// use CurlSessionProvider to serialize access to middleware:
-		if (!send(*it, json))
+	for (auto &t : _middlewareList) {
+		if (!t->enqueue(t->_cbor ? (t->_float32 ? cbor32 : cbor) : json))
 			toRet = false;
 	}
+	return toRet;
+}
 
-	delete dataMap;
+void PushDataServer::stop() {
+	for (auto &t : _middlewareList)
+		t->stop();
+	_started = false;
+}
+
+void PushDataServer::Target::start() {
+	if (_thread.joinable())
+		return;
+	if (curlSessionProvider)
+		curlSessionProvider->prewarm(_url, _url);
+	_stop = false;
+	_thread = std::thread(&Target::run, this);
+}
+
+void PushDataServer::Target::stop() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true; // aborts a running request as well
+	}
+	_cond.notify_all();
+	if (_thread.joinable())
+		_thread.join();
+}
+
+bool PushDataServer::Target::enqueue(const std::string &data) {
+	bool toRet = true;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_queue.size() >= _maxQueue) {
+			_queue.pop_front();
+			_dropped++;
+			toRet = false;
+			print(log_warning, "queue for %s full (%zu), dropped oldest data", "push",
+				  _url.c_str(), _queue.size());
+		}
+		_queue.push_back(data);
+	}
+	_cond.notify_one();
 	return toRet;
 }
 
+void PushDataServer::Target::run() {
+	print(log_finest, "Start push thread for %s", "push", _url.c_str());
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (!_stop) {
+		if (_queue.empty()) {
+			_cond.wait(lock);
+			continue;
+		}
+		if (std::chrono::steady_clock::now() < _nextAttempt) { // backoff after failures
+			_cond.wait_until(lock, _nextAttempt);
+			continue;
+		}
+
+		std::string data = std::move(_queue.front());
+		_queue.pop_front();
+		lock.unlock();
+		bool ok = _server.send(_url, data, _timeout, &_stop, _cbor);
+		lock.lock();
+
+		if (ok) {
+			if (_failures)
+				print(log_info, "%s reachable again", "push", _url.c_str());
+			_sent++;
+			_failures = 0;
+			_attempt = 0;
+		} else {
+			_failed++;
+			_failures++;
+			// 1, 2, 4, ... 64s
+			_nextAttempt = std::chrono::steady_clock::now() +
+						   std::chrono::seconds(1 << (_failures < 7 ? _failures - 1 : 6));
+			if (!_stop && ++_attempt <= _retries && _queue.size() < _maxQueue) {
+				_queue.push_front(std::move(data)); // retry after the backoff
+			} else {
+				_attempt = 0;
+				_dropped++;
+				print(log_debug, "dropped data for %s", "push", _url.c_str());
+			}
+		}
+	}
+	print(log_finest, "Stopped push thread for %s", "push", _url.c_str());
+}
+
 std::string PushDataServer::generateJson(PushDataList::DataMap &dataMap) {
 	std::string toRet;
 	struct json_object *jso = json_object_new_object();
@@ -110,7 +258,35 @@ std::string PushDataServer::generateJson(PushDataList::DataMap &dataMap) {
 	return toRet;
 }
 
-bool PushDataServer::send(const std::string &middleware, const std::string &datastr) {
+// aborts a running transfer on program end
+static int curl_abort_callback(void *abort, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+	return *static_cast<const std::atomic<bool> *>(abort) ? 1 : 0;
+}
+
+std::string PushDataServer::generateCbor(const PushDataList::DataMap &dataMap, bool float32) {
+	std::string toRet;
+	CborWriter cbor(toRet, float32);
+	std::vector<PushDataList::DataTuple> tuples;
+
+	cbor.map(1);
+	cbor.string("data");
+	cbor.array(dataMap.size());
+	for (auto it = dataMap.begin(); it != dataMap.end(); ++it) {
+		PushDataList::DataQueue q((*it).second); // copy, the json encoding might follow
+		tuples.clear();
+		for (; !q.empty(); q.pop())
+			tuples.push_back(q.front());
+
+		cbor.map(3);
+		cbor.string("uuid");
+		cbor.string((*it).first);
+		cbor.tuples(tuples.begin(), tuples.end(), tuples.size());
+	}
+	return toRet;
+}
+
+bool PushDataServer::send(const std::string &middleware, const std::string &datastr, long timeout,
+						  const std::atomic<bool> *abort, bool cbor) {
 	bool toRet = true;
 	CURL *curl = curlSessionProvider ? curlSessionProvider->get_easy_session(middleware) : 0;
 	if (!curl) {
@@ -125,17 +301,25 @@ bool PushDataServer::send(const std::string &middleware, const std::string &data
 	long int http_code;
 
 	curl_easy_setopt(curl, CURLOPT_URL, middleware.c_str());
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, _headers);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, cbor ? _cborHeaders : _headers);
 	// curl_easy_setopt(curl, CURLOPT_VERBOSE, options.verbosity());
 	curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, 0);
 	curl_easy_setopt(curl, CURLOPT_DEBUGDATA, 0);
 	// signal-handling in libcurl is NOT thread-safe. so force to deactivated them!
 	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
 
-	// set timeout to 30 sec. required if e.g. next router has an ip-change.
-	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30);
+	// set timeout (default 30 sec). required if e.g. next router has an ip-change.
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+	if (abort) {
+		curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curl_abort_callback);
+		curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void *)abort);
+		curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+	} else {
+		curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+	}
 
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, datastr.c_str());
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)datastr.size()); // cbor contains 0 bytes
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_custom_write_callback);
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
 
@@ -190,54 +374,133 @@ size_t PushDataServer::curl_custom_write_callback(void *ptr, size_t size, size_t
 	return realsize;
 }
 
-PushDataList::PushDataList() : _next(0), _map_mutex(PTHREAD_MUTEX_INITIALIZER) {
-	pthread_cond_init(&_cond, NULL);
-}
+PushDataList::PushDataList(int window_ms, size_t max_tuples)
+	: _head(0), _free(0), _count(0), _window(window_ms > 0 ? window_ms : 0),
+	  _maxTuples(max_tuples > 0 ? max_tuples : 1) {}
 
 PushDataList::~PushDataList() {
-	pthread_mutex_lock(&_map_mutex); // todo. wrong thread might own the mutex? But might have been
-									 // cancelled (thread_cancellation so will never unlock!)
+	Node *lists[2] = {_head.exchange(0), _free.exchange(0)};
+	for (Node *n : lists) {
+		while (n) {
+			Node *next = n->next;
+			delete n;
+			n = next;
+		}
+	}
+}
 
-	if (_next)
-		delete _next;
+thread_local PushDataList::NodeCache PushDataList::_cache;
 
-	// we keep it locked to prevent race conds at the end
-	pthread_cond_destroy(&_cond);
-	pthread_mutex_destroy(&_map_mutex);
+PushDataList::NodeCache::~NodeCache() {
+	while (free) {
+		Node *next = free->next;
+		delete free;
+		free = next;
+	}
 }
 
-void PushDataList::add(const std::string &uuid, const int64_t &time_ms, const double &value) {
-	assert(0 == pthread_mutex_lock(&_map_mutex));
+PushDataList::Node *PushDataList::allocNode() {
+	// taking the whole free stack with exchange() avoids the ABA problem of popping single nodes
+	if (!_cache.free)
+		_cache.free = _free.exchange(0, std::memory_order_acquire);
+	Node *n = _cache.free;
+	if (!n)
+		return new Node;
+	_cache.free = n->next;
+	return n;
+}
 
-	if (!_next)
-		_next = new DataMap;
+uint32_t PushDataList::intern(const std::string &uuid) {
+	std::lock_guard<std::mutex> lock(_internMutex);
+	auto it = _ids.find(uuid);
+	if (it != _ids.end())
+		return it->second;
+	uint32_t id = _uuids.size();
+	_uuids.push_back(uuid);
+	_ids[uuid] = id;
+	return id;
+}
 
-	_next->operator[](uuid).push(DataTuple(time_ms, value));
+void PushDataList::add(const std::string &uuid, const int64_t &time_ms, const double &value) {
+	add(intern(uuid), time_ms, value);
+}
 
-	pthread_cond_broadcast(&_cond);
-	pthread_mutex_unlock(&_map_mutex);
+void PushDataList::add(uint32_t id, const int64_t &time_ms, const double &value) {
+	Node *n = allocNode();
+	n->id = id;
+	n->time_ms = time_ms;
+	n->value = value;
+	// counted before the push: the consumer only subtracts nodes it took, so _count can't
+	// drop below the number of them
+	size_t count = _count.fetch_add(1, std::memory_order_relaxed) + 1;
+	Node *old = _head.load(std::memory_order_relaxed);
+	do {
+		n->next = old;
+	} while (!_head.compare_exchange_weak(old, n, std::memory_order_release,
+										  std::memory_order_relaxed));
+
+	// only the first tuple of a batch or reaching max_tuples wakes the consumer:
+	if (!old || count == _maxTuples) {
+		std::lock_guard<std::mutex> lock(_waitMutex);
+		_cond.notify_one();
+	}
 }
 
 PushDataList::DataMap *PushDataList::waitForData() {
-	DataMap *toRet = 0;
-	assert(0 == pthread_mutex_lock(&_map_mutex));
-	int rc = 0;
-
-	// try max 5s. We need to avoid deadlocking e.g. on program end/termination.
-	struct timespec ts;
-	clock_gettime(CLOCK_REALTIME, &ts);
-	ts.tv_sec += 5;
-
-	while ((!(_next && !_next->empty())) && rc == 0) {
-		rc = pthread_cond_timedwait(&_cond, &_map_mutex, &ts);
+	{
+		std::unique_lock<std::mutex> lock(_waitMutex);
+		// try max 5s. We need to avoid deadlocking e.g. on program end/termination.
+		auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+		while (!_head.load(std::memory_order_acquire)) {
+			if (_cond.wait_until(lock, timeout) == std::cv_status::timeout &&
+				!_head.load(std::memory_order_acquire))
+				return 0;
+		}
+		// coalesce:
+		auto flush = std::chrono::steady_clock::now() + _window;
+		while (_count.load(std::memory_order_relaxed) < _maxTuples &&
+			   _cond.wait_until(lock, flush) == std::cv_status::no_timeout)
+			;
 	}
 
-	if (rc == 0) {
-		toRet = _next;
-		_next = 0; // change ownership to caller. We will create new one on next add()
+	Node *n = _head.exchange(0, std::memory_order_acquire);
+	// the stack is newest first. reverse it to keep the order of the readings:
+	Node *list = 0;
+	size_t count = 0;
+	while (n) {
+		Node *next = n->next;
+		n->next = list;
+		list = n;
+		n = next;
+		count++;
+	}
+	_count.fetch_sub(count, std::memory_order_relaxed);
+
+	DataMap *toRet = new DataMap;
+	std::vector<DataQueue *> queues; // by id, avoids hashing the uuid per tuple
+	Node *recycled = 0, *last = list;
+	std::lock_guard<std::mutex> lock(_internMutex);
+	while (list) {
+		if (list->id >= queues.size())
+			queues.resize(_uuids.size(), 0);
+		DataQueue *&q = queues[list->id];
+		if (!q)
+			q = &(*toRet)[_uuids[list->id]];
+		q->push(DataTuple(list->time_ms, list->value));
+		Node *next = list->next;
+		list->next = recycled;
+		recycled = list;
+		list = next;
 	}
-	pthread_mutex_unlock(&_map_mutex);
 
+	// give the nodes back to the producers. the consumer is the only one pushing to _free.
+	if (recycled) {
+		Node *old = _free.load(std::memory_order_relaxed);
+		do {
+			last->next = old;
+		} while (!_free.compare_exchange_weak(old, recycled, std::memory_order_release,
+											  std::memory_order_relaxed));
+	}
 	return toRet;
 }
 
@@ -254,6 +517,7 @@ void *push_data_thread(void *arg) {
 		while (!endThread) {
 			pds->waitAndSendOnceToAll();
 		}
+		pds->stop();
 	}
 
 	print(log_debug, "Stopped push_data_thread", "push");
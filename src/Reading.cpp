@@ -76,6 +76,17 @@ ReadingIdentifier::Ptr reading_id_parse(meter_protocol_t protocol, const char *s
 		rid = ReadingIdentifier::Ptr(new ObisIdentifier(Obis(string)));
 		break;
 
+	case meter_protocol_smlgateway: { // <source id>/<OBIS code>, the code is normalized
+		const char *slash = strrchr(string, '/');
+		if (!slash)
+			throw vz::VZException("identifier must be <source>/<OBIS code>");
+		char code[32];
+		Obis(slash + 1).unparse(code, sizeof(code));
+		rid = ReadingIdentifier::Ptr(
+			new StringIdentifier(std::string(string, slash - string + 1) + code));
+		break;
+	}
+
 	case meter_protocol_fluksov2: {
 		char type[13];
 		int channel;
@@ -105,6 +116,7 @@ ReadingIdentifier::Ptr reading_id_parse(meter_protocol_t protocol, const char *s
 	case meter_protocol_s0:
 	case meter_protocol_ocr:
 	case meter_protocol_w1therm:
+	case meter_protocol_mqtt:
 		rid = ReadingIdentifier::Ptr(new StringIdentifier(string));
 		break;
 
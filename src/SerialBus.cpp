@@ -0,0 +1,113 @@
+/*
+ * Serial devices shared by several meters.
+ *
+ * Polls are granted strictly in the order they were requested. A meter that polls more often
+ * than the bus allows queues behind the others instead of starving them.
+ * */
+
+#include "SerialBus.hpp"
+#include "common.h"
+#include "threads.h"
+#include <algorithm>
+#include <mutex>
+
+// number of polls between the latency summaries of a meter
+#define SERIALBUS_SUMMARY_POLLS 100
+
+class SerialBus::Waiter {
+  public:
+	SerialBus *_bus;
+	unsigned long _ticket;
+};
+
+SerialBus::Ptr SerialBus::get(const std::string &device) {
+	static std::mutex registry_mutex;
+	static std::map<std::string, std::weak_ptr<SerialBus>> registry;
+
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	Ptr bus = registry[device].lock();
+	if (!bus) {
+		bus = std::make_shared<SerialBus>(device);
+		registry[device] = bus;
+	}
+	return bus;
+}
+
+SerialBus::SerialBus(const std::string &device)
+	: _device(device), _ticket(0), _busy(false), _waitMs(0.0) {
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_cond, NULL);
+}
+
+SerialBus::~SerialBus() {
+	pthread_cond_destroy(&_cond);
+	pthread_mutex_destroy(&_mutex);
+}
+
+static double elapsed_ms(const std::chrono::steady_clock::time_point &since,
+						 const std::chrono::steady_clock::time_point &now) {
+	return std::chrono::duration<double, std::milli>(now - since).count();
+}
+
+// the waiting thread got cancelled: give up its place in the queue
+void SerialBus::abandon(void *waiter) {
+	Waiter *w = static_cast<Waiter *>(waiter);
+	SerialBus *bus = w->_bus;
+	bus->_queue.remove(w->_ticket);
+	pthread_cond_broadcast(&bus->_cond); // the next one might be at the front now
+	pthread_mutex_unlock(&bus->_mutex);
+}
+
+void SerialBus::acquire(const std::string &meter) {
+	const Clock::time_point start = Clock::now();
+	pthread_mutex_lock(&_mutex);
+	Waiter w;
+	w._bus = this;
+	w._ticket = _ticket++;
+	_queue.push_back(w._ticket);
+
+	pthread_cleanup_push(abandon, &w);
+	while (_busy || _queue.front() != w._ticket)
+		CANCELLABLE(pthread_cond_wait(&_cond, &_mutex));
+	pthread_cleanup_pop(0);
+
+	_queue.pop_front();
+	_busy = true;
+	_owner = meter;
+	_granted = Clock::now();
+	_waitMs = elapsed_ms(start, _granted);
+	pthread_mutex_unlock(&_mutex);
+}
+
+void SerialBus::release(bool completed) {
+	pthread_mutex_lock(&_mutex);
+	if (_busy && completed) {
+		const double poll = elapsed_ms(_granted, Clock::now());
+		Stats &s = _stats[_owner];
+		s._polls++;
+		s._waitMs += _waitMs;
+		s._maxWaitMs = std::max(s._maxWaitMs, _waitMs);
+		s._pollMs += poll;
+		s._maxPollMs = std::max(s._maxPollMs, poll);
+
+		print(log_debug, "waited %.0f ms for %s, poll took %.0f ms", _owner.c_str(), _waitMs,
+			  _device.c_str(), poll);
+		if (s._polls % SERIALBUS_SUMMARY_POLLS == 0)
+			print(log_info,
+				  "%lu polls on %s: wait avg %.0f ms max %.0f ms, poll avg %.0f ms max %.0f ms",
+				  _owner.c_str(), s._polls, _device.c_str(), s._waitMs / s._polls, s._maxWaitMs,
+				  s._pollMs / s._polls, s._maxPollMs);
+	}
+	_busy = false;
+	_owner.clear();
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_mutex);
+}
+
+SerialBus::Stats SerialBus::stats(const std::string &meter) const {
+	pthread_mutex_lock(&_mutex);
+	std::map<std::string, Stats>::const_iterator it = _stats.find(meter);
+	Stats s = it == _stats.end() ? Stats() : it->second;
+	pthread_mutex_unlock(&_mutex);
+	return s;
+}
@@ -0,0 +1,152 @@
+/*
+ * Shared memory ring for local consumers.
+ *
+ * A single writer lock serializes the reading threads. Readers only map the
+ * object read-only and use the per record seqlock, see vzlogger_shm.h.
+ * */
+
+#include "ShmRing.hpp"
+#include "common.h"
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <errno.h>
+#include <fcntl.h>
+#include <json-c/json.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// global var:
+ShmRing *shmRing = 0;
+
+ShmRing::ShmRing(struct json_object *option)
+	: _enabled(false), _name("/vzlogger"), _capacity(4096), _mode(0644), _hdr(0), _ring(0),
+	  _size(0) {
+	if (option) {
+		json_object_object_foreach(option, key, local_value) {
+			enum json_type local_type = json_object_get_type(local_value);
+
+			if (strcmp(key, "enabled") == 0 && local_type == json_type_boolean) {
+				_enabled = json_object_get_boolean(local_value);
+			} else if (strcmp(key, "name") == 0 && local_type == json_type_string) {
+				_name = json_object_get_string(local_value);
+			} else if (strcmp(key, "capacity") == 0 && local_type == json_type_int) {
+				int capacity = json_object_get_int(local_value);
+				if (capacity < 2 || capacity > (1 << 24)) {
+					print(log_alert, "Invalid capacity %d, using %u", "shm", capacity, _capacity);
+				} else {
+					_capacity = 1;
+					while (_capacity < (uint32_t)capacity)
+						_capacity <<= 1; // power of two to map positions with a mask
+				}
+			} else if (strcmp(key, "mode") == 0 && local_type == json_type_string) {
+				_mode = strtol(json_object_get_string(local_value), NULL, 8) & 0777;
+			} else {
+				print(log_alert, "Ignoring invalid field or type: %s=%s", NULL, key,
+					  json_object_get_string(local_value));
+			}
+		}
+	}
+	if (_name.empty() || _name[0] != '/')
+		_name.insert(0, "/");
+
+	print(log_finest, "ShmRing name=%s capacity=%u enabled=%d", "shm", _name.c_str(), _capacity,
+		  _enabled ? 1 : 0);
+}
+
+ShmRing::~ShmRing() {
+	if (_hdr) {
+		// tell the readers that this object is stale:
+		__atomic_store_n(&_hdr->magic, 0u, __ATOMIC_RELEASE);
+		__atomic_add_fetch(&_hdr->futex, 1, __ATOMIC_RELEASE);
+		syscall(SYS_futex, &_hdr->futex, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+		munmap(_hdr, _size);
+		shm_unlink(_name.c_str());
+	}
+}
+
+bool ShmRing::open(const std::vector<Channel::Ptr> &channels) {
+	if (!_enabled || _hdr)
+		return false;
+
+	const size_t channel_offset = sizeof(struct vz_shm_header);
+	size_t ring_offset = channel_offset + channels.size() * sizeof(struct vz_shm_channel);
+	ring_offset = (ring_offset + 63) & ~(size_t)63; // cache line aligned
+	_size = ring_offset + (size_t)_capacity * sizeof(struct vz_shm_record);
+
+	// readers of an old instance keep their mapping. they notice the cleared magic.
+	shm_unlink(_name.c_str());
+	int fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, _mode);
+	if (fd < 0) {
+		print(log_error, "shm_open(%s) failed: %s", "shm", _name.c_str(), strerror(errno));
+		return false;
+	}
+	fchmod(fd, _mode); // not affected by umask
+	if (ftruncate(fd, _size) != 0) {
+		print(log_error, "ftruncate(%s) failed: %s", "shm", _name.c_str(), strerror(errno));
+		close(fd);
+		shm_unlink(_name.c_str());
+		return false;
+	}
+	void *p = mmap(0, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		print(log_error, "mmap(%s) failed: %s", "shm", _name.c_str(), strerror(errno));
+		shm_unlink(_name.c_str());
+		return false;
+	}
+
+	_hdr = static_cast<struct vz_shm_header *>(p); // zero filled by ftruncate
+	_hdr->version = VZ_SHM_VERSION;
+	_hdr->header_size = sizeof(struct vz_shm_header);
+	_hdr->record_size = sizeof(struct vz_shm_record);
+	_hdr->capacity = _capacity;
+	_hdr->channels = channels.size();
+	_hdr->channel_offset = channel_offset;
+	_hdr->ring_offset = ring_offset;
+	_hdr->start_time = time(NULL);
+
+	struct vz_shm_channel *table =
+		reinterpret_cast<struct vz_shm_channel *>(static_cast<char *>(p) + channel_offset);
+	for (size_t i = 0; i < channels.size(); i++) {
+		strncpy(table[i].uuid, channels[i]->uuid(), VZ_SHM_UUID_LEN - 1);
+		strncpy(table[i].name, channels[i]->name(), VZ_SHM_NAME_LEN - 1);
+		_index[channels[i].get()] = i;
+	}
+	_ring = reinterpret_cast<struct vz_shm_record *>(static_cast<char *>(p) + ring_offset);
+
+	__atomic_store_n(&_hdr->magic, VZ_SHM_MAGIC, __ATOMIC_RELEASE); // now valid for readers
+
+	print(log_info, "Created shared memory ring %s (%u records, %u channels)", "shm",
+		  _name.c_str(), _capacity, (unsigned)channels.size());
+	return true;
+}
+
+void ShmRing::add(const Channel *ch, const int64_t &time_ms, const double &value) {
+	if (!_hdr)
+		return;
+	auto it = _index.find(ch); // _index is not modified after open()
+	if (it == _index.end())
+		return;
+
+	std::lock_guard<std::mutex> lock(_writeMutex);
+	const uint64_t pos = _hdr->head;
+	struct vz_shm_record *r = _ring + (pos & (_capacity - 1));
+
+	// seqlock: odd seq while the record is inconsistent
+	const uint32_t seq = r->seq;
+	__atomic_store_n(&r->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&r->channel, it->second, __ATOMIC_RELAXED);
+	__atomic_store_n(&r->pos, pos, __ATOMIC_RELAXED);
+	__atomic_store_n(&r->time_ms, time_ms, __ATOMIC_RELAXED);
+	__atomic_store(&r->value, const_cast<double *>(&value), __ATOMIC_RELAXED);
+	__atomic_store_n(&r->seq, seq + 2, __ATOMIC_RELEASE);
+
+	__atomic_store_n(&_hdr->head, pos + 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&_hdr->futex, 1, __ATOMIC_RELEASE);
+	// unconditional: readers map the object read-only and can't announce that they wait.
+	// without waiters this is a cheap syscall, records arrive at meter rates.
+	syscall(SYS_futex, &_hdr->futex, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
@@ -234,6 +234,11 @@ vz::api::InfluxDB::InfluxDB(const Channel::Ptr &ch, const std::list<Option> &pOp
 	_url.append("&precision=ms");
 	print(log_debug, "api InfluxDB using url %s", ch->name(), _url.c_str());
 	curl_free(database_urlencoded);
+
+	// the prewarm request doesn't know about ssl_verifypeer. same key as send(), so that the
+	// handle with the open connection is the one send() gets
+	if (curlSessionProvider && _ssl_verifypeer)
+		curlSessionProvider->prewarm(_host + ch->uuid(), _host);
 }
 
 // destructor
@@ -30,6 +30,7 @@
  * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <map>
 #include <unistd.h>
 
 #include "Config_Options.hpp"
@@ -42,7 +43,7 @@ extern Config_Options options;
 
 vz::api::MySmartGrid::MySmartGrid(Channel::Ptr ch, std::list<Option> pOptions)
 	: ApiIF(ch), _channelType(chn_type_device), _scaler(1), _response(new vz::api::CurlResponse()),
-	  _first_ts(0), _first_counter(0), _last_counter(0)
+	  _first_ts(0), _sent_ts(0), _first_counter(0), _last_counter(0)
 
 {
 	OptionList optlist;
@@ -92,6 +93,14 @@ vz::api::MySmartGrid::MySmartGrid(Channel::Ptr ch, std::list<Option> pOptions)
 	} catch (vz::VZException &e) {
 		throw;
 	}
+	bool batch;
+	try {
+		batch = optlist.lookup_bool(pOptions, "batch");
+	} catch (vz::OptionNotFoundException &e) {
+		batch = false; // one request per channel
+	} catch (vz::VZException &e) {
+		throw;
+	}
 	convertUuid(channel()->uuid());
 
 	switch (_channelType) {
@@ -129,9 +138,36 @@ vz::api::MySmartGrid::MySmartGrid(Channel::Ptr ch, std::list<Option> pOptions)
 
 	// set timeout to 5 sec. required if next router has an ip-change.
 	curl_easy_setopt(_curlIF.handle(), CURLOPT_TIMEOUT, curlTimeout);
+
+	if (batch) {
+		_device = _sharedDevice(_middleware + "/" + _deviceId);
+		std::lock_guard<std::mutex> lock(_device->mutex);
+		_device->members.push_back(this);
+		print(log_debug, "batch mode for device %s (%d channels)", channel()->name(),
+			  _deviceId.c_str(), (int)_device->members.size());
+	}
+}
+
+vz::api::MySmartGrid::~MySmartGrid() {
+	if (_device) {
+		std::lock_guard<std::mutex> lock(_device->mutex);
+		_device->members.remove(this);
+	}
 }
 
-vz::api::MySmartGrid::~MySmartGrid() {}
+std::shared_ptr<vz::api::MySmartGrid::Device>
+vz::api::MySmartGrid::_sharedDevice(const std::string &key) {
+	static std::mutex mutex;
+	static std::map<std::string, std::weak_ptr<Device>> devices;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::shared_ptr<Device> device = devices[key].lock();
+	if (!device) {
+		device = std::make_shared<Device>();
+		devices[key] = device;
+	}
+	return device;
+}
 
 void vz::api::MySmartGrid::send() {
 	json_object *json_obj = NULL;
@@ -141,6 +177,11 @@ void vz::api::MySmartGrid::send() {
 	long int http_code;
 	CURLcode curl_code;
 
+	if (_device) {
+		_sendBatch();
+		return;
+	}
+
 	// check if we want to send
 	time_t now = time(NULL);
 
@@ -190,6 +231,8 @@ void vz::api::MySmartGrid::send() {
 	if (curl_code == CURLE_OK && http_code == 200) { /* everything is ok */
 		print(log_debug, "Request succeeded with code: %i", channel()->name(), http_code);
 		_values.clear();
+		if (_channelType == chn_type_sensor)
+			_first_ts = _sent_ts;
 	} else { /* error */
 		channel()->buffer()->undelete();
 		if (curl_code != CURLE_OK) {
@@ -246,7 +289,67 @@ void vz::api::MySmartGrid::register_device() {
 	}
 }
 
-void vz::api::MySmartGrid::_send(const std::string &url, json_object *json_obj) {
+void vz::api::MySmartGrid::_sendBatch() {
+	std::unique_lock<std::mutex> lock(_device->mutex);
+
+	time_t now = time(NULL);
+	if (now - _device->last < interval()) {
+		print(log_debug, "api-MySmartGrid, skip message.", "");
+		return;
+	}
+
+	char url[255];
+	sprintf(url, "%s/device/%s", middleware().c_str(), _deviceId.c_str()); /* build url */
+
+	if (!_device->registered) {
+		if (!_send(url, _json_object_registration(), false)) {
+			lock.unlock(); // don't block the other members while waiting
+			_retryPause();
+			return;
+		}
+		_device->registered = true;
+	}
+
+	// {<heartbeat>, "measurements": {"<sensor id>": [[<timestamp>,<value>], ...], ...}}
+	json_object *json_obj = _json_object_heartbeat();
+	json_object *json_sensors = json_object_new_object();
+	std::list<MySmartGrid *> included;
+	for (auto m : _device->members) {
+		if (m->_channelType == chn_type_sensor) {
+			json_object *json_m = m->_apiSensor(m->channel()->buffer());
+			json_object *json_tuples;
+			if (json_m && json_object_object_get_ex(json_m, "measurements", &json_tuples) &&
+				json_object_array_length(json_tuples) > 0) {
+				json_object_object_add(json_sensors, m->uuid(), json_object_get(json_tuples));
+				included.push_back(m);
+			}
+			json_object_put(json_m);
+		} else { // the device itself has no values. the heartbeat is always included
+			Buffer::Ptr buf = m->channel()->buffer();
+			buf->lock();
+			for (Buffer::iterator it = buf->begin(); it != buf->end(); it++) {
+				it->mark_delete();
+			}
+			buf->unlock();
+			buf->clean();
+		}
+	}
+	json_object_object_add(json_obj, "measurements", json_sensors);
+
+	print(log_debug, "batch request for %d sensors", channel()->name(), (int)included.size());
+	if (_send(url, json_obj, false)) {
+		for (auto m : included) {
+			m->_values.clear();
+			m->_first_ts = m->_sent_ts;
+		}
+		_device->last = now;
+	} else {
+		lock.unlock(); // don't block the other members while waiting
+		_retryPause();
+	}
+}
+
+bool vz::api::MySmartGrid::_send(const std::string &url, json_object *json_obj, bool pause) {
 	char digest[255];
 
 	const char *json_str;
@@ -259,7 +362,8 @@ void vz::api::MySmartGrid::_send(const std::string &url, json_object *json_obj)
 	json_str = json_object_to_json_string(json_obj);
 	if (json_str == NULL || strcmp(json_str, "null") == 0) {
 		print(log_debug, "JSON request body is null. Nothing to send now.", channel()->name());
-		return;
+		json_object_put(json_obj);
+		return false;
 	}
 
 	print(log_debug, "JSON request body: '%s'", channel()->name(), json_str);
@@ -285,7 +389,6 @@ void vz::api::MySmartGrid::_send(const std::string &url, json_object *json_obj)
 	/* check response */
 	if (curl_code == CURLE_OK && http_code == 200) { /* everything is ok */
 		print(log_debug, "Request succeeded with code: %i", channel()->name(), http_code);
-		_values.clear();
 	} else { /* error */
 		channel()->buffer()->undelete();
 		if (curl_code != CURLE_OK) {
@@ -302,10 +405,17 @@ void vz::api::MySmartGrid::_send(const std::string &url, json_object *json_obj)
 	json_object_put(json_obj);
 
 	if ((curl_code != CURLE_OK || http_code != 200)) {
-		print(log_info, "Waiting %i secs for next request due to previous failure",
-			  channel()->name(), options.retry_pause());
-		sleep(options.retry_pause());
+		if (pause)
+			_retryPause();
+		return false;
 	}
+	return true;
+}
+
+void vz::api::MySmartGrid::_retryPause() {
+	print(log_info, "Waiting %i secs for next request due to previous failure", channel()->name(),
+		  options.retry_pause());
+	sleep(options.retry_pause());
 }
 
 void vz::api::MySmartGrid::api_parse_exception(char *err, size_t n) {
@@ -478,6 +588,7 @@ json_object *vz::api::MySmartGrid::_json_object_measurements(Buffer::Ptr buf) {
 
 	long timestamp = 0;
 	long value = 0.0;
+	_sent_ts = _first_ts; // _first_ts is advanced by the caller once the request succeeded
 
 	// print(log_debug, "MSG-API, buffer has %d element.", channel()->name(), buf->size());
 	if (_values.size()) {
@@ -521,8 +632,8 @@ json_object *vz::api::MySmartGrid::_json_object_measurements(Buffer::Ptr buf) {
 			_first_counter = value;
 			_last_counter = value;
 		} else {
-			if (/*(_last_counter < value)  &&*/ (_first_ts < timestamp)) {
-				_first_ts = timestamp;
+			if (/*(_last_counter < value)  &&*/ (_sent_ts < timestamp)) {
+				_sent_ts = timestamp;
 				json_object_array_add(json_tuple, json_object_new_int(timestamp));
 				json_object_array_add(json_tuple, json_object_new_int(value - _first_counter));
 				json_object_array_add(json_tuples, json_tuple);
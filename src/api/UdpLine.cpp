@@ -0,0 +1,306 @@
+/***********************************************************************/
+/** @file UdpLine.cpp
+ * Fire-and-forget api sending line protocols over UDP. As many lines as fit
+ * into the configured mtu are packed into one datagram, longer lines are
+ * dropped. Nothing is retried, values are dropped from the buffer once handed
+ * to the kernel.
+ *
+ * @copyright Copyright (c) 2026, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ **/
+/*---------------------------------------------------------------------*/
+
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Config_Options.hpp"
+#include <VZException.hpp>
+#include <api/UdpLine.hpp>
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+extern Config_Options options;
+
+vz::api::UdpLine::UdpLine(const Channel::Ptr &ch, const std::list<Option> &pOptions)
+	: ApiIF(ch), _fd(-1), _last_timestamp(0), _last_value(0), _have_last(false) {
+	OptionList optlist;
+	print(log_debug, "UdpLine API initialize", ch->name());
+
+	try {
+		_host = optlist.lookup_string(pOptions, "host");
+		print(log_finest, "api udp using host %s", ch->name(), _host.c_str());
+	} catch (vz::OptionNotFoundException &e) {
+		print(log_alert, "api udp requires parameter \"host\"!", ch->name());
+		throw;
+	} catch (vz::VZException &e) {
+		print(log_alert, "api udp requires parameter \"host\" as string!", ch->name());
+		throw;
+	}
+
+	std::string format;
+	try {
+		format = optlist.lookup_string(pOptions, "format");
+	} catch (vz::OptionNotFoundException &e) {
+		format = "influxdb";
+	} catch (vz::VZException &e) {
+		print(log_alert, "api udp requires parameter \"format\" as string!", ch->name());
+		throw;
+	}
+	if (format == "influxdb") {
+		_format = FORMAT_INFLUXDB;
+		_port = 8089;
+	} else if (format == "graphite") {
+		_format = FORMAT_GRAPHITE;
+		_port = 2003;
+	} else if (format == "statsd") {
+		_format = FORMAT_STATSD;
+		_port = 8125;
+	} else {
+		print(log_alert, "api udp: unknown format \"%s\" (influxdb, graphite or statsd)",
+			  ch->name(), format.c_str());
+		throw vz::VZException("api udp: unknown format");
+	}
+	print(log_finest, "api udp using format %s", ch->name(), format.c_str());
+
+	try {
+		_port = optlist.lookup_int(pOptions, "port");
+	} catch (vz::OptionNotFoundException &e) {
+		// default port of the format
+	} catch (vz::VZException &e) {
+		print(log_alert, "api udp requires parameter \"port\" as int!", ch->name());
+		throw;
+	}
+	if (_port <= 0 || _port > 65535) {
+		print(log_alert, "api udp: invalid port %d", ch->name(), _port);
+		throw vz::VZException("api udp: invalid port");
+	}
+	print(log_finest, "api udp using port %d", ch->name(), _port);
+
+	try {
+		_measurement_name = optlist.lookup_string(pOptions, "measurement_name");
+	} catch (vz::OptionNotFoundException &e) {
+		_measurement_name = "vzlogger";
+	} catch (vz::VZException &e) {
+		print(log_alert, "api udp requires parameter \"measurement_name\" as string!",
+			  ch->name());
+		throw;
+	}
+
+	try {
+		_tags = optlist.lookup_string(pOptions, "tags");
+		if (_format != FORMAT_INFLUXDB)
+			print(log_warning, "api udp: \"tags\" are only used for format influxdb",
+				  ch->name());
+	} catch (vz::OptionNotFoundException &e) {
+		_tags = "";
+	} catch (vz::VZException &e) {
+		print(log_alert, "api udp requires parameter \"tags\" as string!", ch->name());
+		throw;
+	}
+
+	try {
+		_send_uuid = optlist.lookup_bool(pOptions, "send_uuid");
+	} catch (vz::OptionNotFoundException &e) {
+		_send_uuid = true;
+	} catch (vz::VZException &e) {
+		print(log_alert, "api udp requires parameter \"send_uuid\" as bool!", ch->name());
+		throw;
+	}
+
+	int mtu;
+	try {
+		mtu = optlist.lookup_int(pOptions, "mtu");
+	} catch (vz::OptionNotFoundException &e) {
+		mtu = 1472; // ethernet mtu minus ipv4 and udp header
+	} catch (vz::VZException &e) {
+		print(log_alert, "api udp requires parameter \"mtu\" as int!", ch->name());
+		throw;
+	}
+	if (mtu < 64 || mtu > 65507) {
+		print(log_alert, "api udp: mtu %d out of range (64..65507)", ch->name(), mtu);
+		throw vz::VZException("api udp: invalid mtu");
+	}
+	_mtu = mtu;
+	print(log_finest, "api udp using mtu %d", ch->name(), mtu);
+}
+
+vz::api::UdpLine::~UdpLine() {
+	if (_fd >= 0)
+		close(_fd);
+}
+
+bool vz::api::UdpLine::open_socket() {
+	// resolved on demand so that vzlogger can start before the network/dns is up
+	struct addrinfo hints;
+	struct addrinfo *res = 0;
+	char port[8];
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	snprintf(port, sizeof(port), "%d", _port);
+
+	int err = getaddrinfo(_host.c_str(), port, &hints, &res);
+	if (err) {
+		print(log_error, "api udp: cannot resolve %s: %s", channel()->name(), _host.c_str(),
+			  gai_strerror(err));
+		return false;
+	}
+
+	for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+		_fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+					 ai->ai_protocol);
+		if (_fd < 0)
+			continue;
+		if (connect(_fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(_fd);
+		_fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if (_fd < 0) {
+		print(log_error, "api udp: cannot create socket for %s:%d: %s", channel()->name(),
+			  _host.c_str(), _port, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+void vz::api::UdpLine::append_line(std::string &line, const Reading &r) {
+	char buf[64];
+	const char *key = _send_uuid ? channel()->uuid() : channel()->name();
+
+	switch (_format) {
+	case FORMAT_INFLUXDB:
+		// <measurement>[,uuid=<uuid>][,<tags>] value=<value> <timestamp in ns>
+		line.append(_measurement_name);
+		if (_send_uuid) {
+			line.append(",uuid=");
+			line.append(channel()->uuid());
+		}
+		if (!_tags.empty()) {
+			line.append(",");
+			line.append(_tags);
+		}
+		snprintf(buf, sizeof(buf), " value=%.6f %lld000000\n", r.value(),
+				 (long long)r.time_ms());
+		line.append(buf);
+		break;
+	case FORMAT_GRAPHITE:
+		// <measurement>.<key> <value> <timestamp in s>
+		line.append(_measurement_name);
+		line.append(".");
+		line.append(key);
+		snprintf(buf, sizeof(buf), " %.6f %lld\n", r.value(), (long long)r.time_s());
+		line.append(buf);
+		break;
+	case FORMAT_STATSD:
+		// <measurement>.<key>:<value>|g
+		// a signed gauge value is a delta in statsd so negative values need a reset to 0 first
+		if (r.value() < 0) {
+			line.append(_measurement_name);
+			line.append(".");
+			line.append(key);
+			line.append(":0|g\n");
+		}
+		line.append(_measurement_name);
+		line.append(".");
+		line.append(key);
+		snprintf(buf, sizeof(buf), ":%.6f|g\n", r.value());
+		line.append(buf);
+		break;
+	}
+}
+
+void vz::api::UdpLine::send_datagram(const std::string &datagram) {
+	if (_fd < 0 || datagram.empty())
+		return;
+	ssize_t res = ::send(_fd, datagram.data(), datagram.size(), MSG_NOSIGNAL);
+	if (res < 0) {
+		// ECONNREFUSED only reports an icmp error of a previous datagram. nothing to do about it.
+		if (errno != ECONNREFUSED && errno != EAGAIN && errno != EWOULDBLOCK) {
+			print(log_warning, "api udp: send failed: %s", channel()->name(), strerror(errno));
+			close(_fd); // resolve again with the next send
+			_fd = -1;
+		} else {
+			print(log_debug, "api udp: send failed: %s", channel()->name(), strerror(errno));
+		}
+	} else {
+		print(log_finest, "api udp: sent %d bytes", channel()->name(), (int)res);
+	}
+}
+
+void vz::api::UdpLine::send() {
+	Buffer::Ptr buf = channel()->buffer();
+	const int duplicates = channel()->duplicates();
+	const int64_t duplicates_ms = duplicates * 1000LL;
+	std::string datagram;
+	std::string line;
+	size_t lines = 0;
+
+	if (_fd < 0)
+		open_socket(); // if this fails the values are dropped anyhow
+
+	datagram.reserve(_mtu);
+	buf->lock();
+	for (Buffer::iterator it = buf->begin(); it != buf->end(); it++) {
+		const Reading &r = *it;
+		it->mark_delete();
+
+		const int64_t timestamp = r.time_ms();
+		if (_last_timestamp > timestamp)
+			continue; // no timestamps from the past
+		if (duplicates && _have_last && timestamp < _last_timestamp + duplicates_ms &&
+			r.value() == _last_value)
+			continue; // duplicate, ignore it
+		_last_timestamp = timestamp;
+		_last_value = r.value();
+		_have_last = true;
+
+		line.clear();
+		append_line(line, r);
+		if (line.size() > _mtu) { // a line can't be split over datagrams
+			print(log_error, "api udp: dropped %d byte line exceeding the mtu of %d",
+				  channel()->name(), (int)line.size(), (int)_mtu);
+			continue;
+		}
+		if (datagram.size() + line.size() > _mtu) {
+			send_datagram(datagram);
+			datagram.clear();
+		}
+		datagram.append(line);
+		lines++;
+	}
+	buf->unlock();
+	send_datagram(datagram);
+	buf->clean();
+
+	if (lines)
+		print(log_debug, "api udp: sent %d lines", channel()->name(), (int)lines);
+	else
+		print(log_info, "Nothing to send to udp api", channel()->name());
+}
+
+void vz::api::UdpLine::register_device() {}
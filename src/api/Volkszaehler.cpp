@@ -83,6 +83,9 @@ vz::api::Volkszaehler::Volkszaehler(Channel::Ptr ch, std::list<Option> pOptions)
 	_url.append(channel()->uuid());
 	_url.append(".json");
 
+	if (curlSessionProvider)
+		curlSessionProvider->prewarm(_middleware, _middleware);
+
 	_api.headers = NULL;
 	_api.headers = curl_slist_append(_api.headers, "Content-type: application/json");
 	_api.headers = curl_slist_append(_api.headers, "Accept: application/json");
@@ -115,7 +118,7 @@ void vz::api::Volkszaehler::send() {
 
 	_api.curl = curlSessionProvider
 					? curlSessionProvider->get_easy_session(_middleware)
-					: 0; // TODO add option to use parallel sessions. Simply add uuid() to the key.
+					: 0; // channels share the pool of sessions for the middleware (curl_handles)
 	if (!_api.curl) {
 		throw vz::VZException("CURL: cannot create handle.");
 	}
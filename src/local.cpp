@@ -23,107 +23,775 @@
  * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
+#include <endian.h>
 #include <json-c/json.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include "Channel.hpp"
+#include "LocalBuffer.hpp"
+#include "Metrics.hpp"
 #include "local.h"
 #include "vzlogger.h"
+#include "vzlogger_columns.h"
 #include <MeterMap.hpp>
 #include <VZException.hpp>
 #include <pthread.h>
+#ifdef ENABLE_MQTT
+#include "mqtt.hpp"
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 extern Config_Options options;
 
-class ChannelData {
+#define LOCALBUFFER_INITIAL 64 // initial capacity of a time based LocalBuffer
+
+// tuples by uuid. Built with local_index, read-only afterwards. Each buffer has its own lock.
+static std::unordered_map<std::string, std::unique_ptr<LocalBuffer>> localbuffer;
+
+// tuple range requested with ?from=&to=&limit= and downsampled with ?points=&method=
+class LocalQuery {
+  public:
+	LocalQuery()
+		: _from(INT64_MIN), _to(INT64_MAX), _limit(0), _points(0), _method(DOWNSAMPLE_LTTB) {};
+	bool all() const { return _from == INT64_MIN && _to == INT64_MAX && !_limit && !_points; }
+	int64_t _from; // in ms
+	int64_t _to;
+	size_t _limit;  // 0 = no limit
+	size_t _points; // 0 = no downsampling
+	DownsampleMethod _method;
+};
+
+// changes whenever any LocalBuffer changes, the version of the channel index
+static std::atomic<uint64_t> localbuffer_version(0);
+
+// serialized response for a url, reused until the data changes. ETags are unique across
+// restarts as they contain the start time.
+class LocalResponse {
   public:
-	ChannelData(const int64_t &t, const double &v) : _t(t), _v(v) {};
-	int64_t _t;
-	double _v;
+	LocalResponse() : _code(MHD_HTTP_NOT_FOUND), _version(0) {};
+	int _code;
+	uint64_t _version;
+	std::string _etag; // empty if not cached
+	std::string _body;
+	std::string _gzip; // empty if not worth it or without zlib
 };
+static std::mutex responses_mutex; // protects responses
+static std::unordered_map<std::string, std::shared_ptr<const LocalResponse>> responses;
+static time_t local_epoch = 0;
 
-typedef std::list<ChannelData> LIST_ChannelData;
-typedef std::map<std::string, LIST_ChannelData> MAP_UUID_ChannelData;
-pthread_mutex_t localbuffer_mutex = PTHREAD_MUTEX_INITIALIZER;
-MAP_UUID_ChannelData localbuffer;
+// channels by uuid for the request handler. Built before the httpd starts, read-only afterwards.
+class LocalChannel {
+  public:
+	LocalChannel(MeterMap *mapping, Channel::Ptr ch) : _mapping(mapping), _ch(ch) {};
+	MeterMap *_mapping;
+	Channel::Ptr _ch;
+};
+static std::unordered_map<std::string, std::vector<LocalChannel>> local_index;
+
+// background thread removing outdated tuples from a time based localbuffer and timing out
+// waiting requests
+static std::thread housekeeping_thread;
+static std::mutex housekeeping_mutex;
+static std::condition_variable housekeeping_cond;
+static bool housekeeping_stop = false;
+
+// comet (long poll) and server-sent events requests waiting for new tuples. With a thread pool
+// their connections are suspended and resumed once there is something to send. With a thread
+// per connection they block on _cond instead.
+#define SSE_KEEPALIVE 15             // in s, comment sent to idle event streams
+#define SSE_MAX_PENDING (256 * 1024) // streams with more unsent data are closed
+
+class LocalWaiter {
+  public:
+	LocalWaiter(struct MHD_Connection *connection, const std::string &uuid, bool sse)
+		: _connection(connection), _uuid(uuid), _sse(sse), _ready(false), _suspended(false),
+		  _closed(false), _deadline(0), _sent(0) {};
+	struct MHD_Connection *_connection;
+	std::string _uuid;   // empty for all channels
+	bool _sse;           // event stream, otherwise comet
+	bool _ready;         // comet: new tuples or timeout
+	bool _suspended;     // the connection is suspended
+	bool _closed;        // sse: end the stream once _events are sent
+	time_t _deadline;    // comet: timeout, sse: next keep alive
+	std::string _events; // sse: events to send
+	size_t _sent;        // sse: bytes of _events sent already
+	std::condition_variable _cond;
+};
+
+static std::mutex waiters_mutex; // protects waiters, waiters_stop and all LocalWaiter members
+static std::list<LocalWaiter *> waiters;
+static std::atomic<size_t> waiters_count(0); // avoids the lock in add_ch_to_localbuffer
+static bool waiters_stop = false;
+static bool local_suspend = false; // MHD_ALLOW_SUSPEND_RESUME is set
+
+// state for the /metrics endpoint. Writers (reading threads) update these maps under
+// metrics_mutex and render a new snapshot. Scrapers only load the snapshot and never lock.
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, MetricsChannel> metrics_channels; // by uuid
+static std::map<std::string, MetricsMeter> metrics_meters;     // by meter name
+static std::shared_ptr<const std::string> metrics_snapshot;     // use atomic_load/_store only
+
+// oldest time to keep in a time based localbuffer
+static int64_t localbuffer_min_time() {
+	Reading rnow;
+	rnow.time(); // sets to "now"
+	return rnow.time_ms() - (1000 * options.buffer_length()); // now - time to keep in buffer
+}
 
 void shrink_localbuffer() // remove old data in the local buffer
 {
 	if (options.buffer_length() >= 0) { // time based localbuffer. keep buffer_length secs
-		Reading rnow;
-		rnow.time(); // sets to "now"
-		int64_t minT =
-			rnow.time_ms() - (1000 * options.buffer_length()); // now - time to keep in buffer
+		const int64_t minT = localbuffer_min_time();
+		for (auto &it : localbuffer)
+			if (it.second->expire(minT))
+				localbuffer_version++;
+	}
+}
+
+// with waiters_mutex held
+static void wake(LocalWaiter *w) {
+	if (w->_suspended) {
+		w->_suspended = false;
+		MHD_resume_connection(w->_connection);
+	}
+	w->_cond.notify_all();
+}
+
+// with waiters_mutex held
+static void unregister(LocalWaiter *w) {
+	std::list<LocalWaiter *>::iterator it = std::find(waiters.begin(), waiters.end(), w);
+	if (it != waiters.end()) {
+		waiters.erase(it);
+		waiters_count--;
+	}
+}
+
+// answer comet requests after comet_timeout and send keep alives to idle event streams
+static void local_timeouts() {
+	if (!waiters_count)
+		return;
+	const time_t now = time(NULL);
+	std::lock_guard<std::mutex> lock(waiters_mutex);
+	for (std::list<LocalWaiter *>::iterator it = waiters.begin(); it != waiters.end();) {
+		LocalWaiter *w = *it;
+		if (w->_deadline > now) {
+			++it;
+		} else if (w->_sse) {
+			w->_events += ": keepalive\n\n";
+			w->_deadline = now + SSE_KEEPALIVE;
+			wake(w);
+			++it;
+		} else {
+			w->_ready = true;
+			it = waiters.erase(it);
+			waiters_count--;
+			wake(w);
+		}
+	}
+}
+
+// append a json object as server-sent event
+static void sse_append(std::string &events, struct json_object *jso) {
+	events += "data: ";
+	events += json_object_to_json_string_ext(jso, JSON_C_TO_STRING_PLAIN);
+	events += "\n\n";
+}
+
+// pass new tuples of a channel to the waiting requests
+static void local_notify(const std::string &uuid, const std::vector<ChannelData> &tuples) {
+	std::string event;
+	std::lock_guard<std::mutex> lock(waiters_mutex);
+	for (std::list<LocalWaiter *>::iterator it = waiters.begin(); it != waiters.end();) {
+		LocalWaiter *w = *it;
+		if (w->_uuid.length() && w->_uuid != uuid) {
+			++it;
+			continue;
+		}
+		if (w->_sse) {
+			if (event.empty()) {
+				struct json_object *json_event = json_object_new_object();
+				struct json_object *json_tuples = json_object_new_array();
+				for (const ChannelData &d : tuples) {
+					struct json_object *json_tuple = json_object_new_array();
+					json_object_array_add(json_tuple, json_object_new_int64(d._t));
+					json_object_array_add(json_tuple, json_object_new_double(d._v));
+					json_object_array_add(json_tuples, json_tuple);
+				}
+				json_object_object_add(json_event, "uuid", json_object_new_string(uuid.c_str()));
+				json_object_object_add(json_event, "tuples", json_tuples);
+				sse_append(event, json_event);
+				json_object_put(json_event);
+			}
+			if (w->_events.length() - w->_sent > SSE_MAX_PENDING) {
+				print(log_warning, "closing event stream, client is too slow", "http");
+				w->_events.clear();
+				w->_sent = 0;
+				w->_closed = true;
+			} else if (!w->_closed) {
+				w->_events += event;
+			}
+			w->_deadline = time(NULL) + SSE_KEEPALIVE;
+			wake(w);
+			++it;
+		} else {
+			w->_ready = true;
+			it = waiters.erase(it);
+			waiters_count--;
+			wake(w);
+		}
+	}
+}
+
+void start_local_housekeeping() {
+	if (housekeeping_thread.joinable())
+		return;
+	housekeeping_stop = false;
+	housekeeping_thread = std::thread([]() {
+		std::unique_lock<std::mutex> lock(housekeeping_mutex);
+		while (!housekeeping_stop) {
+			lock.unlock();
+			shrink_localbuffer(); // size based buffers are limited in add_ch_to_localbuffer
+			local_timeouts();
+			lock.lock();
+			housekeeping_cond.wait_for(lock, std::chrono::seconds(1),
+									   []() { return housekeeping_stop; });
+		}
+	});
+}
 
-		pthread_mutex_lock(&localbuffer_mutex);
+void stop_local_housekeeping() {
+	if (!housekeeping_thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(housekeeping_mutex);
+		housekeeping_stop = true;
+	}
+	housekeeping_cond.notify_all();
+	housekeeping_thread.join();
+}
 
-		MAP_UUID_ChannelData::iterator it = localbuffer.begin();
-		for (; it != localbuffer.end(); ++it) {
-			LIST_ChannelData &l = it->second;
-			LIST_ChannelData::iterator lit = l.begin();
+void stop_local_waiters() {
+	std::lock_guard<std::mutex> lock(waiters_mutex);
+	waiters_stop = true;
+	for (LocalWaiter *w : waiters) {
+		w->_ready = true;
+		w->_closed = true;
+		wake(w);
+	}
+	waiters.clear(); // sse waiters are deleted by sse_free
+	waiters_count = 0;
+}
 
-			while (lit != l.end() && ((lit->_t) < minT))
-				lit = l.erase(lit);
+void request_completed(void *cls, struct MHD_Connection *connection, void **con_cls,
+					   enum MHD_RequestTerminationCode toe) {
+	LocalWaiter *w = static_cast<LocalWaiter *>(*con_cls);
+	if (w) { // comet request
+		{
+			std::lock_guard<std::mutex> lock(waiters_mutex);
+			unregister(w);
 		}
+		delete w;
+		*con_cls = NULL;
+	}
+}
 
-		pthread_mutex_unlock(&localbuffer_mutex);
+// wait for new tuples or comet_timeout. returns true if the connection got suspended.
+static bool comet_wait(LocalWaiter *w) {
+	std::unique_lock<std::mutex> lock(waiters_mutex);
+	if (waiters_stop)
+		return false;
+	w->_deadline = time(NULL) + options.comet_timeout();
+	waiters.push_back(w);
+	waiters_count++;
+	if (local_suspend) {
+		w->_suspended = true;
+		MHD_suspend_connection(w->_connection);
+		return true;
 	}
+	w->_cond.wait_for(lock, std::chrono::seconds(options.comet_timeout()),
+					  [w]() { return w->_ready; });
+	unregister(w);
+	return false;
+}
+
+static ssize_t sse_read(void *cls, uint64_t pos, char *buf, size_t max) {
+	LocalWaiter *w = static_cast<LocalWaiter *>(cls);
+	std::unique_lock<std::mutex> lock(waiters_mutex);
+	while (w->_sent == w->_events.length()) {
+		w->_events.clear();
+		w->_sent = 0;
+		if (w->_closed)
+			return MHD_CONTENT_READER_END_OF_STREAM;
+		if (local_suspend) { // resumed by local_notify or local_timeouts
+			w->_suspended = true;
+			MHD_suspend_connection(w->_connection);
+			return 0;
+		}
+		w->_cond.wait(lock, [w]() { return w->_closed || w->_sent < w->_events.length(); });
+	}
+	size_t len = std::min(max, w->_events.length() - w->_sent);
+	memcpy(buf, w->_events.data() + w->_sent, len);
+	w->_sent += len;
+	return len;
+}
+
+static void sse_free(void *cls) {
+	LocalWaiter *w = static_cast<LocalWaiter *>(cls);
+	{
+		std::lock_guard<std::mutex> lock(waiters_mutex);
+		unregister(w);
+	}
+	delete w;
+}
+
+void init_local_index(MapContainer &mappings, bool suspend) {
+	local_suspend = suspend;
+	local_epoch = time(NULL);
+	local_index.clear();
+	localbuffer.clear();
+	responses.clear();
+	// size based buffers keep -buffer_length tuples, time based ones grow as needed
+	const bool fixed = options.buffer_length() < 0;
+	const size_t capacity = fixed ? -options.buffer_length() : LOCALBUFFER_INITIAL;
+	for (MapContainer::iterator mapping = mappings.begin(); mapping != mappings.end(); mapping++)
+		for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
+			local_index[(*ch)->uuid()].push_back(LocalChannel(&*mapping, *ch));
+			std::unique_ptr<LocalBuffer> &l = localbuffer[(*ch)->uuid()];
+			if (!l)
+				l.reset(new LocalBuffer(capacity, fixed));
+		}
+	print(log_debug, "local index with %zu uuids", "http", local_index.size());
 }
 
 void add_ch_to_localbuffer(Channel &ch) {
-	pthread_mutex_lock(&localbuffer_mutex);
-	LIST_ChannelData &l = localbuffer[ch.uuid()];
+	auto lb = localbuffer.find(ch.uuid());
+	if (lb == localbuffer.end())
+		return; // not indexed
+	LocalBuffer &l = *lb->second;
 
 	// now add all not-deleted items to the localbuffer:
 	Buffer::Ptr buf = ch.buffer();
 	Buffer::iterator it;
+	size_t added = 0;
+	ChannelData last;
+	const bool notify = waiters_count > 0;
+	std::vector<ChannelData> tuples; // for the waiting requests
 	for (it = buf->begin(); it != buf->end(); ++it) {
 		Reading &r = *it;
 		if (!r.deleted()) {
-			l.push_back(ChannelData(r.time_ms(), r.value()));
+			last = ChannelData(r.time_ms(), r.value());
+			l.add(last._t, last._v);
+			if (notify)
+				tuples.push_back(last);
+			added++;
 		}
 	}
-	if (options.buffer_length() < 0) { // max size based localbuffer. keep max -buffer_length items
-		while (l.size() > static_cast<unsigned int>(-(options.buffer_length())))
-			l.pop_front();
+
+	if (added) {
+		localbuffer_version++;
+
+		pthread_mutex_lock(&metrics_mutex);
+		MetricsChannel &m = metrics_channels[ch.uuid()];
+		m._t = last._t;
+		m._v = last._v;
+		m._tuples += added;
+		m._valid = true;
+		pthread_mutex_unlock(&metrics_mutex);
+
+		if (notify)
+			local_notify(ch.uuid(), tuples);
+	}
+}
+
+// render all metrics. needs metrics_mutex to be locked
+static std::string metrics_render() {
+	std::string toRet = metrics_render(metrics_channels, metrics_meters);
+
+#ifdef ENABLE_MQTT
+	char buf[64];
+	if (mqttClient) { // as of the end of the last period
+		MqttClient::Stats s = mqttClient->stats();
+		snprintf(buf, sizeof(buf), "vzlogger_mqtt_queue_depth %zu\n", s._depth);
+		toRet += "# HELP vzlogger_mqtt_queue_depth Messages in the mqtt outbound queue.\n"
+				 "# TYPE vzlogger_mqtt_queue_depth gauge\n";
+		toRet += buf;
+		snprintf(buf, sizeof(buf), "vzlogger_mqtt_inflight %d\n", s._inflight);
+		toRet += "# HELP vzlogger_mqtt_inflight Messages not yet confirmed by the broker.\n"
+				 "# TYPE vzlogger_mqtt_inflight gauge\n";
+		toRet += buf;
+		snprintf(buf, sizeof(buf), "vzlogger_mqtt_sent_total %lu\n", s._sent);
+		toRet += "# HELP vzlogger_mqtt_sent_total Messages passed to the broker connection.\n"
+				 "# TYPE vzlogger_mqtt_sent_total counter\n";
+		toRet += buf;
+		snprintf(buf, sizeof(buf), "vzlogger_mqtt_dropped_total %lu\n", s._dropped);
+		toRet += "# HELP vzlogger_mqtt_dropped_total Messages dropped as the queue was full.\n"
+				 "# TYPE vzlogger_mqtt_dropped_total counter\n";
+		toRet += buf;
+		snprintf(buf, sizeof(buf), "vzlogger_mqtt_superseded_total %lu\n", s._superseded);
+		toRet += "# HELP vzlogger_mqtt_superseded_total Queued messages replaced by a newer one "
+				 "for the same topic.\n"
+				 "# TYPE vzlogger_mqtt_superseded_total counter\n";
+		toRet += buf;
+	}
+#endif
+
+	return toRet;
+}
+
+void update_local_metrics(MeterMap &mapping, size_t readings) {
+	Meter::Ptr mtr = mapping.meter();
+	const char *protocol = meter_get_details(mtr->protocolId())->name;
+
+	pthread_mutex_lock(&metrics_mutex);
+	MetricsMeter &m = metrics_meters[mtr->name()];
+	m._protocol = protocol;
+	m._readings += readings;
+	m._periods++;
+
+	for (MeterMap::iterator ch = mapping.begin(); ch != mapping.end(); ch++) {
+		MetricsChannel &c = metrics_channels[(*ch)->uuid()];
+		if (c._meter.empty()) { // labels don't change, so set them only once
+			c._meter = mtr->name();
+			c._protocol = protocol;
+			try {
+				char id[MAX_IDENTIFIER_LEN];
+				id[0] = 0;
+				(*ch)->identifier()->unparse(id, sizeof(id));
+				c._identifier = id;
+			} catch (std::exception &e) {
+				// identifier not set, keep the label empty
+			}
+		}
 	}
 
-	pthread_mutex_unlock(&localbuffer_mutex);
+	std::shared_ptr<const std::string> snapshot(new std::string(metrics_render()));
+	pthread_mutex_unlock(&metrics_mutex);
+
+	std::atomic_store(&metrics_snapshot, snapshot);
 }
 
-json_object *api_json_tuples(const char *uuid) {
+// the housekeeping thread runs once a second only, so skip outdated tuples here
+static int64_t local_from(const LocalQuery &q) {
+	if (options.buffer_length() >= 0)
+		return std::max(q._from, localbuffer_min_time());
+	return q._from;
+}
+
+// the tuples selected by q, downsampled if requested. Returns their number.
+static size_t local_range(const LocalBuffer &lb, const LocalQuery &q,
+						  std::vector<ChannelData> &out) {
+	if (!lb.range(local_from(q), q._to, q._limit, out))
+		return 0;
+	if (q._points > 0 && out.size() > q._points) {
+		std::vector<ChannelData> reduced;
+		downsample(out, q._points, q._method, reduced);
+		out.swap(reduced);
+	}
+	return out.size();
+}
+
+json_object *api_json_tuples(const char *uuid, const LocalQuery &q) {
 
 	if (!uuid)
 		return NULL;
-	pthread_mutex_lock(&localbuffer_mutex);
-	LIST_ChannelData &l = localbuffer[uuid];
-
-	print(log_debug, "==> number of tuples: %d", uuid, l.size());
+	auto lb = localbuffer.find(uuid);
+	if (lb == localbuffer.end())
+		return NULL;
 
-	if (l.size() < 1) {
-		pthread_mutex_unlock(&localbuffer_mutex);
+	std::vector<ChannelData> l;
+	if (!local_range(*lb->second, q, l))
 		return NULL;
-	}
+
+	print(log_debug, "==> number of tuples: %d", uuid, l.size());
 
 	json_object *json_tuples = json_object_new_array();
-	for (LIST_ChannelData::const_iterator cit = l.cbegin(); cit != l.cend(); ++cit) {
+	for (const ChannelData &d : l) {
 		struct json_object *json_tuple = json_object_new_array();
 
-		json_object_array_add(json_tuple, json_object_new_int64(cit->_t));
-		json_object_array_add(json_tuple, json_object_new_double(cit->_v));
+		json_object_array_add(json_tuple, json_object_new_int64(d._t));
+		json_object_array_add(json_tuple, json_object_new_double(d._v));
 
 		json_object_array_add(json_tuples, json_tuple);
 	}
-	pthread_mutex_unlock(&localbuffer_mutex);
 
 	return json_tuples;
 }
 
+static json_object *api_json_channel(MeterMap &mapping, Channel &ch, const LocalQuery &q) {
+	struct json_object *json_ch = json_object_new_object();
+
+	json_object_object_add(json_ch, "uuid", json_object_new_string(ch.uuid()));
+	// Add OBIS identifier from config (e.g. "1-0:1.8.0")
+	try {
+		const std::string obis_str = ch.identifier()->toString();
+		json_object_object_add(json_ch, "obis", json_object_new_string(obis_str.c_str()));
+	} catch (std::exception &e) {
+		// identifier not set or not convertible — skip silently
+	}
+	json_object_object_add(json_ch, "last",
+						   json_object_new_int64(ch.time_ms())); // return here in ms as well
+	json_object_object_add(json_ch, "interval", json_object_new_int(mapping.meter()->interval()));
+	json_object_object_add(
+		json_ch, "protocol",
+		json_object_new_string(meter_get_details(mapping.meter()->protocolId())->name));
+
+	struct json_object *json_tuples = api_json_tuples(ch.uuid(), q);
+	if (json_tuples)
+		json_object_object_add(json_ch, "tuples", json_tuples);
+	return json_ch;
+}
+
+// the json document for a channel (or all channels for the index)
+static void api_json_render(MapContainer *mappings, const char *url, bool show_all,
+							const LocalQuery &q, LocalResponse &r) {
+	struct json_object *json_obj = json_object_new_object();
+	struct json_object *json_data = json_object_new_array();
+	struct json_object *json_exception = NULL;
+	const char *uuid = url + 1; // strip leading slash
+
+	if (strcmp(url, "/") == 0 && !show_all) {
+		json_exception = json_object_new_object();
+
+		json_object_object_add(json_exception, "message",
+							   json_object_new_string("channel index is disabled"));
+		json_object_object_add(json_exception, "code", json_object_new_int(0));
+	}
+
+	if (show_all) {
+		for (MapContainer::iterator mapping = mappings->begin(); mapping != mappings->end();
+			 mapping++) {
+			for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
+				r._code = MHD_HTTP_OK;
+				json_object_array_add(json_data, api_json_channel(*mapping, **ch, q));
+			}
+		}
+	} else {
+		auto it = local_index.find(uuid);
+		if (it != local_index.end()) {
+			r._code = MHD_HTTP_OK;
+			for (LocalChannel &lc : it->second)
+				json_object_array_add(json_data, api_json_channel(*lc._mapping, *lc._ch, q));
+		}
+	}
+
+	json_object_object_add(json_obj, "version", json_object_new_string(VERSION));
+	json_object_object_add(json_obj, "generator", json_object_new_string(PACKAGE));
+	json_object_object_add(json_obj, "data", json_data);
+
+	if (json_exception) {
+		json_object_object_add(json_obj, "exception", json_exception);
+	}
+
+	r._body = json_object_to_json_string(json_obj);
+	json_object_put(json_obj);
+}
+
+#ifdef HAVE_ZLIB
+// gzip (not just deflate) as Content-Encoding: gzip needs the gzip header
+static std::string gzip(const std::string &in) {
+	std::string toRet;
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return toRet;
+	toRet.resize(deflateBound(&zs, in.length()));
+	zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+	zs.avail_in = in.length();
+	zs.next_out = reinterpret_cast<Bytef *>(&toRet[0]);
+	zs.avail_out = toRet.length();
+	if (deflate(&zs, Z_FINISH) == Z_STREAM_END)
+		toRet.resize(zs.total_out);
+	else
+		toRet.clear();
+	deflateEnd(&zs);
+	return toRet;
+}
+#endif
+
+// the response for a request without query parameters. Rendered (and compressed) on the
+// first request after the data changed, later requests only take a reference.
+static std::shared_ptr<const LocalResponse> cached_response(MapContainer *mappings, const char *url,
+															 bool show_all) {
+	const uint64_t version =
+		show_all ? localbuffer_version.load() : localbuffer.find(url + 1)->second->version();
+	{
+		std::lock_guard<std::mutex> lock(responses_mutex);
+		auto it = responses.find(url);
+		if (it != responses.end() && it->second->_version == version)
+			return it->second;
+	}
+
+	// rendered without the lock. Racing requests might render the same version twice.
+	std::shared_ptr<LocalResponse> r(new LocalResponse());
+	api_json_render(mappings, url, show_all, LocalQuery(), *r);
+	r->_version = version;
+	char etag[48];
+	snprintf(etag, sizeof(etag), "\"%lx-%llx\"", (unsigned long)local_epoch,
+			 (unsigned long long)version);
+	r->_etag = etag;
+#ifdef HAVE_ZLIB
+	if (r->_body.length() > 256) // smaller ones fit in one packet anyway
+		r->_gzip = gzip(r->_body);
+#endif
+
+	std::lock_guard<std::mutex> lock(responses_mutex);
+	std::shared_ptr<const LocalResponse> &cached = responses[url];
+	if (!cached || cached->_version < version)
+		cached = r;
+	return r;
+}
+
+// body of a response taken from a (shared) LocalResponse without copying it
+class LocalBody {
+  public:
+	LocalBody(std::shared_ptr<const LocalResponse> r, const std::string &data)
+		: _r(r), _data(data) {};
+	std::shared_ptr<const LocalResponse> _r; // keeps _data alive
+	const std::string &_data;
+};
+
+static ssize_t body_read(void *cls, uint64_t pos, char *buf, size_t max) {
+	const LocalBody *b = static_cast<const LocalBody *>(cls);
+	if (pos >= b->_data.length())
+		return MHD_CONTENT_READER_END_OF_STREAM;
+	size_t len = std::min(max, static_cast<size_t>(b->_data.length() - pos));
+	memcpy(buf, b->_data.data() + pos, len);
+	return len;
+}
+
+static void body_free(void *cls) { delete static_cast<LocalBody *>(cls); }
+
+// write a vz_columns_frame header and the uuid, returns the start of the time column
+static char *columns_frame(char *p, const std::string &uuid, size_t count) {
+	struct vz_columns_frame f;
+	f.magic = htole32(VZ_COLUMNS_MAGIC);
+	f.version = htole16(VZ_COLUMNS_VERSION);
+	f.uuid_len = htole16(uuid.length());
+	f.count = htole64(count);
+	memcpy(p, &f, sizeof(f));
+	p += sizeof(f);
+	memset(p, 0, vz_columns_uuid_size(uuid.length()));
+	memcpy(p, uuid.data(), uuid.length());
+	return p + vz_columns_uuid_size(uuid.length());
+}
+
+// ?format=binary, see vzlogger_columns.h. Without downsampling the columns are written from
+// the rings straight into the response buffer.
+static struct MHD_Response *api_columns(const char *uuid, bool show_all, const LocalQuery &q) {
+	std::vector<std::pair<const std::string *, const LocalBuffer *>> channels;
+	for (auto &it : localbuffer)
+		if (show_all || it.first == uuid)
+			channels.push_back(std::make_pair(&it.first, it.second.get()));
+
+	std::vector<std::vector<ChannelData>> reduced(q._points > 0 ? channels.size() : 0);
+	std::vector<size_t> counts(channels.size());
+	size_t size = 0;
+	for (size_t i = 0; i < channels.size(); i++) {
+		counts[i] = q._points > 0 ? local_range(*channels[i].second, q, reduced[i])
+								  : channels[i].second->count(local_from(q), q._to, q._limit);
+		size += vz_columns_frame_size(channels[i].first->length(), counts[i]);
+	}
+
+	char *buf = static_cast<char *>(malloc(size > 0 ? size : 1));
+	if (!buf)
+		throw vz::VZException("out of memory");
+	char *p = buf;
+	for (size_t i = 0; i < channels.size(); i++) {
+		const std::string &id = *channels[i].first;
+		size_t n = counts[i];
+		char *t = columns_frame(p, id, n);
+		if (q._points > 0) {
+			char *v = t + 8 * n;
+			for (const ChannelData &d : reduced[i]) {
+				uint64_t u = htole64(static_cast<uint64_t>(d._t));
+				memcpy(t, &u, 8);
+				memcpy(&u, &d._v, 8);
+				u = htole64(u);
+				memcpy(v, &u, 8);
+				t += 8;
+				v += 8;
+			}
+		} else {
+			// tuples might have expired since count(), the frame gets shorter then
+			n = channels[i].second->columns(local_from(q), q._to, q._limit, t, n);
+			if (n != counts[i])
+				columns_frame(p, id, n);
+		}
+		p += vz_columns_frame_size(id.length(), n);
+	}
+
+	return MHD_create_response_from_buffer(p - buf, buf, MHD_RESPMEM_MUST_FREE);
+}
+
+// does the comma separated header value contain token?
+static bool header_contains(const char *value, const char *token) {
+	if (!value)
+		return false;
+	const size_t len = strlen(token);
+	for (const char *p = strstr(value, token); p; p = strstr(p + 1, token)) {
+		const bool start = p == value || p[-1] == ' ' || p[-1] == ',';
+		const bool end = p[len] == 0 || p[len] == ',' || p[len] == ';' || p[len] == ' ';
+		if (start && end)
+			return true;
+	}
+	return false;
+}
+
+// parse ?from=&to=&limit=&points=&method=. Negative times are relative to now, e.g.
+// from=-300000 for the last 5 minutes. Invalid values are ignored.
+static LocalQuery local_query(struct MHD_Connection *connection) {
+	LocalQuery q;
+	Reading rnow;
+	rnow.time(); // sets to "now"
+	const char *names[] = {"from", "to", "limit", "points"};
+	int64_t *times[] = {&q._from, &q._to, NULL, NULL};
+	size_t *counts[] = {NULL, NULL, &q._limit, &q._points};
+	for (int i = 0; i < 4; i++) {
+		const char *str = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, names[i]);
+		if (!str || !*str)
+			continue;
+		char *end;
+		const long long v = strtoll(str, &end, 10);
+		if (*end) {
+			print(log_debug, "ignoring invalid %s=%s", "http", names[i], str);
+		} else if (times[i]) {
+			*times[i] = v < 0 ? rnow.time_ms() + v : v;
+		} else if (v > 0) {
+			*counts[i] = v;
+		}
+	}
+
+	const char *method = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "method");
+	if (method) {
+		if (strcmp(method, "lttb") == 0)
+			q._method = DOWNSAMPLE_LTTB;
+		else if (strcmp(method, "minmax") == 0)
+			q._method = DOWNSAMPLE_MINMAX;
+		else if (strcmp(method, "avg") == 0)
+			q._method = DOWNSAMPLE_AVG;
+		else
+			print(log_debug, "ignoring invalid method=%s", "http", method);
+	}
+	return q;
+}
+
 MHD_RESULT handle_request(void *cls, struct MHD_Connection *connection, const char *url,
 						  const char *method, const char *version, const char *upload_data,
 						  size_t *upload_data_size, void **con_cls) {
@@ -141,91 +809,117 @@ MHD_RESULT handle_request(void *cls, struct MHD_Connection *connection, const ch
 		print(log_info, "Local request received: method=%s url=%s mode=%s", "http", method, url,
 			  mode);
 
-		if (strcmp(method, "GET") == 0) {
+		if (strcmp(method, "GET") == 0 && strcmp(url, "/metrics") == 0) {
+			// prometheus text format from the last snapshot. Doesn't touch the localbuffer.
+			std::shared_ptr<const std::string> snapshot = std::atomic_load(&metrics_snapshot);
+			const std::string empty;
+			const std::string &body = snapshot ? *snapshot : empty;
 
-			struct json_object *json_obj = json_object_new_object();
-			struct json_object *json_data = json_object_new_array();
-			struct json_object *json_exception = NULL;
+			response = MHD_create_response_from_buffer(
+				body.length(), static_cast<void *>(const_cast<char *>(body.data())),
+				MHD_RESPMEM_MUST_COPY);
+			response_code = MHD_HTTP_OK;
 
+			MHD_add_response_header(response, "Content-type", "text/plain; version=0.0.4");
+		} else if (strcmp(method, "GET") == 0) {
 			const char *uuid = url + 1; // strip leading slash
-			const char *json_str;
-			bool show_all = false;
-
-			if (strcmp(url, "/") == 0) {
-				if (options.channel_index()) {
-					show_all = true;
-				} else {
-					json_exception = json_object_new_object();
-
-					json_object_object_add(json_exception, "message",
-										   json_object_new_string("channel index is disabled"));
-					json_object_object_add(json_exception, "code", json_object_new_int(0));
-				}
-			}
-
-			shrink_localbuffer(); // in case the channel return very few/seldom data
-
-			for (MapContainer::iterator mapping = mappings->begin(); mapping != mappings->end();
-				 mapping++) {
-				for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
-					if (strcmp((*ch)->uuid(), uuid) == 0 || show_all) {
-						response_code = MHD_HTTP_OK;
-
-						// blocking until new data arrives (comet-like blocking of HTTP response)
-						if (mode && strcmp(mode, "comet") == 0) {
-							// TODO wait only options.comet_timeout()!
-							// gettimeofday(&tp, NULL);
-							// ts.tv_sec = tp.tv_sec + options.comet_timeout();
-							// ts.tv_nsec = tp.tv_usec * 1000;
-
-							// (*ch)->wait(); // TODO not usefull with
-							// 			   // show_all! Wait only if this channel empty?
-						}
-
-						struct json_object *json_ch = json_object_new_object();
-
-						json_object_object_add(json_ch, "uuid",
-											   json_object_new_string((*ch)->uuid()));
-						// Add OBIS identifier from config (e.g. "1-0:1.8.0")
-						try {
-							const std::string obis_str = (*ch)->identifier()->toString();
-							json_object_object_add(json_ch, "obis",
-												   json_object_new_string(obis_str.c_str()));
-						} catch (std::exception &e) {
-							// identifier not set or not convertible — skip silently
+			const bool show_all = strcmp(url, "/") == 0 && options.channel_index();
+			const bool found = show_all || local_index.find(uuid) != local_index.end();
+			const char *accept = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Accept");
+			const bool sse = (mode && strcmp(mode, "sse") == 0) ||
+							 (accept && strstr(accept, "text/event-stream"));
+			const LocalQuery q = local_query(connection);
+
+			if (found && sse) {
+				// stream the current tuples first, then the new ones as they are added
+				LocalWaiter *w = new LocalWaiter(connection, show_all ? "" : uuid, true);
+				for (MapContainer::iterator mapping = mappings->begin();
+					 mapping != mappings->end(); mapping++) {
+					for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
+						if (show_all || strcmp((*ch)->uuid(), uuid) == 0) {
+							struct json_object *json_ch = api_json_channel(*mapping, **ch, q);
+							sse_append(w->_events, json_ch);
+							json_object_put(json_ch);
 						}
-						json_object_object_add(
-							json_ch, "last",
-							json_object_new_int64((*ch)->time_ms())); // return here in ms as well
-						json_object_object_add(json_ch, "interval",
-											   json_object_new_int(mapping->meter()->interval()));
-						json_object_object_add(
-							json_ch, "protocol",
-							json_object_new_string(
-								meter_get_details(mapping->meter()->protocolId())->name));
-
-						struct json_object *json_tuples = api_json_tuples((*ch)->uuid());
-						if (json_tuples)
-							json_object_object_add(json_ch, "tuples", json_tuples);
-
-						json_object_array_add(json_data, json_ch);
 					}
 				}
+				{
+					std::lock_guard<std::mutex> lock(waiters_mutex);
+					w->_deadline = time(NULL) + SSE_KEEPALIVE;
+					if (waiters_stop) {
+						w->_closed = true;
+					} else {
+						waiters.push_back(w);
+						waiters_count++;
+					}
+				}
+
+				response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 4096, &sse_read, w,
+															 &sse_free);
+				MHD_add_response_header(response, "Content-type", "text/event-stream");
+				MHD_add_response_header(response, "Cache-Control", "no-cache");
+				status = MHD_queue_response(connection, MHD_HTTP_OK, response);
+				MHD_destroy_response(response);
+				return status;
 			}
 
-			json_object_object_add(json_obj, "version", json_object_new_string(VERSION));
-			json_object_object_add(json_obj, "generator", json_object_new_string(PACKAGE));
-			json_object_object_add(json_obj, "data", json_data);
+			if (found && mode && strcmp(mode, "comet") == 0 && options.comet_timeout() > 0 &&
+				*con_cls == NULL) {
+				// answered after new tuples arrived or comet_timeout
+				LocalWaiter *w = new LocalWaiter(connection, show_all ? "" : uuid, false);
+				*con_cls = w; // deleted by request_completed
+				if (comet_wait(w))
+					return MHD_YES; // called again once resumed
+			}
 
-			if (json_exception) {
-				json_object_object_add(json_obj, "exception", json_exception);
+			const char *format =
+				MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "format");
+			if (found && format && strcmp(format, "binary") == 0) {
+				response = api_columns(uuid, show_all, q);
+				MHD_add_response_header(response, "Content-type", "application/octet-stream");
+				status = MHD_queue_response(connection, MHD_HTTP_OK, response);
+				MHD_destroy_response(response);
+				return status;
 			}
 
-			json_str = json_object_to_json_string(json_obj);
-			response = MHD_create_response_from_buffer(
-				strlen(json_str), static_cast<void *>(const_cast<char *>(json_str)),
-				MHD_RESPMEM_MUST_COPY);
-			json_object_put(json_obj);
+			std::shared_ptr<const LocalResponse> r;
+			if (found && q.all()) {
+				r = cached_response(mappings, url, show_all);
+			} else {
+				std::shared_ptr<LocalResponse> uncached(new LocalResponse());
+				api_json_render(mappings, url, show_all, q, *uncached);
+				r = uncached;
+			}
+			response_code = r->_code;
+
+			const bool gz =
+				!r->_gzip.empty() &&
+				header_contains(MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+															"Accept-Encoding"),
+								"gzip");
+			std::string etag = r->_etag;
+			if (!etag.empty() && gz)
+				etag.insert(etag.length() - 1, "-gz"); // each encoding has its own strong ETag
+			const char *none_match =
+				MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "If-None-Match");
+
+			if (!etag.empty() && none_match &&
+				(strcmp(none_match, "*") == 0 || header_contains(none_match, etag.c_str()))) {
+				response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+				response_code = MHD_HTTP_NOT_MODIFIED;
+			} else {
+				const std::string &body = gz ? r->_gzip : r->_body;
+				response = MHD_create_response_from_callback(
+					body.length(), 16 * 1024, &body_read, new LocalBody(r, body), &body_free);
+				if (gz)
+					MHD_add_response_header(response, "Content-Encoding", "gzip");
+			}
+			if (!etag.empty()) {
+				MHD_add_response_header(response, "ETag", etag.c_str());
+				MHD_add_response_header(response, "Cache-Control", "no-cache"); // revalidate
+			}
+			if (!r->_gzip.empty())
+				MHD_add_response_header(response, "Vary", "Accept-Encoding");
 
 			MHD_add_response_header(response, "Content-type", "application/json");
 		} else {
@@ -4,9 +4,15 @@
  * */
 
 #include "mqtt.hpp"
+#include "Cbor.hpp"
 #include "common.h"
 #include "mosquitto.h"
+#if LIBMOSQUITTO_VERSION_NUMBER >= 1006000
+#include "mqtt_protocol.h"
+#endif
 #include <cassert>
+#include <cfloat>
+#include <cstring>
 #include <sstream>
 #include <unistd.h>
 
@@ -16,6 +22,7 @@ volatile bool endMqttClientThread = false;
 
 // class impl.
 MqttClient::MqttClient(struct json_object *option) : _enabled(false) {
+	bool batchRetainSet = false;
 
 	print(log_finest, "MqttClient::MqttClient called", "mqtt");
 	if (option) {
@@ -63,6 +70,63 @@ MqttClient::MqttClient(struct json_object *option) : _enabled(false) {
 				_timestamp = json_object_get_boolean(local_value);
 			} else if (strcmp(key, "id") == 0 && local_type == json_type_string) {
 				_id = json_object_get_string(local_value);
+			} else if (strcmp(key, "encoding") == 0 && local_type == json_type_string) {
+				std::string encoding = json_object_get_string(local_value);
+				if (encoding == "cbor")
+					_cbor = true;
+				else if (encoding == "json")
+					_cbor = false;
+				else
+					print(log_alert, "Ignoring invalid encoding %s (json or cbor)", "mqtt",
+						  encoding.c_str());
+			} else if (strcmp(key, "float32") == 0 && local_type == json_type_boolean) {
+				_float32 = json_object_get_boolean(local_value);
+			} else if (strcmp(key, "batch") == 0 && local_type == json_type_boolean) {
+				_batch = json_object_get_boolean(local_value);
+			} else if (strcmp(key, "batchTopic") == 0 && local_type == json_type_string) {
+				_batchTopic = json_object_get_string(local_value);
+			} else if (strcmp(key, "batchRetain") == 0 && local_type == json_type_boolean) {
+				_batchRetain = json_object_get_boolean(local_value);
+				batchRetainSet = true;
+			} else if (strcmp(key, "protocolVersion") == 0 && local_type == json_type_int) {
+				int version = json_object_get_int(local_value);
+				if (version == 5 || version == 311)
+					_v5 = version == 5;
+				else
+					print(log_alert, "Ignoring invalid protocolVersion %d (311 or 5)", "mqtt",
+						  version);
+			} else if (strcmp(key, "messageExpiry") == 0 && local_type == json_type_int) {
+				_messageExpiry = json_object_get_int(local_value);
+				if (_messageExpiry < 0)
+					_messageExpiry = 0;
+			} else if (strcmp(key, "topicAlias") == 0 && local_type == json_type_boolean) {
+				_topicAlias = json_object_get_boolean(local_value);
+			} else if (strcmp(key, "userProperties") == 0 && local_type == json_type_boolean) {
+				_userProperties = json_object_get_boolean(local_value);
+			} else if (strcmp(key, "queueSize") == 0 && local_type == json_type_int) {
+				int size = json_object_get_int(local_value);
+				if (size > 0)
+					_queueSize = size;
+				else
+					print(log_alert, "Ignoring invalid queueSize %d", "mqtt", size);
+			} else if (strcmp(key, "queuePolicy") == 0 && local_type == json_type_string) {
+				std::string policy = json_object_get_string(local_value);
+				if (policy == "oldest")
+					_queuePolicy = QueuePolicy::DropOldest;
+				else if (policy == "newest")
+					_queuePolicy = QueuePolicy::DropNewest;
+				else if (policy == "lastPerTopic")
+					_queuePolicy = QueuePolicy::LastPerTopic;
+				else
+					print(log_alert,
+						  "Ignoring invalid queuePolicy %s (oldest, newest or lastPerTopic)",
+						  "mqtt", policy.c_str());
+			} else if (strcmp(key, "maxInflight") == 0 && local_type == json_type_int) {
+				int inflight = json_object_get_int(local_value);
+				if (inflight > 0)
+					_maxInflight = inflight;
+				else
+					print(log_alert, "Ignoring invalid maxInflight %d", "mqtt", inflight);
 			} else {
 				print(log_alert, "Ignoring invalid field or type: %s=%s", NULL, key,
 					  json_object_get_string(local_value));
@@ -78,6 +142,18 @@ MqttClient::MqttClient(struct json_object *option) : _enabled(false) {
 	else
 		_topic += '/';
 
+	if (!batchRetainSet)
+		_batchRetain = _retain;
+
+#if LIBMOSQUITTO_VERSION_NUMBER < 1006000
+	if (_v5) {
+		print(log_alert, "libmosquitto too old for MQTT v5, using 3.1.1", "mqtt");
+		_v5 = false;
+	}
+#endif
+	if (!_batchTopic.length())
+		_batchTopic = "%m";
+
 	// mosquitto lib init:
 	if (mosquitto_lib_init() != MOSQ_ERR_SUCCESS) {
 		print(log_alert, "libmosquitto init failed! Stopped.", "mqtt");
@@ -150,7 +226,11 @@ MqttClient::MqttClient(struct json_object *option) : _enabled(false) {
 				}
 			}
 
-			int protocol = MQTT_PROTOCOL_V311;
+#if LIBMOSQUITTO_VERSION_NUMBER >= 1006000
+			int protocol = _v5 ? MQTT_PROTOCOL_V5 : MQTT_PROTOCOL_V311;
+#else
+			int protocol = MQTT_PROTOCOL_V311; // no MQTT_PROTOCOL_V5, _v5 is false
+#endif
 			res = mosquitto_opts_set(_mcs, MOSQ_OPT_PROTOCOL_VERSION, &protocol);
 			if (res != MOSQ_ERR_SUCCESS) {
 				print(log_warning, "unable to set MQTT protocol version (error %d)", "mqtt", res);
@@ -167,6 +247,17 @@ MqttClient::MqttClient(struct json_object *option) : _enabled(false) {
 				_mcs, [](struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg) {
 					static_cast<MqttClient *>(obj)->message_callback(mosq, msg);
 				});
+			mosquitto_publish_callback_set(_mcs, [](struct mosquitto *mosq, void *obj, int mid) {
+				static_cast<MqttClient *>(obj)->publish_callback(mosq, mid);
+			});
+#if LIBMOSQUITTO_VERSION_NUMBER >= 1006000
+			if (_v5)
+				mosquitto_connect_v5_callback_set(
+					_mcs, [](struct mosquitto *mosq, void *obj, int res, int flags,
+							 const mosquitto_property *props) {
+						static_cast<MqttClient *>(obj)->connect_v5_callback(mosq, res, props);
+					});
+#endif
 
 			// now connect. we use sync interface with spe. thread calling mosquitto_loop
 			res = mosquitto_connect(_mcs, _host.c_str(), _port, _keepalive);
@@ -208,6 +299,7 @@ MqttClient::~MqttClient() {
 	if (_mcs) {
 		assert(!_enabled or endMqttClientThread);
 
+		drain(); // whatever fits into the inflight window
 		mosquitto_disconnect(_mcs);
 		// we call mosquitto_loop at least once here as the thread should be stopped already:
 		int res = mosquitto_loop(_mcs, 50, 1);
@@ -216,14 +308,15 @@ MqttClient::~MqttClient() {
 		}
 		mosquitto_destroy(_mcs);
 	}
-	mosquitto_lib_cleanup(); // this assumes nobody else is using libmosquitto!
+	mosquitto_lib_cleanup(); // mqtt meters are closed already. nobody else uses libmosquitto
 }
 
 void MqttClient::ChannelEntry::generateNames(const std::string &prefix, Channel &ch) {
 	_announceValues.clear();
-	_fullTopicRaw = prefix;
 	// Use configured mqtt_topic if set, otherwise fall back to ch.name()
-	_fullTopicRaw += (!ch.mqttTopic().empty()) ? ch.mqttTopic() : ch.name();
+	_name = (!ch.mqttTopic().empty()) ? ch.mqttTopic() : ch.name();
+	_fullTopicRaw = prefix;
+	_fullTopicRaw += _name;
 	_fullTopicRaw += '/';
 	if (ch.identifier()) {
 		char unparseBuf[200];
@@ -246,6 +339,64 @@ void MqttClient::ChannelEntry::generateNames(const std::string &prefix, Channel
 		_announceValues.emplace_back("uuid", uuid);
 }
 
+void MqttClient::setupEntry(ChannelEntry &entry, Channel &ch) {
+	entry.generateNames(_topic, ch);
+	if (entry._sendAgg && !_rawAndAgg)
+		entry._sendRaw = false;
+}
+
+void MqttClient::init(const std::vector<Channel::Ptr> &channels) {
+	for (auto &ch : channels) {
+		if (!ch || ch->index() < 0)
+			continue;
+		size_t idx = ch->index();
+		if (idx >= _slots.size())
+			_slots.resize(idx + 1);
+		_slots[idx].reset(new ChannelEntry());
+		setupEntry(*_slots[idx], *ch);
+	}
+	print(log_finest, "init: %zu channels", "mqtt", channels.size());
+}
+
+MqttClient::ChannelEntry &MqttClient::channelEntry(Channel &ch) {
+	auto it = _chMap.find(ch.name());
+	if (it == _chMap.end()) {
+		std::unique_ptr<ChannelEntry> entry(new ChannelEntry());
+		setupEntry(*entry, ch);
+		it = _chMap.emplace(ch.name(), std::move(entry)).first;
+	}
+	return *(*it).second;
+}
+
+void MqttClient::announce(ChannelEntry &entry) {
+	// do we need to announce the uuid?
+	if (entry._announced.load(std::memory_order_relaxed) || !entry._announceValues.size())
+		return;
+	if (_v5 && _userProperties) { // sent with each message instead
+		entry._announced = true;
+		return;
+	}
+	for (auto &v : entry._announceValues) {
+		enqueue(entry._announceName + v.first, v.second.c_str(), v.second.length(), _retain);
+	}
+	entry._announced = true;
+}
+
+// same output as json-c for doubles
+static int format_json_double(char *buf, size_t size, double v) {
+	if (v != v)
+		return snprintf(buf, size, "NaN");
+	if (v > DBL_MAX || v < -DBL_MAX)
+		return snprintf(buf, size, v > 0 ? "Infinity" : "-Infinity");
+	int len = snprintf(buf, size, "%.17g", v);
+	if (len > 0 && (size_t)len + 2 < size && !strpbrk(buf, ".eE")) {
+		buf[len++] = '.';
+		buf[len++] = '0';
+		buf[len] = 0;
+	}
+	return len;
+}
+
 void MqttClient::publish(Channel::Ptr ch, Reading &rds, bool aggregate) {
 	// take care: this function must be thread safe and non-blocking!
 	// for now we do only call this from read_thread and our mqtt_client thread doesn't harm here
@@ -256,61 +407,256 @@ void MqttClient::publish(Channel::Ptr ch, Reading &rds, bool aggregate) {
 	if (!_mcs)
 		return;
 
-	// search for cached values:
-	std::unique_lock<std::mutex> lock(_chMapMutex);
-	auto it = _chMap.find(ch->name());
-	if (it == _chMap.end()) {
-		ChannelEntry entry;
-		entry.generateNames(_topic, (*ch));
-		if (entry._sendAgg && !_rawAndAgg)
-			entry._sendRaw = false;
+	// precomputed entry (lock free) or cached values:
+	ChannelEntry *entry = slot(*ch);
+	if (!entry) {
+		std::lock_guard<std::mutex> lock(_chMapMutex);
+		entry = &channelEntry(*ch); // entries are never removed
+	}
+	announce(*entry);
+
+	if (!((entry->_sendAgg and aggregate) or (entry->_sendRaw && !aggregate)))
+		return;
+	const std::string &topic = aggregate ? entry->_fullTopicAgg : entry->_fullTopicRaw;
 
-		it = _chMap.emplace(std::make_pair(ch->name(), entry)).first;
+	char buf[128];
+	const char *payload = buf;
+	int len;
+	std::string str; // cbor or values too large for buf
+
+	if (_cbor) {
+		CborWriter cbor(str, _float32);
+		if (_timestamp) {
+			cbor.map(2);
+			cbor.string("timestamp");
+			cbor.integer(rds.time_ms());
+			cbor.string("value");
+		}
+		cbor.number(rds.value());
+		payload = str.data();
+		len = str.size();
+		print(log_finest, "publish %s (%d bytes cbor)", "mqtt", topic.c_str(), len);
+	} else {
+		if (_timestamp) {
+			char value[40];
+			format_json_double(value, sizeof(value), rds.value());
+			len = snprintf(buf, sizeof(buf), "{ \"timestamp\": %lld, \"value\": %s }",
+						   (long long)rds.time_ms(), value);
+		} else {
+			len = snprintf(buf, sizeof(buf), "%f", rds.value()); // as std::to_string
+		}
+		if (len < 0 || (size_t)len >= sizeof(buf)) { // %f of huge values, the json one always fits
+			str = std::to_string(rds.value());
+			payload = str.c_str();
+			len = str.size();
+		}
+		print(log_finest, "publish %s=%s", "mqtt", topic.c_str(), payload);
 	}
 
-	assert(it != _chMap.end());
-	ChannelEntry &entry = (*it).second;
-	// do we need to announce the uuid?
-	if (!entry._announced && entry._announceValues.size()) {
-		for (auto &v : entry._announceValues) {
-			std::string name = entry._announceName + v.first;
-			int res = mosquitto_publish(_mcs, 0, name.c_str(), v.second.length(), v.second.c_str(),
-										_qos, _retain);
-			if (res != MOSQ_ERR_SUCCESS) {
-				print(log_finest, "mosquitto_publish announce \"%s\" failed: %s", "mqtt",
-					  name.c_str(), mosquitto_strerror(res));
-			} else {
-				entry._announced = true; // if one can be announced we treat it successfull
-			}
+	enqueue(topic, payload, len, _retain, !aggregate, entry);
+}
+
+void MqttClient::publish(const char *meterName, const Batch &batch, bool aggregate) {
+	if (!_mcs || !meterName || batch.empty())
+		return;
+
+	// group the values by channel in order of their first appearance:
+	typedef std::vector<std::pair<int64_t, double>> Tuples;
+	std::vector<std::pair<std::string, Tuples>> values;
+	std::unordered_map<std::string, size_t> index;
+	for (auto &b : batch) {
+		if (!b._ch)
+			continue;
+		ChannelEntry *entry = slot(*b._ch);
+		if (!entry) {
+			std::lock_guard<std::mutex> lock(_chMapMutex);
+			entry = &channelEntry(*b._ch);
+		}
+		announce(*entry);
+		if ((entry->_sendAgg and aggregate) or (entry->_sendRaw && !aggregate)) {
+			auto ins = index.emplace(entry->_name, values.size());
+			if (ins.second)
+				values.push_back(std::make_pair(entry->_name, Tuples()));
+			values[ins.first->second].second.push_back(std::make_pair(b._time_ms, b._value));
 		}
 	}
 
-	std::string &topic = aggregate ? entry._fullTopicAgg : entry._fullTopicRaw;
-	if ((entry._sendAgg and aggregate) or (entry._sendRaw && !aggregate)) {
-		lock.unlock(); // we can unlock here already
-		std::string payload;
-		struct json_object *payload_obj = NULL;
+	if (values.empty())
+		return;
 
-		if (_timestamp) {
-			payload_obj = json_object_new_object();
-			json_object_object_add(payload_obj, "timestamp", json_object_new_int64(rds.time_ms()));
-			json_object_object_add(payload_obj, "value", json_object_new_double(rds.value()));
-			payload = json_object_to_json_string(payload_obj);
-		} else {
-			payload = std::to_string(rds.value());
+	std::string topic = _topic;
+	for (const char *c = _batchTopic.c_str(); *c; ++c) {
+		if (c[0] == '%' && c[1] == 'm') {
+			topic += meterName;
+			++c;
+		} else
+			topic += *c;
+	}
+	topic += aggregate ? "/agg" : "/raw";
+
+	std::string payload;
+	if (_cbor) {
+		// {"meter": <name>, "values": {"<channel>": {"t": [...], "v": [...]}, ...}}
+		CborWriter cbor(payload, _float32);
+		cbor.map(2);
+		cbor.string("meter");
+		cbor.string(meterName, strlen(meterName));
+		cbor.string("values");
+		cbor.map(values.size());
+		for (auto &v : values) {
+			cbor.string(v.first);
+			cbor.map(2);
+			cbor.tuples(v.second.begin(), v.second.end(), v.second.size());
 		}
+		print(log_finest, "publish batch %s (%zu bytes cbor)", "mqtt", topic.c_str(),
+			  payload.size());
+	} else {
+		// {"meter":"<name>","values":{"<channel>":[[<time_ms>,<value>],...],...}}
+		struct json_object *payload_obj = json_object_new_object();
+		struct json_object *jsv = json_object_new_object();
+		json_object_object_add(payload_obj, "meter", json_object_new_string(meterName));
+		json_object_object_add(payload_obj, "values", jsv);
+		for (auto &v : values) {
+			struct json_object *tuples = json_object_new_array();
+			for (auto &t : v.second) {
+				struct json_object *tuple = json_object_new_array();
+				json_object_array_add(tuple, json_object_new_int64(t.first));
+				json_object_array_add(tuple, json_object_new_double(t.second));
+				json_object_array_add(tuples, tuple);
+			}
+			json_object_object_add(jsv, v.first.c_str(), tuples);
+		}
+		payload = json_object_to_json_string_ext(payload_obj, JSON_C_TO_STRING_PLAIN);
+		json_object_put(payload_obj);
+		print(log_finest, "publish batch %s=%s", "mqtt", topic.c_str(), payload.c_str());
+	}
 
-		print(log_finest, "publish %s=%s", "mqtt", topic.c_str(), payload.c_str());
+	enqueue(topic, payload.data(), payload.size(), _batchRetain);
+}
 
-		int res = mosquitto_publish(_mcs, 0, topic.c_str(), payload.length(), payload.c_str(), _qos,
-									_retain);
-		if (res != MOSQ_ERR_SUCCESS) {
+void MqttClient::flush(const char *meterName, Batch &batch, bool aggregate) {
+	if (batch.empty())
+		return;
+	publish(meterName, batch, aggregate);
+	batch.clear();
+}
+
+void MqttClient::enqueue(const std::string &topic, const char *payload, size_t len, bool retain,
+						 bool raw, const ChannelEntry *entry) {
+	std::lock_guard<std::mutex> lock(_queueMutex);
+	if (_queuePolicy == QueuePolicy::LastPerTopic) {
+		auto it = _queuedTopics.find(topic);
+		if (it != _queuedTopics.end()) { // keeps the position of the older message
+			it->second->_payload.assign(payload, len);
+			it->second->_retain = retain;
+			it->second->_raw = raw;
+			it->second->_entry = entry;
+			_superseded++;
+			return;
+		}
+	}
+	if (_queue.size() >= _queueSize) {
+		_dropped++;
+		if (_queuePolicy == QueuePolicy::DropNewest)
+			return;
+		auto it = _queuedTopics.find(_queue.front()._topic);
+		if (it != _queuedTopics.end() && it->second == &_queue.front())
+			_queuedTopics.erase(it);
+		_queue.pop_front();
+	}
+	_queue.push_back(Message{topic, std::string(payload, len), retain, raw, entry});
+	if (_queuePolicy == QueuePolicy::LastPerTopic)
+		_queuedTopics[topic] = &_queue.back(); // references stay valid on push_back/pop_front
+	if (_queue.size() > _maxDepth)
+		_maxDepth = _queue.size();
+}
+
+void MqttClient::drain() {
+	if (!_isConnected)
+		return; // keep them queued, libmosquitto would buffer them without limit
+	std::unique_lock<std::mutex> lock(_queueMutex);
+	while (!_queue.empty() && _inflight < _maxInflight) {
+		Message m(std::move(_queue.front()));
+		auto it = _queuedTopics.find(m._topic);
+		if (it != _queuedTopics.end() && it->second == &_queue.front())
+			_queuedTopics.erase(it);
+		_queue.pop_front();
+		lock.unlock();
+
+		_inflight++; // confirmed by publish_callback, for QoS 0 once it's written
+		int res;
+#if LIBMOSQUITTO_VERSION_NUMBER >= 1006000
+		if (_v5) {
+			res = publish_v5(m);
+		} else
+#endif
+			res = mosquitto_publish(_mcs, 0, m._topic.c_str(), m._payload.size(),
+									m._payload.data(), _qos, m._retain);
+		lock.lock();
+		if (res == MOSQ_ERR_SUCCESS) {
+			_sent++;
+		} else {
+			_inflight--;
 			print(log_finest, "mosquitto_publish failed: %s", "mqtt", mosquitto_strerror(res));
+			if (res == MOSQ_ERR_NO_CONN) { // retry after reconnect
+				if (_queuePolicy != QueuePolicy::LastPerTopic) {
+					_queue.push_front(std::move(m));
+				} else if (_queuedTopics.count(m._topic)) {
+					_superseded++; // a newer message for the topic was queued meanwhile
+				} else {
+					_queue.push_front(std::move(m));
+					_queuedTopics[_queue.front()._topic] = &_queue.front();
+				}
+				break;
+			}
 		}
-		if (payload_obj != NULL) {
-			json_object_put(payload_obj);
+	}
+}
+
+#if LIBMOSQUITTO_VERSION_NUMBER >= 1006000
+int MqttClient::publish_v5(const Message &m) {
+	mosquitto_property *props = NULL;
+	const char *topic = m._topic.c_str();
+
+	// the first message to a topic after connecting defines the alias, later ones only use it
+	if (_aliasMax) {
+		auto it = _aliases.find(m._topic);
+		if (it != _aliases.end()) {
+			topic = NULL;
+			mosquitto_property_add_int16(&props, MQTT_PROP_TOPIC_ALIAS, it->second);
+		} else if (_nextAlias <= _aliasMax) {
+			uint16_t alias = _nextAlias++;
+			_aliases[m._topic] = alias;
+			mosquitto_property_add_int16(&props, MQTT_PROP_TOPIC_ALIAS, alias);
 		}
 	}
+	if (m._raw && _messageExpiry > 0)
+		mosquitto_property_add_int32(&props, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, _messageExpiry);
+	if (m._entry && _userProperties) {
+		for (auto &v : m._entry->_announceValues)
+			mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, v.first.c_str(),
+											   v.second.c_str());
+	}
+
+	int res = mosquitto_publish_v5(_mcs, 0, topic, m._payload.size(), m._payload.data(), _qos,
+								   m._retain, props);
+	mosquitto_property_free_all(&props);
+	if (res != MOSQ_ERR_SUCCESS && topic)
+		_aliases.erase(m._topic); // the broker doesn't know the alias
+	return res;
+}
+#endif
+
+MqttClient::Stats MqttClient::stats() {
+	std::lock_guard<std::mutex> lock(_queueMutex);
+	Stats s;
+	s._depth = _queue.size();
+	s._maxDepth = _maxDepth;
+	s._inflight = _inflight;
+	s._sent = _sent;
+	s._dropped = _dropped;
+	s._superseded = _superseded;
+	return s;
 }
 
 void MqttClient::connect_callback(struct mosquitto *mosq, int result) {
@@ -325,9 +671,35 @@ void MqttClient::connect_callback(struct mosquitto *mosq, int result) {
 	}
 }
 
+void MqttClient::connect_v5_callback(struct mosquitto *mosq, int result, const void *props) {
+	// topic aliases are valid for one connection only
+	_aliases.clear();
+	_aliasMax = 0;
+	_nextAlias = 1;
+#if LIBMOSQUITTO_VERSION_NUMBER >= 1006000
+	uint16_t max = 0;
+	// QoS 1/2 messages are resent by libmosquitto after a reconnect, with the alias of the
+	// old connection. so aliases are used with QoS 0 only.
+	if (result == MOSQ_ERR_SUCCESS && _topicAlias && _qos == 0 &&
+		mosquitto_property_read_int16(static_cast<const mosquitto_property *>(props),
+									  MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &max, false))
+		_aliasMax = max;
+#endif
+	print(log_finest, "connect_v5_callback called, res=%d, topic alias max=%u", "mqtt", result,
+		  (unsigned)_aliasMax);
+}
+
 void MqttClient::disconnect_callback(struct mosquitto *mosq, int result) {
 	print(log_finest, "disconnect_callback called, res=%d", "mqtt", result);
 	_isConnected = false;
+	// QoS 0 messages not written yet are lost without a callback. QoS 1/2 ones are resent
+	// after the reconnect and might exceed the inflight limit once.
+	_inflight = 0;
+}
+
+void MqttClient::publish_callback(struct mosquitto *mosq, int mid) {
+	if (_inflight > 0)
+		_inflight--;
 }
 
 void MqttClient::message_callback(struct mosquitto *mosq, const struct mosquitto_message *msg) {
@@ -338,8 +710,20 @@ void *mqtt_client_thread(void *arg) {
 	print(log_debug, "Start mqtt_client_thread", "mqtt");
 
 	if (mqttClient) {
+		MqttClient::Stats last = mqttClient->stats();
+		time_t lastStats = time(NULL);
 		while (!endMqttClientThread) {
-			int res = mosquitto_loop(mqttClient->_mcs, 1000, 1);
+			mqttClient->drain();
+			// short timeout as publish() doesn't wake us up
+			int res = mosquitto_loop(mqttClient->_mcs, 100, 1);
+			if (time(NULL) - lastStats >= 60) {
+				MqttClient::Stats s = mqttClient->stats();
+				if (s._dropped != last._dropped)
+					print(log_warning, "queue full, dropped %lu messages (queued %zu, inflight %d)",
+						  "mqtt", s._dropped - last._dropped, s._depth, s._inflight);
+				last = s;
+				lastStats = time(NULL);
+			}
 			if (res != MOSQ_ERR_SUCCESS) {
 				print(log_warning, "mosquitto_loop failed (trying to reconnect): %s", "mqtt",
 					  mosquitto_strerror(res));
@@ -32,6 +32,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -56,7 +57,7 @@ MeterD0::MeterD0(std::list<Option> &options)
 	: Protocol("d0"), _host(""), _device(""), _auto_ack(false), _wait_sync_end(false),
 	  _read_timeout_s(10), _baudrate_change_delay_ms(0), _reaction_time_ms(200) // default to 200ms
 	  ,
-	  _dump_fd(0), _old_mode(NONE), _dump_pos(0) {
+	  _fd(-1), _rpos(0), _rlen(0), _dump_fd(0), _old_mode(NONE), _dump_pos(0) {
 	OptionList optlist;
 
 	// connection
@@ -342,6 +343,8 @@ int MeterD0::open() {
 
 	if (_device.length() > 0) {
 		_fd = _openDevice(&_oldtio, _baudrate);
+		if (_pull.size() && !_bus)
+			_bus = SerialBus::get(_device);
 	} else if (_host.length() > 0) {
 		char *addr = strdup(host());
 		const char *node = strsep(&addr, ":");
@@ -349,6 +352,7 @@ int MeterD0::open() {
 
 		_fd = _openSocket(node, service);
 	}
+	_rpos = _rlen = 0;
 
 	return (_fd < 0) ? ERR : SUCCESS;
 }
@@ -362,7 +366,22 @@ int MeterD0::close() {
 	return ::close(_fd);
 }
 
+static void release_bus(void *bus) { static_cast<SerialBus *>(bus)->release(false); }
+
 ssize_t MeterD0::read(std::vector<Reading> &rds, size_t max_readings) {
+	if (!_bus)
+		return _read(rds, max_readings);
+
+	ssize_t res;
+	_bus->acquire(name());
+	pthread_cleanup_push(release_bus, _bus.get()); // cancelled or thrown while polling
+	res = _read(rds, max_readings);
+	pthread_cleanup_pop(0);
+	_bus->release();
+	return res;
+}
+
+ssize_t MeterD0::_read(std::vector<Reading> &rds, size_t max_readings) {
 
 	enum {
 		START,
@@ -424,11 +443,21 @@ ssize_t MeterD0::read(std::vector<Reading> &rds, size_t max_readings) {
 
 	baudrate_connect = _baudrate;
 	baudrate_read = _baudrate_read;
-	tcgetattr(_fd, &tio);
+	if (_device.length())
+		tio = _tio; // parity and timeouts might have been changed by another meter on the bus
+	else
+		tcgetattr(_fd, &tio);
 
 	if (_pull.size()) {
 		dump_file(CTRL, "TCIOFLUSH and cfsetiospeed");
-		tcflush(_fd, TCIOFLUSH);
+		_rpos = _rlen = 0; // whatever is left from the last read() is stale
+		if (tcflush(_fd, TCIOFLUSH) != 0) { // no tty: read and drop the pending input instead
+			ssize_t res;
+			while ((res = _fill(0)) > 0)
+				_rpos = _rlen = 0;
+			if (res < 0)
+				print(log_error, "error reading (%d)", name().c_str(), errno);
+		}
 		cfsetispeed(&tio, baudrate_connect);
 		cfsetospeed(&tio, baudrate_connect);
 		// apply new configuration
@@ -454,7 +483,7 @@ ssize_t MeterD0::read(std::vector<Reading> &rds, size_t max_readings) {
 		   (e.g. Hager EHZ361).
 		*/
 		int skipped = 0;
-		while (_wait_sync_end && ::read(_fd, &byte, 1)) {
+		while (_wait_sync_end && _readByte(byte, _read_timeout_s * 1000) > 0) {
 			dump_file(byte);
 			if (byte == '!') {
 				_wait_sync_end = false;
@@ -482,11 +511,9 @@ ssize_t MeterD0::read(std::vector<Reading> &rds, size_t max_readings) {
 			break;
 		}
 
-		// now read a single byte
-		bytes_read = ::read(_fd, &byte, 1);
-		if (bytes_read == 0 || (bytes_read == -1 && errno == EAGAIN)) {
-			// wait 5ms and read again
-			usleep(5000);
+		// now take a single byte, waiting at most a second to check for timeout/cancel
+		bytes_read = _readByte(byte, 1000);
+		if (bytes_read == 0) {
 			continue;
 		} else if (bytes_read == -1) {
 			print(log_error, "error reading a byte (%d)", name().c_str(), errno);
@@ -790,15 +817,13 @@ ssize_t MeterD0::read(std::vector<Reading> &rds, size_t max_readings) {
 						  name().c_str(), obis_code, value, unit);
 					rds[number_of_tuples].value(strtod(value, NULL));
 
-					try {
-						Obis obis(obis_code);
-						ReadingIdentifier *rid(new ObisIdentifier(obis));
-						rds[number_of_tuples].identifier(rid);
-						rds[number_of_tuples].time();
-						number_of_tuples++;
-					} catch (vz::VZException &e) {
-						print(log_alert, "Failed to parse obis code (%s)", name().c_str(),
-							  obis_code);
+					{
+						ReadingIdentifier::Ptr rid = _obisIdentifier(obis_code);
+						if (rid) {
+							rds[number_of_tuples].identifier(rid);
+							rds[number_of_tuples].time();
+							number_of_tuples++;
+						}
 					}
 					break;
 				case 'L': // nobreak; // L, P not supported yet
@@ -827,6 +852,59 @@ error:
 	return number_of_tuples; // return number of good readings so far.
 }
 
+#define D0_OBIS_CACHE_MAX 256 // more different codes are garbage, don't let the cache grow
+
+ReadingIdentifier::Ptr MeterD0::_obisIdentifier(const char *obis_code) {
+	const std::string key(obis_code); // fits the small string buffer, no allocation
+	auto it = _obisCache.find(key);
+	if (it != _obisCache.end())
+		return it->second;
+
+	ReadingIdentifier::Ptr rid;
+	try {
+		Obis obis(obis_code);
+		rid.reset(new ObisIdentifier(obis));
+	} catch (vz::VZException &e) {
+		print(log_alert, "Failed to parse obis code (%s)", name().c_str(), obis_code);
+	}
+	if (_obisCache.size() < D0_OBIS_CACHE_MAX)
+		_obisCache[key] = rid;
+	return rid;
+}
+
+ssize_t MeterD0::_fill(int timeout_ms) {
+	if (_rpos == _rlen)
+		_rpos = _rlen = 0;
+	else if (_rpos > 0) { // move the unparsed rest to the front
+		memmove(_rbuf, _rbuf + _rpos, _rlen - _rpos);
+		_rlen -= _rpos;
+		_rpos = 0;
+	}
+	if (_rlen == sizeof(_rbuf))
+		return 0; // full, parse first
+
+	struct pollfd pfd;
+	pfd.fd = _fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	int res;
+	CANCELLABLE(res = poll(&pfd, 1, timeout_ms));
+	if (res < 0)
+		return errno == EINTR ? 0 : -1;
+	if (res == 0)
+		return 0;
+
+	ssize_t len = ::read(_fd, _rbuf + _rlen, sizeof(_rbuf) - _rlen);
+	if (len < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	if (len == 0) { // readable but nothing to read: connection closed or hang up
+		errno = EPIPE;
+		return -1;
+	}
+	_rlen += len;
+	return len;
+}
+
 int MeterD0::_openSocket(const char *node, const char *service) {
 	struct sockaddr_in sin;
 	struct addrinfo *ais;
@@ -937,6 +1015,7 @@ int MeterD0::_openDevice(struct termios *old_tio, speed_t baudrate) {
 
 	// apply new configuration
 	tcsetattr(fd, TCSANOW, &tio);
+	_tio = tio;
 
 	return fd;
 }
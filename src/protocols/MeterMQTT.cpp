@@ -0,0 +1,404 @@
+/**
+ * Subscribe to topics on a MQTT broker
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2026, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <json-c/json.h>
+#include <mosquitto.h>
+
+#include "Options.hpp"
+#include "protocols/MeterMQTT.hpp"
+#include "threads.h"
+#include <VZException.hpp>
+
+MeterMQTT::MeterMQTT(std::list<Option> options)
+	: Protocol("mqtt"), _port(1883), _keepalive(30), _qos(0), _unmapped(true), _queueSize(10000),
+	  _mosq(0), _tok(0), _dropped(0) {
+	OptionList optlist;
+
+	try {
+		_host = optlist.lookup_string(options, "host");
+	} catch (vz::OptionNotFoundException &e) {
+		_host = "localhost";
+	} catch (vz::VZException &e) {
+		print(log_alert, "Invalid type for host", name().c_str());
+		throw;
+	}
+
+	try {
+		_port = optlist.lookup_int(options, "port");
+	} catch (vz::OptionNotFoundException &e) {
+		// keep default
+	} catch (vz::VZException &e) {
+		print(log_alert, "Invalid type for port", name().c_str());
+		throw;
+	}
+
+	// optional strings, empty if not set:
+	struct {
+		const char *key;
+		std::string *value;
+	} strings[] = {{"user", &_user},         {"pass", &_pass},       {"id", &_id},
+				   {"cafile", &_cafile},     {"capath", &_capath},   {"certfile", &_certfile},
+				   {"keyfile", &_keyfile},   {"timeField", &_timeField}};
+	for (auto &s : strings) {
+		try {
+			*s.value = optlist.lookup_string(options, s.key);
+		} catch (vz::OptionNotFoundException &e) {
+		} catch (vz::VZException &e) {
+			print(log_alert, "Invalid type for %s", name().c_str(), s.key);
+			throw;
+		}
+	}
+
+	try {
+		_keepalive = optlist.lookup_int(options, "keepalive");
+	} catch (vz::OptionNotFoundException &e) {
+	} catch (vz::VZException &e) {
+		print(log_alert, "Invalid type for keepalive", name().c_str());
+		throw;
+	}
+
+	try {
+		_qos = optlist.lookup_int(options, "qos");
+		if (_qos < 0 || _qos > 2)
+			throw vz::VZException("qos must be 0, 1 or 2");
+	} catch (vz::OptionNotFoundException &e) {
+	} catch (vz::VZException &e) {
+		print(log_alert, "Invalid qos", name().c_str());
+		throw;
+	}
+
+	try {
+		int size = optlist.lookup_int(options, "queueSize");
+		if (size > 0)
+			_queueSize = size;
+	} catch (vz::OptionNotFoundException &e) {
+	} catch (vz::VZException &e) {
+		print(log_alert, "Invalid type for queueSize", name().c_str());
+		throw;
+	}
+
+	try {
+		_unmapped = optlist.lookup_bool(options, "unmapped");
+	} catch (vz::OptionNotFoundException &e) {
+	} catch (vz::VZException &e) {
+		print(log_alert, "Invalid type for unmapped", name().c_str());
+		throw;
+	}
+
+	// "topic" is a single subscription or an array of them
+	try {
+		const Option &topic = optlist.lookup(options, "topic");
+		if (topic.type() == Option::type_string) {
+			_topics.push_back((const char *)topic);
+		} else if (topic.type() == Option::type_array) {
+			struct json_object *jso = topic;
+			for (size_t i = 0; i < json_object_array_length(jso); i++) {
+				struct json_object *jt = json_object_array_get_idx(jso, i);
+				if (json_object_get_type(jt) != json_type_string)
+					throw vz::VZException("topic entries must be strings");
+				_topics.push_back(json_object_get_string(jt));
+			}
+		} else
+			throw vz::InvalidTypeException("topic must be a string or an array of strings");
+		if (_topics.empty())
+			throw vz::VZException("no topic");
+	} catch (vz::VZException &e) {
+		print(log_alert, "Missing topic or invalid type", name().c_str());
+		throw;
+	}
+
+	try {
+		parse_map(optlist.lookup_json_object(options, "map"));
+	} catch (vz::OptionNotFoundException &e) {
+	} catch (vz::VZException &e) {
+		print(log_alert, "Failed to parse map", name().c_str());
+		throw;
+	}
+
+	_tok = json_tokener_new();
+}
+
+MeterMQTT::~MeterMQTT() {
+	close();
+	if (_tok)
+		json_tokener_free(_tok);
+}
+
+/**
+ * "map": {
+ *   "<topic>": "<identifier>",
+ *   "<topic>": {"<field>": "<identifier>", "<field>/<nested field>": "<identifier>", ...}
+ * }
+ */
+void MeterMQTT::parse_map(struct json_object *jso) {
+	if (!jso)
+		return;
+	json_object_object_foreach(jso, topic, value) {
+		Mapping &m = _map[topic];
+		if (json_object_get_type(value) == json_type_string) {
+			m.identifier = json_object_get_string(value);
+		} else if (json_object_get_type(value) == json_type_object) {
+			json_object_object_foreach(value, field, ident) {
+				if (json_object_get_type(ident) != json_type_string)
+					throw vz::InvalidTypeException("map field identifiers must be strings");
+				m.fields[field] = json_object_get_string(ident);
+			}
+		} else
+			throw vz::InvalidTypeException("map entries must be strings or objects");
+	}
+	print(log_debug, "%zu mapped topics", name().c_str(), _map.size());
+}
+
+int MeterMQTT::open() {
+	if (_mosq)
+		return SUCCESS;
+
+	mosquitto_lib_init();
+	_mosq = mosquitto_new(_id.length() ? _id.c_str() : NULL, true, this);
+	if (!_mosq) {
+		print(log_alert, "mosquitto_new failed", name().c_str());
+		return ERR;
+	}
+	if ((_user.length() || _pass.length()) &&
+		mosquitto_username_pw_set(_mosq, _user.c_str(), _pass.c_str()) != MOSQ_ERR_SUCCESS)
+		print(log_warning, "mosquitto_username_pw_set failed", name().c_str());
+	if (_cafile.length() || _capath.length()) {
+		int res = mosquitto_tls_set(_mosq, _cafile.length() ? _cafile.c_str() : NULL,
+									_capath.length() ? _capath.c_str() : NULL,
+									_certfile.length() ? _certfile.c_str() : NULL,
+									_keyfile.length() ? _keyfile.c_str() : NULL, NULL);
+		if (res != MOSQ_ERR_SUCCESS)
+			print(log_warning, "mosquitto_tls_set failed: %s", name().c_str(),
+				  mosquitto_strerror(res));
+	}
+	mosquitto_connect_callback_set(_mosq, [](struct mosquitto *, void *obj, int result) {
+		static_cast<MeterMQTT *>(obj)->connect_callback(result);
+	});
+	mosquitto_message_callback_set(
+		_mosq, [](struct mosquitto *, void *obj, const struct mosquitto_message *msg) {
+			static_cast<MeterMQTT *>(obj)->message_callback(msg);
+		});
+	mosquitto_reconnect_delay_set(_mosq, 1, 60, true);
+
+	// the network thread keeps reconnecting if the broker is not reachable yet
+	int res = mosquitto_connect_async(_mosq, _host.c_str(), _port, _keepalive);
+	if (res != MOSQ_ERR_SUCCESS)
+		print(log_warning, "connect to %s:%d failed: %s. Retrying.", name().c_str(),
+			  _host.c_str(), _port, mosquitto_strerror(res));
+	res = mosquitto_loop_start(_mosq);
+	if (res != MOSQ_ERR_SUCCESS) {
+		print(log_alert, "mosquitto_loop_start failed: %s", name().c_str(),
+			  mosquitto_strerror(res));
+		mosquitto_destroy(_mosq);
+		_mosq = 0;
+		return ERR;
+	}
+	return SUCCESS;
+}
+
+int MeterMQTT::close() {
+	if (!_mosq)
+		return SUCCESS;
+	mosquitto_disconnect(_mosq);
+	mosquitto_loop_stop(_mosq, false);
+	mosquitto_destroy(_mosq);
+	_mosq = 0;
+	return SUCCESS;
+}
+
+void MeterMQTT::connect_callback(int result) {
+	if (result != 0) {
+		print(log_warning, "connect to %s:%d failed: %s", name().c_str(), _host.c_str(), _port,
+			  mosquitto_connack_string(result));
+		return;
+	}
+	print(log_info, "connected to %s:%d", name().c_str(), _host.c_str(), _port);
+	// clean session, so subscribe again after each reconnect:
+	for (auto &t : _topics) {
+		int res = mosquitto_subscribe(_mosq, NULL, t.c_str(), _qos);
+		if (res != MOSQ_ERR_SUCCESS)
+			print(log_warning, "subscribe %s failed: %s", name().c_str(), t.c_str(),
+				  mosquitto_strerror(res));
+	}
+}
+
+void MeterMQTT::message_callback(const struct mosquitto_message *msg) {
+	if (msg && msg->topic && msg->payloadlen > 0)
+		handle(msg->topic, static_cast<const char *>(msg->payload), msg->payloadlen);
+}
+
+#define MQTT_IDENTIFIER_CACHE_MAX 1024 // wildcard topics might create new names without end
+
+ReadingIdentifier::Ptr MeterMQTT::intern(const std::string &identifier) {
+	auto it = _identifiers.find(identifier);
+	if (it != _identifiers.end())
+		return it->second;
+
+	ReadingIdentifier::Ptr rid(new StringIdentifier(identifier));
+	if (_identifiers.size() < MQTT_IDENTIFIER_CACHE_MAX)
+		_identifiers[identifier] = rid;
+	return rid;
+}
+
+int64_t MeterMQTT::json_time(struct json_object *jso, int64_t now_ms) const {
+	struct json_object *jt;
+	if (!_timeField.length() || !json_object_object_get_ex(jso, _timeField.c_str(), &jt))
+		return now_ms;
+	double t = json_object_get_double(jt);
+	if (t <= 0)
+		return now_ms;
+	return t > 1e11 ? (int64_t)t : (int64_t)(t * 1000); // ms or s since the epoch
+}
+
+void MeterMQTT::add_json(const Mapping *mapping, const std::string &base, std::string &path,
+						 struct json_object *jso, int64_t time_ms, std::vector<Sample> &out) {
+	json_object_object_foreach(jso, key, value) {
+		const size_t len = path.length();
+		if (len)
+			path += '/';
+		path += key;
+
+		json_type type = json_object_get_type(value);
+		if (type == json_type_object) {
+			add_json(mapping, base, path, value, time_ms, out);
+		} else if ((type == json_type_int || type == json_type_double ||
+					type == json_type_boolean) &&
+				   !(len == 0 && path == _timeField)) {
+			ReadingIdentifier::Ptr id;
+			if (mapping && mapping->fields.size()) {
+				auto it = mapping->fields.find(path);
+				if (it != mapping->fields.end())
+					id = intern(it->second);
+			} else
+				id = intern(base + '/' + path);
+			if (id)
+				out.push_back(Sample{id, json_object_get_double(value), time_ms});
+		}
+		path.resize(len);
+	}
+}
+
+size_t MeterMQTT::handle(const char *topic, const char *payload, size_t len) {
+	const Mapping *mapping = 0;
+	auto it = _map.find(topic);
+	if (it != _map.end())
+		mapping = &it->second;
+	else if (!_unmapped)
+		return 0;
+	const std::string base =
+		mapping && mapping->identifier.length() ? mapping->identifier : std::string(topic);
+
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	const int64_t now_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+	std::vector<Sample> samples;
+	size_t skip = 0;
+	while (skip < len && isspace((unsigned char)payload[skip]))
+		skip++;
+	if (skip < len && payload[skip] == '{') {
+		json_tokener_reset(_tok);
+		struct json_object *jso = json_tokener_parse_ex(_tok, payload, len);
+		if (!jso || json_object_get_type(jso) != json_type_object) {
+			print(log_debug, "ignoring invalid JSON on %s", name().c_str(), topic);
+			if (jso)
+				json_object_put(jso);
+			return 0;
+		}
+		std::string path;
+		add_json(mapping, base, path, jso, json_time(jso, now_ms), samples);
+		json_object_put(jso);
+	} else if (!mapping || !mapping->fields.size()) {
+		// plain number, payloads are not NUL terminated
+		char buf[64];
+		if (len >= sizeof(buf))
+			return 0;
+		memcpy(buf, payload, len);
+		buf[len] = '\0';
+		char *end;
+		double value = strtod(buf, &end);
+		while (*end && isspace((unsigned char)*end))
+			end++;
+		if (end == buf + skip || *end) {
+			print(log_debug, "ignoring non numeric payload on %s", name().c_str(), topic);
+			return 0;
+		}
+		samples.push_back(Sample{intern(base), value, now_ms});
+	}
+
+	if (samples.empty())
+		return 0;
+	bool logDrop = false;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto &s : samples) {
+			if (_queue.size() >= _queueSize) { // read() doesn't keep up, keep the newest values
+				_queue.pop_front();
+				logDrop = (_dropped++ % 1000) == 0;
+			}
+			_queue.push_back(s);
+		}
+	}
+	_cond.notify_one();
+	if (logDrop)
+		print(log_warning, "queue full, dropped %zu readings so far", name().c_str(), dropped());
+	return samples.size();
+}
+
+size_t MeterMQTT::dropped() const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _dropped;
+}
+
+ssize_t MeterMQTT::read(std::vector<Reading> &rds, size_t n) {
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (_queue.empty()) {
+		_cond.wait_for(lock, std::chrono::seconds(1));
+		if (_queue.empty()) {
+			lock.unlock();
+			_safe_to_cancel();
+			lock.lock();
+		}
+	}
+
+	size_t i = 0;
+	for (; i < n && !_queue.empty(); i++) {
+		const Sample &s = _queue.front();
+		rds[i].identifier(s.identifier);
+		rds[i].value(s.value);
+		struct timeval tv;
+		tv.tv_sec = s.time_ms / 1000;
+		tv.tv_usec = (s.time_ms % 1000) * 1000;
+		rds[i].time(tv);
+		_queue.pop_front();
+	}
+	return i;
+}
@@ -25,9 +25,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/gpio.h>
 #include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/time.h>
 #include <time.h>
@@ -39,19 +41,29 @@
 #include "protocols/MeterS0.hpp"
 #include <VZException.hpp>
 
+#define S0_EVENTS_MAX 64 // edge events read at once, also the kernel buffer of a line request
+
 MeterS0::MeterS0(std::list<Option> options, HWIF *hwif, HWIF *hwif_dir)
 	: Protocol("s0"), _hwif(hwif), _hwif_dir(hwif_dir), _counter_thread_stop(false),
 	  _send_zero(false), _debounce_delay_ms(0), _nonblocking_delay_ns(1e5), _first_impulse(true) {
 	OptionList optlist;
 
 	// check which HWIF to use:
+	// if "gpio" and "gpiochip" are given -> GPIO character device
 	// if "gpio" is given -> GPIO
 	// else (assuming "device") -> UART
 	bool use_gpio = false;
 	bool use_mmap = false;
 	std::string mmap;
+	std::string gpiochip;
 	int gpiopin = -1;
 
+	try {
+		gpiochip = optlist.lookup_string(options, "gpiochip");
+	} catch (vz::VZException &e) {
+		// ignore
+	}
+
 	if (!_hwif) {
 		try {
 			gpiopin = optlist.lookup_int(options, "gpio");
@@ -73,7 +85,10 @@ MeterS0::MeterS0(std::list<Option> options, HWIF *hwif, HWIF *hwif_dir)
 			} catch (vz::VZException &e) {
 				// ignore
 			}
-			if (use_mmap) {
+			if (!gpiochip.empty()) {
+				use_mmap = false;
+				_hwif = new HWIF_GPIOCDEV(gpiochip, gpiopin, options);
+			} else if (use_mmap) {
 				_hwif = new HWIF_MMAP(gpiopin, mmap);
 			} else
 				_hwif = new HWIF_GPIO(gpiopin, options);
@@ -93,7 +108,9 @@ MeterS0::MeterS0(std::list<Option> options, HWIF *hwif, HWIF *hwif_dir)
 			if (gpiodirpin == gpiopin) {
 				throw vz::VZException("gpio_dir must not be equal to gpio");
 			}
-			if (use_mmap) {
+			if (!gpiochip.empty()) {
+				_hwif_dir = new HWIF_GPIOCDEV(gpiochip, gpiodirpin, options, false);
+			} else if (use_mmap) {
 				_hwif_dir = new HWIF_MMAP(gpiodirpin, mmap);
 			} else
 				_hwif_dir = new HWIF_GPIO(gpiodirpin, options);
@@ -210,6 +227,12 @@ void MeterS0::counter_thread() {
 		  _hwif->is_blocking() ? "blocking" : "non blocking");
 
 	bool is_blocking = _hwif->is_blocking();
+	const bool has_timestamps = _hwif->has_timestamps();
+	// edges closer than debounce_delay are bounces if the hw does not filter them
+	const bool debounce = _debounce_delay_ms > 0 && !_hwif->is_debounced();
+	struct timespec last_impulse;
+	last_impulse.tv_sec = 0;
+	last_impulse.tv_nsec = 0;
 
 	{ // set thread priority to highest and SCHED_FIFO scheduling class
 		// ignore any errors
@@ -233,7 +256,37 @@ void MeterS0::counter_thread() {
 		(cur_state >= 0) ? cur_state : 0; // use current state if it is valid else assume low edge
 	const int nonblocking_delay_ns = _nonblocking_delay_ns;
 	while (!_counter_thread_stop) {
-		if (is_blocking) {
+		if (has_timestamps) {
+			// all impulses since the last call at once, with the time of the edge
+			struct timespec ts[S0_EVENTS_MAX];
+			int cnt = _hwif->waitForImpulses(ts, S0_EVENTS_MAX);
+			if (cnt < 0) {
+				print(log_warning, "Reading from hardwareinterface failed with %s.",
+					  name().c_str(), strerror(errno));
+				struct timespec ts1s = {1, 0}; // as long as a timeout
+				nanosleep(&ts1s, NULL);
+				continue;
+			}
+			unsigned int accepted = 0;
+			for (int i = 0; i < cnt; i++) {
+				if (debounce && last_impulse.tv_sec &&
+					timespec_sub_ms(ts[i], last_impulse) < (unsigned long)_debounce_delay_ms)
+					continue;
+				last_impulse = ts[i];
+				++accepted;
+			}
+			if (accepted) {
+				const struct timespec ref = _time_last_ref;
+				const bool after_ref =
+					last_impulse.tv_sec > ref.tv_sec ||
+					(last_impulse.tv_sec == ref.tv_sec && last_impulse.tv_nsec >= ref.tv_nsec);
+				_ms_last_impulse = after_ref ? timespec_sub_ms(last_impulse, ref) : 0;
+				if (_hwif_dir && (_hwif_dir->status() > 0))
+					_impulses_neg += accepted;
+				else
+					_impulses += accepted;
+			}
+		} else if (is_blocking) {
 			bool timeout = false;
 			if (_hwif->waitForImpulse(timeout)) {
 				// something has happened on the hardwareinterface (hwif)
@@ -752,3 +805,160 @@ bool MeterS0::HWIF_GPIO::waitForImpulse(bool &timeout) {
 	timeout = false;
 	return false;
 }
+
+MeterS0::HWIF_GPIOCDEV::HWIF_GPIOCDEV(const std::string &chip, int line,
+									 const std::list<Option> &options, bool edges)
+	: _chip(chip), _line(line), _edges(edges), _debounce_ms(30), _fd(-1), _debounced(false),
+	  _realtime(false) {
+	OptionList optlist;
+
+	if (_line < 0)
+		throw vz::VZException("invalid (<0) gpio(pin) set");
+
+	try {
+		_debounce_ms = optlist.lookup_int(options, "debounce_delay");
+	} catch (vz::VZException &e) {
+		// keep default, invalid values are reported by MeterS0
+	}
+}
+
+MeterS0::HWIF_GPIOCDEV::~HWIF_GPIOCDEV() {
+	if (_fd >= 0)
+		_close();
+}
+
+bool MeterS0::HWIF_GPIOCDEV::_open() {
+#ifdef GPIO_V2_GET_LINE_IOCTL
+	int chip = ::open(_chip.c_str(), O_RDONLY | O_CLOEXEC);
+	if (chip < 0) {
+		print(log_alert, "open(%s): %s", "S0", _chip.c_str(), strerror(errno));
+		return false;
+	}
+
+	// realtime timestamps need linux 5.11 and debouncing 5.10, retry without them
+	bool realtime = _edges;
+	bool debounce = _edges && _debounce_ms > 0;
+	struct gpio_v2_line_request req;
+	int res, err;
+	for (;;) {
+		memset(&req, 0, sizeof(req));
+		req.offsets[0] = _line;
+		req.num_lines = 1;
+		strncpy(req.consumer, "vzlogger", sizeof(req.consumer) - 1);
+		req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+		if (_edges) {
+			req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+			req.event_buffer_size = S0_EVENTS_MAX;
+		}
+		if (realtime)
+			req.config.flags |= GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME;
+		if (debounce) {
+			req.config.num_attrs = 1;
+			req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+			req.config.attrs[0].attr.debounce_period_us = _debounce_ms * 1000;
+			req.config.attrs[0].mask = 1; // our only line
+		}
+		res = ioctl(chip, GPIO_V2_GET_LINE_IOCTL, &req);
+		err = errno;
+		if (res == 0 || err != EINVAL)
+			break;
+		if (realtime)
+			realtime = false;
+		else if (debounce)
+			debounce = false;
+		else
+			break;
+	}
+	::close(chip); // the line request has its own fd
+
+	if (res < 0) {
+		print(log_alert, "request line %d of %s: %s", "S0", _line, _chip.c_str(), strerror(err));
+		return false;
+	}
+	_fd = req.fd;
+	_debounced = debounce;
+	_realtime = realtime;
+	if (_edges)
+		print(log_debug, "line %d of %s: %s debouncing, %s timestamps", "S0", _line,
+			  _chip.c_str(), debounce ? "kernel" : "software", realtime ? "realtime" : "monotonic");
+	return true;
+#else
+	print(log_alert, "built without GPIO character device support", "S0");
+	return false;
+#endif
+}
+
+bool MeterS0::HWIF_GPIOCDEV::_close() {
+	if (_fd < 0)
+		return false;
+
+	::close(_fd);
+	_fd = -1;
+
+	return true;
+}
+
+int MeterS0::HWIF_GPIOCDEV::status() {
+#ifdef GPIO_V2_GET_LINE_IOCTL
+	struct gpio_v2_line_values values;
+	if (_fd < 0)
+		return -1;
+	values.bits = 0;
+	values.mask = 1;
+	if (ioctl(_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+		return -2;
+	return (values.bits & 1) ? 1 : 0;
+#else
+	return -1;
+#endif
+}
+
+int MeterS0::HWIF_GPIOCDEV::waitForImpulses(struct timespec *ts, int max) {
+#ifdef GPIO_V2_GET_LINE_IOCTL
+	struct gpio_v2_line_event events[S0_EVENTS_MAX];
+	if (_fd < 0 || !_edges)
+		return -1;
+
+	struct pollfd poll_fd;
+	poll_fd.fd = _fd;
+	poll_fd.events = POLLIN;
+	poll_fd.revents = 0;
+
+	int rv = poll(&poll_fd, 1, 1000); // timeout set to 1s
+	if (rv == 0 || (rv < 0 && errno == EINTR))
+		return 0;
+	if (rv < 0)
+		return -1;
+
+	if (max > S0_EVENTS_MAX)
+		max = S0_EVENTS_MAX;
+	ssize_t len = ::read(_fd, events, max * sizeof(events[0]));
+	if (len < (ssize_t)sizeof(events[0]))
+		return -1;
+	const int cnt = len / sizeof(events[0]);
+
+	int64_t offset = 0; // from the event clock to CLOCK_REALTIME
+	if (!_realtime) {
+		struct timespec mono, real;
+		clock_gettime(CLOCK_MONOTONIC, &mono);
+		clock_gettime(CLOCK_REALTIME, &real);
+		offset = (int64_t)(real.tv_sec - mono.tv_sec) * 1000000000ll +
+				 (real.tv_nsec - mono.tv_nsec);
+	}
+	for (int i = 0; i < cnt; i++) {
+		const int64_t ns = (int64_t)events[i].timestamp_ns + offset;
+		ts[i].tv_sec = ns / 1000000000ll;
+		ts[i].tv_nsec = ns % 1000000000ll;
+	}
+	return cnt;
+#else
+	return -1;
+#endif
+}
+
+bool MeterS0::HWIF_GPIOCDEV::waitForImpulse(bool &timeout) {
+	struct timespec ts;
+	int cnt = waitForImpulses(&ts, 1);
+	timeout = cnt == 0;
+	return cnt > 0;
+}
@@ -1,5 +1,5 @@
 /**
- * Wrapper around libsml
+ * SML meter, the frames are decoded in place by SmlDecoder
  *
  * @package vzlogger
  * @copyright Copyright (c) 2011 - 2023, The volkszaehler.org project
@@ -28,7 +28,7 @@
  */
 
 #include <errno.h>
-#include <math.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,19 +45,13 @@
 
 #include "threads.h"
 
-/* sml stuff */
-#include <sml/sml_file.h>
-#include <sml/sml_transport.h>
-
 #include "Obis.hpp"
 #include "Options.hpp"
 #include "protocols/MeterSML.hpp"
 #include <VZException.hpp>
 
-#define SML_BUFFER_LEN 8096
-
 MeterSML::MeterSML(std::list<Option> options)
-	: Protocol("sml"), _host(""), _device(""), BUFFER_LEN(SML_BUFFER_LEN) {
+	: Protocol("sml"), _host(""), _device(""), BUFFER_LEN(SML_BUFFER_LEN), _rlen(0) {
 	OptionList optlist;
 
 	/* connection */
@@ -196,7 +190,8 @@ MeterSML::MeterSML(std::list<Option> options)
 	}
 }
 
-MeterSML::MeterSML(const MeterSML &proto) : Protocol(proto), _fd(ERR), BUFFER_LEN(SML_BUFFER_LEN) {}
+MeterSML::MeterSML(const MeterSML &proto)
+	: Protocol(proto), _fd(ERR), BUFFER_LEN(SML_BUFFER_LEN), _rlen(0) {}
 
 MeterSML::~MeterSML() {}
 
@@ -204,6 +199,8 @@ int MeterSML::open() {
 
 	if (_device != "") {
 		_fd = _openDevice(&_old_tio, _baudrate);
+		if (_pull.size() && !_bus)
+			_bus = SerialBus::get(_device);
 	} else if (_host != "") {
 		char *addr = strdup(host());
 		const char *node = strsep(&addr, ":");
@@ -215,6 +212,8 @@ int MeterSML::open() {
 		_fd = _openSocket(node, service);
 		free(addr);
 	}
+	_rlen = 0;
+	_held._used = 0;
 	return _fd;
 }
 
@@ -238,14 +237,24 @@ bool MeterSML::reopen() {
 	return _fd != ERR;
 }
 
+static void release_bus(void *bus) { static_cast<SerialBus *>(bus)->release(false); }
+
 ssize_t MeterSML::read(std::vector<Reading> &rds, size_t n) {
+	if (!_bus)
+		return _read(rds, n);
+
+	ssize_t res;
+	_bus->acquire(name());
+	pthread_cleanup_push(release_bus, _bus.get()); // cancelled or thrown while polling
+	res = _read(rds, n);
+	pthread_cleanup_pop(0);
+	_bus->release();
+	return res;
+}
 
-	unsigned char buffer[SML_BUFFER_LEN];
-	size_t bytes, m = 0;
+ssize_t MeterSML::_read(std::vector<Reading> &rds, size_t n) {
 
-	sml_file *file;
-	sml_get_list_response *body;
-	sml_list *entry;
+	size_t m = 0;
 
 	if (_fd < 0) {
 		if (!reopen()) {
@@ -256,83 +265,181 @@ ssize_t MeterSML::read(std::vector<Reading> &rds, size_t n) {
 	}
 
 	if (_pull.size()) {
+		if (_bus) { // the previous meter on the bus might use other settings
+			tcsetattr(_fd, TCSANOW, &_tio);
+			tcflush(_fd, TCIOFLUSH);
+		}
+		_rlen = 0; // frames received before are not the answer
+		_held._used = 0;
 		int wlen = write(_fd, _pull.c_str(), _pull.size());
 		print(log_debug, "sending pullsequenz send (len:%d is:%d).", name().c_str(), _pull.size(),
 			  wlen);
 	}
 
-	/* wait until we receive a new datagram from the meter (blocking read) */
-	CANCELLABLE(bytes = sml_transport_read(_fd, buffer, SML_BUFFER_LEN));
-
-	if (0 == bytes) {
+	/* wait until we receive a new frame from the meter (blocking read) */
+	bool reopened = false;
+	while (!_decode(rds, m, n)) {
+		if (_fill() >= 0)
+			continue;
 		// try to reopen. see issue #362
-		if (reopen()) {
-			CANCELLABLE(bytes = sml_transport_read(_fd, buffer, SML_BUFFER_LEN));
-			print(log_info, "sml_transport_read returned len=%d after reopen", name().c_str(),
-				  bytes);
+		if (reopened || !reopen()) {
+			print(log_error, "no SML frame received", name().c_str());
+			return 0;
 		}
+		print(log_info, "reading again after reopen", name().c_str());
+		reopened = true;
 	}
 
-	if (bytes < 16) {
-		print(log_error, "short message from sml_transport_read len=%d", name().c_str(), bytes);
-		return (0);
-	}
-
-	/* parse SML file & stripping escape sequences */
-	file = sml_file_parse(buffer + 8, bytes - 16);
+	return m; // return number of successful readings
+}
 
-	/* obtain SML messagebody of type getResponseList */
-	for (short i = 0; i < file->messages_len; i++) {
-		sml_message *message = file->messages[i];
+ssize_t MeterSML::_fill() {
+	if (_rlen == SML_BUFFER_LEN) {
+		print(log_error, "SML frame longer than %d bytes, dropped", name().c_str(), SML_BUFFER_LEN);
+		_rlen = 0;
+		_held._used = 0;
+	}
 
-		if (*message->message_body->tag == SML_MESSAGE_GET_LIST_RESPONSE) {
-			body = (sml_get_list_response *)message->message_body->data;
-			entry = body->val_list;
+	struct pollfd pfd;
+	pfd.fd = _fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	int res;
+	CANCELLABLE(res = poll(&pfd, 1, -1));
+	if (res < 0)
+		return errno == EINTR ? 0 : -1;
+
+	ssize_t len = ::read(_fd, _rbuf + _rlen, SML_BUFFER_LEN - _rlen);
+	if (len < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	if (len == 0) // closed
+		return -1;
+	_rlen += len;
+	return len;
+}
 
-			/* iterating through linked list */
-			for (; m < n && entry != NULL;) {
-				if (_parse(entry, &rds[m]))
-					m++;
-				entry = entry->next;
-			}
+class MeterSML::FrameVisitor : public SmlDecoder::Visitor {
+  public:
+	FrameVisitor(MeterSML &meter, std::vector<Reading> &rds, size_t &m, size_t n)
+		: _meter(meter), _rds(rds), _m(m), _n(n), _truncated(false) {
+		_now.tv_sec = 0;
+		_now.tv_usec = 0;
+	}
+	bool entry(const SmlDecoder::Entry &e) {
+		if (_m >= _n) {
+			_truncated = true;
+			return false;
 		}
+		if (_meter._parse(e, &_rds[_m], _now))
+			_m++;
+		return true;
 	}
+	bool truncated() const { return _truncated; }
+
+  private:
+	MeterSML &_meter;
+	std::vector<Reading> &_rds;
+	size_t &_m;
+	size_t _n;
+	bool _truncated;     // entries were left because rds is full
+	struct timeval _now; // one local time for all readings of a frame
+};
+
+size_t MeterSML::_decode(std::vector<Reading> &rds, size_t &m, size_t n) {
+	size_t frames = 0, pos = 0;
+	while (pos < _rlen && m < n) {
+		size_t used, len;
+		const unsigned char *body;
+		SmlDecoder::Result res;
+		if (_held._used) { // always at the start of _rbuf
+			res = SmlDecoder::FRAME;
+			used = _held._used;
+			body = _rbuf + _held._body;
+			len = _held._len;
+			_held._used = 0;
+		} else
+			res = SmlDecoder::frame(_rbuf + pos, _rlen - pos, used, body, len);
+		if (res == SmlDecoder::NONE) {
+			pos += used;
+			break;
+		}
+		if (res == SmlDecoder::BAD_FRAME) {
+			print(log_error, "dropped SML frame with wrong checksum", name().c_str());
+			pos += used;
+			frames++;
+			continue;
+		}
+		// a frame that might not fit into rds any more is kept for the next read()
+		if (m > 0 && n - m < SmlDecoder::max_entries(len) &&
+			n - m < SmlDecoder::entries(body, len)) {
+			_held._used = used;
+			_held._body = body - (_rbuf + pos);
+			_held._len = len;
+			break;
+		}
+		pos += used;
+		frames++;
+		FrameVisitor visitor(*this, rds, m, n);
+		if (!SmlDecoder::parse(body, len, visitor))
+			print(log_warning, "malformed SML message", name().c_str());
+		else if (visitor.truncated())
+			print(log_warning, "more SML entries than fit into one read, dropped the rest",
+				  name().c_str());
+	}
+	if (pos) {
+		memmove(_rbuf, _rbuf + pos, _rlen - pos);
+		_rlen -= pos;
+	}
+	return frames;
+}
 
-	/* free the malloc'd memory */
-	sml_file_free(file);
+#define SML_OBIS_CACHE_MAX 256 // more different names are garbage, don't let the cache grow
 
-	return m; // return number of successful readings
+ReadingIdentifier::Ptr MeterSML::_obisIdentifier(const Obis &obis, uint64_t key) {
+	auto it = _obisCache.find(key);
+	if (it != _obisCache.end())
+		return it->second;
+
+	ReadingIdentifier::Ptr rid(new ObisIdentifier(obis));
+	if (_obisCache.size() < SML_OBIS_CACHE_MAX)
+		_obisCache[key] = rid;
+	return rid;
 }
 
-bool MeterSML::_parse(sml_list *entry, Reading *rd) {
-	// int unit = (entry->unit) ? *entry->unit : 0;
-	int scaler = (entry->scaler) ? *entry->scaler : 1;
+bool MeterSML::_parse(const SmlDecoder::Entry &e, Reading *rd, struct timeval &now) {
+	// int unit = e._hasUnit ? e._unit : 0;
+	int scaler = e._hasScaler ? e._scaler : 1;
 
-	Obis obis((unsigned char)entry->obj_name->str[0], (unsigned char)entry->obj_name->str[1],
-			  (unsigned char)entry->obj_name->str[2], (unsigned char)entry->obj_name->str[3],
-			  (unsigned char)entry->obj_name->str[4], (unsigned char)entry->obj_name->str[5]);
-	if (obis.isValid() && entry->value != NULL) {
+	if (e._objNameLen < 6)
+		return false;
+	const unsigned char *obj = e._objName;
+	Obis obis(obj[0], obj[1], obj[2], obj[3], obj[4], obj[5]);
+	if (obis.isValid() && e._valueType != SmlDecoder::Entry::VALUE_NONE) {
 		// some entries might contain a string so check type and use proper rd->value(...) call
 		// if the entry does contain a string we can either throw it away or try to convert it to
 		// a value. We throw it away for now as its octet encoded and would need some conversion
-		if (entry->value->type == SML_TYPE_OCTET_STRING) {
-			// ignore value for now (entry->value->data.bytes points to something like
+		if (e._valueType == SmlDecoder::Entry::VALUE_OCTETS) {
+			// ignore value for now (e._octets points to something like
 			// "3032323830383136" we don't even create a reading for this:
 			return false;
 		} else {
-			rd->value(sml_value_to_double(entry->value) * pow(10, scaler));
+			rd->value(e._number * SmlDecoder::scale(scaler));
 		}
 
-		ReadingIdentifier *rid(new ObisIdentifier(obis));
-		rd->identifier(rid);
+		uint64_t key = 0;
+		for (int i = 0; i < 6; i++)
+			key = (key << 8) | obj[i];
+		rd->identifier(_obisIdentifier(obis, key));
 
 		// TODO handle SML_TIME_SEC_INDEX or time by SML File/Message
 		struct timeval tv;
-		if (!_use_local_time && entry->val_time) { /* use time from meter */
-			tv.tv_sec = *entry->val_time->data.timestamp;
+		if (!_use_local_time && e._hasTime) { /* use time from meter */
+			tv.tv_sec = e._time;
 			tv.tv_usec = 0;
 		} else {
-			gettimeofday(&tv, NULL); /* use local time */
+			if (!now.tv_sec)
+				gettimeofday(&now, NULL); /* use local time, once per frame */
+			tv = now;
 		}
 		rd->time(tv);
 		return true;
@@ -431,6 +538,7 @@ int MeterSML::_openDevice(struct termios *old_tio, speed_t baudrate) {
 
 	/* apply new configuration */
 	tcsetattr(fd, TCSANOW, &tio);
+	_tio = tio;
 
 	return fd;
 }
@@ -0,0 +1,470 @@
+/**
+ * Read SML from many TCP sources (e.g. IR heads with a network interface) in one thread
+ *
+ * @package vzlogger
+ * @copyright Copyright (c) 2026, The volkszaehler.org project
+ * @license http://www.gnu.org/licenses/gpl.txt GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <json-c/json.h>
+
+#include "Obis.hpp"
+#include "Options.hpp"
+#include "protocols/MeterSMLGateway.hpp"
+#include "threads.h"
+#include <VZException.hpp>
+
+#define SMLGW_EVENTS 64          // events handled per epoll_wait()
+#define SMLGW_OBIS_CACHE_MAX 256 // identifiers per source
+
+static int64_t monotonic_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+MeterSMLGateway::Source::Source(const std::string &id, const std::string &host)
+	: _id(id), _fd(-1), _state(IDLE), _retry(0), _deadline(0), _delay(0), _pending(false),
+	  _len(0) {
+	const size_t colon = host.rfind(':');
+	if (colon == std::string::npos || colon == 0 || colon + 1 == host.size())
+		throw vz::VZException("source host must be <host>:<port>");
+	_node = host.substr(0, colon);
+	_service = host.substr(colon + 1);
+}
+
+MeterSMLGateway::MeterSMLGateway(std::list<Option> options)
+	: Protocol("smlgateway"), _reconnectDelay(1000), _reconnectMaxDelay(60000),
+	  _connectTimeout(5), _readTimeout(30), _use_local_time(false), _epfd(-1) {
+	OptionList optlist;
+
+	try {
+		parse_sources(optlist.lookup_json_array(options, "sources"));
+		if (_sources.empty())
+			throw vz::VZException("no sources");
+	} catch (vz::VZException &e) {
+		print(log_alert, "Missing sources or invalid type", name().c_str());
+		throw;
+	}
+
+	try {
+		_reconnectDelay = optlist.lookup_int(options, "reconnect_delay");
+	} catch (vz::OptionNotFoundException &e) {
+		// keep default
+	} catch (vz::VZException &e) {
+		print(log_alert, "Invalid type for reconnect_delay", name().c_str());
+		throw;
+	}
+
+	try {
+		_reconnectMaxDelay = optlist.lookup_int(options, "reconnect_max_delay");
+	} catch (vz::OptionNotFoundException &e) {
+		// keep default
+	} catch (vz::VZException &e) {
+		print(log_alert, "Invalid type for reconnect_max_delay", name().c_str());
+		throw;
+	}
+	if (_reconnectDelay < 1)
+		_reconnectDelay = 1;
+	if (_reconnectMaxDelay < _reconnectDelay)
+		_reconnectMaxDelay = _reconnectDelay;
+
+	try {
+		_connectTimeout = optlist.lookup_int(options, "connect_timeout");
+	} catch (vz::OptionNotFoundException &e) {
+		// keep default
+	} catch (vz::VZException &e) {
+		print(log_alert, "Invalid type for connect_timeout", name().c_str());
+		throw;
+	}
+
+	try {
+		_readTimeout = optlist.lookup_int(options, "read_timeout");
+	} catch (vz::OptionNotFoundException &e) {
+		// keep default
+	} catch (vz::VZException &e) {
+		print(log_alert, "Invalid type for read_timeout", name().c_str());
+		throw;
+	}
+
+	try {
+		_use_local_time = optlist.lookup_bool(options, "use_local_time");
+	} catch (vz::OptionNotFoundException &e) {
+		// keep default
+	} catch (vz::VZException &e) {
+		print(log_alert, "Invalid type for use_local_time", name().c_str());
+		throw;
+	}
+}
+
+MeterSMLGateway::~MeterSMLGateway() { close(); }
+
+/**
+ * "sources": [
+ *   "<host>:<port>",                          identifier prefix is "<host>:<port>"
+ *   {"id": "<prefix>", "host": "<host>:<port>"}
+ * ]
+ */
+void MeterSMLGateway::parse_sources(struct json_object *jso) {
+	for (size_t i = 0; i < json_object_array_length(jso); i++) {
+		struct json_object *js = json_object_array_get_idx(jso, i);
+		std::string id, host;
+		if (json_object_get_type(js) == json_type_string) {
+			host = id = json_object_get_string(js);
+		} else if (json_object_get_type(js) == json_type_object) {
+			struct json_object *jh, *ji;
+			if (!json_object_object_get_ex(js, "host", &jh) ||
+				json_object_get_type(jh) != json_type_string)
+				throw vz::VZException("source without host");
+			host = id = json_object_get_string(jh);
+			if (json_object_object_get_ex(js, "id", &ji)) {
+				if (json_object_get_type(ji) != json_type_string)
+					throw vz::InvalidTypeException("source id must be a string");
+				id = json_object_get_string(ji);
+			}
+		} else
+			throw vz::InvalidTypeException("sources must be strings or objects");
+		if (id.find('/') != std::string::npos)
+			throw vz::VZException("source id must not contain '/'");
+		_sources.push_back(std::unique_ptr<Source>(new Source(id, host)));
+	}
+}
+
+int MeterSMLGateway::open() {
+	_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (_epfd < 0) {
+		print(log_alert, "epoll_create1(): %s", name().c_str(), strerror(errno));
+		return ERR;
+	}
+	// the connections are started by read(), a source that is down does not fail the meter
+	for (size_t i = 0; i < _sources.size(); i++) {
+		_sources[i]->_retry = 0;
+		_sources[i]->_delay = _reconnectDelay;
+	}
+	return SUCCESS;
+}
+
+int MeterSMLGateway::close() {
+	for (size_t i = 0; i < _sources.size(); i++) {
+		Source &s = *_sources[i];
+		if (s._fd >= 0)
+			::close(s._fd);
+		s._fd = -1;
+		s._state = Source::IDLE;
+		s._len = 0;
+	s._held._used = 0;
+		s._held._used = 0;
+		s._pending = false;
+	}
+	int res = 0;
+	if (_epfd >= 0)
+		res = ::close(_epfd);
+	_epfd = -1;
+	return res;
+}
+
+ssize_t MeterSMLGateway::read(std::vector<Reading> &rds, size_t n) {
+	struct epoll_event events[SMLGW_EVENTS];
+	size_t m = 0;
+
+	if (_epfd < 0)
+		return 0;
+
+	for (;;) {
+		const int64_t now = monotonic_ms();
+		int timeout = timers(now);
+
+		// frames that did not fit into the last call
+		for (size_t i = 0; i < _sources.size() && m < n; i++)
+			if (_sources[i]->_pending)
+				decode(*_sources[i], rds, m, n);
+		if (m > 0)
+			return m;
+
+		int res;
+		CANCELLABLE(res = epoll_wait(_epfd, events, SMLGW_EVENTS, timeout));
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			print(log_error, "epoll_wait(): %s", name().c_str(), strerror(errno));
+			_cancellable_sleep(1);
+			return 0;
+		}
+
+		const int64_t then = monotonic_ms();
+		for (int i = 0; i < res; i++) {
+			Source &s = *static_cast<Source *>(events[i].data.ptr);
+			if (s._state == Source::CONNECTING)
+				established(s, then);
+			else if (s._state == Source::CONNECTED && !s._pending) {
+				receive(s, then);
+				decode(s, rds, m, n);
+			}
+		}
+		if (m > 0)
+			return m;
+	}
+}
+
+int MeterSMLGateway::timers(int64_t now) {
+	int64_t next = -1;
+	for (size_t i = 0; i < _sources.size(); i++) {
+		Source &s = *_sources[i];
+		if (s._state == Source::IDLE && now >= s._retry)
+			connect_source(s, now);
+		else if (s._state != Source::IDLE && now >= s._deadline)
+			disconnect(s, now,
+					   s._state == Source::CONNECTING ? "connect timeout" : "read timeout");
+
+		const int64_t at = s._state == Source::IDLE ? s._retry : s._deadline;
+		if (next < 0 || at - now < next)
+			next = at > now ? at - now : 0;
+	}
+	return (int)next;
+}
+
+void MeterSMLGateway::connect_source(Source &s, int64_t now) {
+	struct addrinfo hints, *ais;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	// blocks for host names that are not cached, use addresses for many sources
+	int rc = getaddrinfo(s._node.c_str(), s._service.c_str(), &hints, &ais);
+	if (rc != 0) {
+		disconnect(s, now, gai_strerror(rc));
+		return;
+	}
+
+	s._fd = socket(ais->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (s._fd < 0) {
+		freeaddrinfo(ais);
+		disconnect(s, now, strerror(errno));
+		return;
+	}
+	int res = ::connect(s._fd, ais->ai_addr, ais->ai_addrlen);
+	freeaddrinfo(ais);
+	if (res < 0 && errno != EINPROGRESS) {
+		disconnect(s, now, strerror(errno));
+		return;
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLOUT; // writable once connected
+	ev.data.ptr = &s;
+	if (epoll_ctl(_epfd, EPOLL_CTL_ADD, s._fd, &ev) < 0) {
+		disconnect(s, now, strerror(errno));
+		return;
+	}
+	s._state = Source::CONNECTING;
+	s._deadline = now + _connectTimeout * 1000;
+}
+
+void MeterSMLGateway::established(Source &s, int64_t now) {
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if (getsockopt(s._fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		err = errno;
+	if (err) {
+		disconnect(s, now, strerror(err));
+		return;
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &s;
+	if (epoll_ctl(_epfd, EPOLL_CTL_MOD, s._fd, &ev) < 0) {
+		disconnect(s, now, strerror(errno));
+		return;
+	}
+	print(log_info, "connected to %s", name().c_str(), s._id.c_str());
+	s._state = Source::CONNECTED;
+	s._deadline = now + _readTimeout * 1000;
+	s._len = 0;
+	s._held._used = 0;
+}
+
+void MeterSMLGateway::disconnect(Source &s, int64_t now, const char *reason) {
+	print(log_warning, "%s: %s, reconnecting in %d ms", name().c_str(), s._id.c_str(), reason,
+		  s._delay);
+	if (s._fd >= 0)
+		::close(s._fd); // removes it from the epoll set
+	s._fd = -1;
+	s._state = Source::IDLE;
+	s._len = 0;
+	s._held._used = 0;
+	s._pending = false;
+	s._retry = now + s._delay;
+	s._delay = s._delay > _reconnectMaxDelay / 2 ? _reconnectMaxDelay : s._delay * 2;
+}
+
+void MeterSMLGateway::receive(Source &s, int64_t now) {
+	if (s._len == SML_BUFFER_LEN) {
+		print(log_error, "%s: SML frame longer than %d bytes, dropped", name().c_str(),
+			  s._id.c_str(), SML_BUFFER_LEN);
+		s._len = 0;
+	s._held._used = 0;
+		s._held._used = 0;
+	}
+	ssize_t len = ::read(s._fd, s._buf + s._len, SML_BUFFER_LEN - s._len);
+	if (len > 0) {
+		s._len += len;
+		s._deadline = now + _readTimeout * 1000;
+	} else if (len == 0)
+		disconnect(s, now, "connection closed");
+	else if (errno != EAGAIN && errno != EINTR)
+		disconnect(s, now, strerror(errno));
+}
+
+class MeterSMLGateway::FrameVisitor : public SmlDecoder::Visitor {
+  public:
+	FrameVisitor(MeterSMLGateway &meter, Source &source, std::vector<Reading> &rds, size_t &m,
+				 size_t n)
+		: _meter(meter), _source(source), _rds(rds), _m(m), _n(n), _truncated(false) {
+		_now.tv_sec = 0;
+		_now.tv_usec = 0;
+	}
+	bool entry(const SmlDecoder::Entry &e) {
+		if (_m >= _n) {
+			_truncated = true;
+			return false;
+		}
+		if (_meter.parse(_source, e, &_rds[_m], _now))
+			_m++;
+		return true;
+	}
+	bool truncated() const { return _truncated; }
+
+  private:
+	MeterSMLGateway &_meter;
+	Source &_source;
+	std::vector<Reading> &_rds;
+	size_t &_m;
+	size_t _n;
+	bool _truncated;     // entries were left because rds is full
+	struct timeval _now; // one local time for all readings of a frame
+};
+
+void MeterSMLGateway::decode(Source &s, std::vector<Reading> &rds, size_t &m, size_t n) {
+	size_t pos = 0;
+	s._pending = false;
+	while (pos < s._len) {
+		if (m >= n) { // keep the rest for the next read()
+			s._pending = true;
+			break;
+		}
+		size_t used, len;
+		const unsigned char *body;
+		SmlDecoder::Result res;
+		if (s._held._used) { // always at the start of _buf
+			res = SmlDecoder::FRAME;
+			used = s._held._used;
+			body = s._buf + s._held._body;
+			len = s._held._len;
+			s._held._used = 0;
+		} else
+			res = SmlDecoder::frame(s._buf + pos, s._len - pos, used, body, len);
+		if (res == SmlDecoder::NONE) {
+			pos += used;
+			break;
+		}
+		if (res == SmlDecoder::BAD_FRAME) {
+			print(log_error, "%s: dropped SML frame with wrong checksum", name().c_str(),
+				  s._id.c_str());
+			pos += used;
+			continue;
+		}
+		// a frame that might not fit into rds any more is kept for the next read()
+		if (m > 0 && n - m < SmlDecoder::max_entries(len) &&
+			n - m < SmlDecoder::entries(body, len)) {
+			s._held._used = used;
+			s._held._body = body - (s._buf + pos);
+			s._held._len = len;
+			s._pending = true;
+			break;
+		}
+		pos += used;
+		s._delay = _reconnectDelay; // the source works
+		FrameVisitor visitor(*this, s, rds, m, n);
+		if (!SmlDecoder::parse(body, len, visitor))
+			print(log_warning, "%s: malformed SML message", name().c_str(), s._id.c_str());
+		else if (visitor.truncated())
+			print(log_warning, "%s: more SML entries than fit into one read, dropped the rest",
+				  name().c_str(), s._id.c_str());
+	}
+	if (pos) {
+		memmove(s._buf, s._buf + pos, s._len - pos);
+		s._len -= pos;
+	}
+}
+
+// as MeterSML::_parse, with the source as identifier prefix
+bool MeterSMLGateway::parse(Source &s, const SmlDecoder::Entry &e, Reading *rd,
+							struct timeval &now) {
+	int scaler = e._hasScaler ? e._scaler : 1;
+
+	if (e._objNameLen < 6 || e._valueType != SmlDecoder::Entry::VALUE_NUMBER)
+		return false;
+	const unsigned char *obj = e._objName;
+	uint64_t key = 0;
+	for (int i = 0; i < 6; i++)
+		key = (key << 8) | obj[i];
+
+	ReadingIdentifier::Ptr rid;
+	auto it = s._ids.find(key);
+	if (it != s._ids.end())
+		rid = it->second;
+	else {
+		Obis obis(obj[0], obj[1], obj[2], obj[3], obj[4], obj[5]);
+		if (obis.isValid()) {
+			char code[32];
+			obis.unparse(code, sizeof(code));
+			rid.reset(new StringIdentifier(s._id + "/" + code));
+		}
+		if (s._ids.size() < SMLGW_OBIS_CACHE_MAX)
+			s._ids[key] = rid;
+	}
+	if (!rid)
+		return false;
+
+	rd->value(e._number * SmlDecoder::scale(scaler));
+	rd->identifier(rid);
+
+	struct timeval tv;
+	if (!_use_local_time && e._hasTime) { /* use time from meter */
+		tv.tv_sec = e._time;
+		tv.tv_usec = 0;
+	} else {
+		if (!now.tv_sec)
+			gettimeofday(&now, NULL); /* use local time, once per frame */
+		tv = now;
+	}
+	rd->time(tv);
+	return true;
+}
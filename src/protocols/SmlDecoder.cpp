@@ -0,0 +1,396 @@
+/**
+ * Streaming decoder for SML (Smart Message Language) as sent by electricity meters
+ *
+ * A frame starts with 1b1b1b1b 01010101 and ends with 1b1b1b1b 1a followed by the number of
+ * padding bytes and the CRC16 of the frame. Escape sequences are aligned to 4 bytes, a
+ * 1b1b1b1b in the data is sent twice.
+ *
+ * @copyright Copyright (c) 2026, The volkszaehler.org project
+ * @package vzlogger
+ * @license http://opensource.org/licenses/gpl-license.php GNU Public License
+ */
+/*
+ * This file is part of volkzaehler.org
+ *
+ * volkzaehler.org is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * volkzaehler.org is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with volkszaehler.org. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstring>
+
+#include "protocols/SmlDecoder.hpp"
+
+#define SML_GET_LIST_RESPONSE 0x00000701
+
+static const unsigned char escape_seq[4] = {0x1b, 0x1b, 0x1b, 0x1b};
+static const unsigned char start_seq[4] = {0x01, 0x01, 0x01, 0x01};
+
+static const double *scale_table() {
+	static double table[256];
+	for (int i = 0; i < 256; i++)
+		table[i] = pow(10, i - 128);
+	return table;
+}
+
+const double *const SmlDecoder::_scale = scale_table();
+
+static const uint16_t *crc16_table() {
+	static uint16_t table[256];
+	for (int i = 0; i < 256; i++) {
+		uint16_t crc = i;
+		for (int j = 0; j < 8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+		table[i] = crc;
+	}
+	return table;
+}
+
+uint16_t SmlDecoder::crc16(const unsigned char *buf, size_t len) {
+	static const uint16_t *table = crc16_table();
+	uint16_t crc = 0xffff;
+	while (len--)
+		crc = (crc >> 8) ^ table[(crc ^ *buf++) & 0xff];
+	return crc ^ 0xffff;
+}
+
+static bool is_start(const unsigned char *p) {
+	return memcmp(p, escape_seq, 4) == 0 && memcmp(p + 4, start_seq, 4) == 0;
+}
+
+SmlDecoder::Result SmlDecoder::frame(unsigned char *buf, size_t len, size_t &used,
+									 const unsigned char *&body, size_t &body_len) {
+	// find the start sequence
+	size_t s = 0;
+	for (;;) {
+		const unsigned char *p =
+			s < len ? (const unsigned char *)memchr(buf + s, 0x1b, len - s) : NULL;
+		if (p)
+			s = p - buf;
+		if (!p || s + 8 > len) {
+			// keep what might be the beginning of a start sequence
+			used = p ? s : (len > 7 ? len - 7 : 0);
+			return NONE;
+		}
+		if (is_start(buf + s))
+			break;
+		s++;
+	}
+
+	// find the end sequence without touching the data, the frame might be incomplete
+	size_t p = s + 8;
+	bool escaped = false;
+	for (;;) {
+		if (p + 4 > len) {
+			used = s;
+			return NONE;
+		}
+		if (memcmp(buf + p, escape_seq, 4) != 0) {
+			p += 4;
+			continue;
+		}
+		if (p + 8 > len) {
+			used = s;
+			return NONE;
+		}
+		const unsigned char *q = buf + p + 4;
+		if (memcmp(q, escape_seq, 4) == 0) {
+			escaped = true;
+			p += 8;
+		} else if (q[0] == 0x1a)
+			break;
+		else {
+			// a new frame starts or the escape sequence is invalid
+			used = memcmp(q, start_seq, 4) == 0 ? p : p + 8;
+			return BAD_FRAME;
+		}
+	}
+	used = p + 8;
+
+	const uint16_t crc = crc16(buf + s, p + 6 - s);
+	if (buf[p + 6] != (crc & 0xff) || buf[p + 7] != (crc >> 8))
+		return BAD_FRAME;
+
+	size_t end = p;
+	if (escaped) { // unescape in place
+		end = s + 8;
+		for (size_t r = s + 8; r < p; r += 4) {
+			if (memcmp(buf + r, escape_seq, 4) == 0)
+				r += 4; // the first one of the pair
+			memmove(buf + end, buf + r, 4);
+			end += 4;
+		}
+	}
+	const size_t padding = buf[p + 5];
+	if (padding > end - (s + 8))
+		return BAD_FRAME;
+
+	body = buf + s + 8;
+	body_len = end - (s + 8) - padding;
+	return FRAME;
+}
+
+namespace {
+
+enum {
+	TYPE_OCTETS = 0x00,
+	TYPE_BOOL = 0x40,
+	TYPE_INT = 0x50,
+	TYPE_UINT = 0x60,
+	TYPE_LIST = 0x70,
+	TYPE_END = 0x100 // EndOfSmlMsg
+};
+
+// reads the type-length-value encoding
+class Cursor {
+  public:
+	Cursor(const unsigned char *p, const unsigned char *end) : _p(p), _end(end) {}
+
+	// type and length of the next element. The length of a list is its number of elements,
+	// otherwise the number of data bytes following.
+	bool tl(unsigned &type, size_t &len) {
+		if (_p >= _end)
+			return false;
+		unsigned char b = *_p++;
+		if (b == 0x00) {
+			type = TYPE_END;
+			len = 0;
+			return true;
+		}
+		type = b & 0x70;
+		len = b & 0x0f;
+		size_t n = 1;
+		while (b & 0x80) {
+			if (_p >= _end || n == sizeof(size_t) * 2)
+				return false;
+			b = *_p++;
+			len = (len << 4) | (b & 0x0f);
+			n++;
+		}
+		if (type != TYPE_LIST) {
+			if (len < n || len - n > (size_t)(_end - _p))
+				return false;
+			len -= n;
+		}
+		return true;
+	}
+
+	// skip count elements
+	bool skip(size_t count = 1) {
+		unsigned type;
+		size_t len;
+		while (count) {
+			if (!tl(type, len))
+				return false;
+			count--;
+			if (type == TYPE_LIST)
+				count += len;
+			else
+				_p += len;
+		}
+		return true;
+	}
+
+	// the data of a number element with type and len
+	bool number(unsigned type, size_t len, int64_t &v) {
+		if (len == 0 || len > 8)
+			return false;
+		uint64_t u = 0;
+		if (type == TYPE_INT && (_p[0] & 0x80) && len < 8)
+			u = ~(uint64_t)0; // sign extension
+		for (size_t i = 0; i < len; i++)
+			u = (u << 8) | _p[i];
+		_p += len;
+		v = (int64_t)u;
+		return true;
+	}
+
+	// an optional integer
+	bool integer(bool &has, int64_t &v) {
+		unsigned type;
+		size_t len;
+		if (!tl(type, len))
+			return false;
+		has = !(type == TYPE_OCTETS && len == 0);
+		if (!has)
+			return true;
+		return (type == TYPE_INT || type == TYPE_UINT) && number(type, len, v);
+	}
+
+	const unsigned char *_p;
+	const unsigned char *_end;
+};
+
+// valTime: optional list of the kind of time (secIndex, timestamp or localTimestamp) and
+// the seconds. A localTimestamp is a list of the timestamp and two offsets.
+bool val_time(Cursor &c, SmlDecoder::Entry &e) {
+	unsigned type;
+	size_t n, len;
+	int64_t v = 0;
+	bool has;
+	e._hasTime = false;
+	if (!c.tl(type, n))
+		return false;
+	if (type == TYPE_OCTETS && n == 0)
+		return true;
+	if (type != TYPE_LIST || n < 2 || !c.integer(has, v) || !c.tl(type, len))
+		return false;
+	if (type == TYPE_LIST) {
+		if (len < 1 || !c.integer(e._hasTime, v) || !c.skip(len - 1))
+			return false;
+	} else if (type == TYPE_UINT || type == TYPE_INT) {
+		if (!c.number(type, len, v))
+			return false;
+		e._hasTime = true;
+	} else
+		return false;
+	e._time = (uint32_t)v;
+	return c.skip(n - 2);
+}
+
+bool entry(Cursor &c, SmlDecoder::Entry &e) {
+	unsigned type;
+	size_t n, len;
+	int64_t v = 0;
+	if (!c.tl(type, n) || type != TYPE_LIST || n < 6)
+		return false;
+
+	// objName
+	if (!c.tl(type, len) || type != TYPE_OCTETS)
+		return false;
+	e._objName = c._p;
+	e._objNameLen = len;
+	c._p += len;
+
+	// status
+	if (!c.skip() || !val_time(c, e))
+		return false;
+
+	if (!c.integer(e._hasUnit, v))
+		return false;
+	e._unit = (uint8_t)v;
+	if (!c.integer(e._hasScaler, v))
+		return false;
+	e._scaler = (int8_t)v;
+
+	// value
+	e._valueType = SmlDecoder::Entry::VALUE_NONE;
+	if (!c.tl(type, len))
+		return false;
+	switch (type) {
+	case TYPE_OCTETS:
+		if (len) {
+			e._valueType = SmlDecoder::Entry::VALUE_OCTETS;
+			e._octets = c._p;
+			e._octetsLen = len;
+		}
+		c._p += len;
+		break;
+	case TYPE_BOOL:
+		if (len != 1)
+			return false;
+		e._valueType = SmlDecoder::Entry::VALUE_NUMBER;
+		e._number = *c._p++ ? 1 : 0;
+		break;
+	case TYPE_INT:
+	case TYPE_UINT:
+		if (!c.number(type, len, v))
+			return false;
+		e._valueType = SmlDecoder::Entry::VALUE_NUMBER;
+		e._number = type == TYPE_INT ? (double)v : (double)(uint64_t)v;
+		break;
+	case TYPE_LIST: // not supported
+		if (!c.skip(len))
+			return false;
+		break;
+	default:
+		return false;
+	}
+
+	// valueSignature
+	return c.skip(n - 6);
+}
+
+// visit the entries of a GetListResponse. stop is set if the visitor does not want more.
+bool get_list_response(Cursor &c, SmlDecoder::Visitor &visitor, bool &stop) {
+	unsigned type;
+	size_t n, entries;
+	if (!c.tl(type, n) || type != TYPE_LIST || n < 5)
+		return false;
+	// clientId, serverId, listName, actSensorTime
+	if (!c.skip(4))
+		return false;
+	if (!c.tl(type, entries) || type != TYPE_LIST)
+		return false;
+	for (size_t i = 0; i < entries; i++) {
+		SmlDecoder::Entry e;
+		if (!entry(c, e))
+			return false;
+		if (!visitor.entry(e)) {
+			stop = true;
+			return true;
+		}
+	}
+	// listSignature, actGatewayTime
+	return c.skip(n - 5);
+}
+
+} // namespace
+
+bool SmlDecoder::parse(const unsigned char *body, size_t len, Visitor &visitor) {
+	Cursor c(body, body + len);
+	unsigned type;
+	size_t n, m;
+	int64_t tag;
+	bool has, stop = false;
+	while (c._p < c._end) {
+		if (*c._p == 0x00) { // EndOfSmlMsg or padding
+			c._p++;
+			continue;
+		}
+		// transactionId, groupNo, abortOnError, messageBody, crc16, endOfSmlMsg
+		if (!c.tl(type, n) || type != TYPE_LIST || n < 4 || !c.skip(3))
+			return false;
+		// messageBody: tag and data
+		if (!c.tl(type, m) || type != TYPE_LIST || m != 2 || !c.integer(has, tag) || !has)
+			return false;
+		if (tag == SML_GET_LIST_RESPONSE) {
+			if (!get_list_response(c, visitor, stop))
+				return false;
+			if (stop)
+				return true;
+		} else if (!c.skip())
+			return false;
+		if (!c.skip(n - 4))
+			return false;
+	}
+	return true;
+}
+
+namespace {
+class CountVisitor : public SmlDecoder::Visitor {
+  public:
+	CountVisitor() : _n(0) {}
+	bool entry(const SmlDecoder::Entry &e) {
+		_n++;
+		return true;
+	}
+	size_t _n;
+};
+} // namespace
+
+size_t SmlDecoder::entries(const unsigned char *body, size_t len) {
+	CountVisitor c;
+	parse(body, len, c);
+	return c._n;
+}
@@ -25,6 +25,7 @@
 
 #include <math.h>
 #include <unistd.h>
+#include <unordered_map>
 
 #include "Reading.hpp"
 #include "threads.h"
@@ -33,6 +34,7 @@
 #include <api/InfluxDB.hpp>
 #include <api/MySmartGrid.hpp>
 #include <api/Null.hpp>
+#include <api/UdpLine.hpp>
 #include <api/Volkszaehler.hpp>
 #ifdef LOCAL_SUPPORT
 #include "local.h"
@@ -41,6 +43,7 @@
 #include "mqtt.hpp"
 #endif
 #include "PushData.hpp"
+#include "ShmRing.hpp"
 
 extern Config_Options options;
 
@@ -50,7 +53,11 @@ void *reading_thread(void *arg) {
 	time_t aggIntEnd;
 	const meter_details_t *details;
 	size_t n = 0;
+	size_t period_readings = 0; // readings within the current aggregation period
 	bool first_reading = true;
+#ifdef ENABLE_MQTT
+	MqttClient::Batch mqttBatch; // values of the current period if mqtt batch mode is enabled
+#endif
 
 	// Only allow cancellation at safe points
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
@@ -59,6 +66,68 @@ void *reading_thread(void *arg) {
 	details = meter_get_details(mtr->protocolId());
 	std::vector<Reading> rds(details->max_readings, Reading(mtr->identifier()));
 
+	// interned channel ids for the push data list, in channel order:
+	std::vector<uint32_t> pushIds;
+	if (pushDataList)
+		for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++)
+			pushIds.push_back(pushDataList->intern((*ch)->uuid()));
+
+	// channel indices by identifier if all channels use string identifiers (e.g. a mqtt meter
+	// with thousands of topics). These are equal iff the strings are, so the lookup matches
+	// exactly like the linear search.
+	std::unordered_map<std::string, std::vector<size_t>> chIndex;
+	if (mapping->size() > 8) {
+		size_t chIdx = 0;
+		for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++, chIdx++) {
+			const StringIdentifier *sid =
+				dynamic_cast<const StringIdentifier *>((*ch)->identifier().get());
+			if (!sid) {
+				chIndex.clear();
+				break;
+			}
+			chIndex[sid->string()].push_back(chIdx);
+		}
+	}
+
+	// channel indices by identifier object for meters that reuse their identifiers (e.g. d0).
+	// The cache holds a reference, so an address can't be reused by another identifier. Meters
+	// creating new identifiers for each reading overflow it and it is switched off.
+	std::unordered_map<const ReadingIdentifier *,
+					   std::pair<ReadingIdentifier::Ptr, std::vector<size_t>>>
+		idCache;
+	bool idCacheOff = false;
+
+	// insert a reading into the queue of channel chIdx and pass it on:
+	auto deliver = [&](size_t chIdx, Reading &rd) {
+		Channel::Ptr &ch = *(mapping->begin() + chIdx);
+		if (ch->time_ms() < rd.time_ms()) {
+			ch->last(&rd);
+		}
+
+		print(log_info, "Adding reading to queue (value=%.2f ts=%lld)", ch->name(), rd.value(),
+			  rd.time_ms());
+		ch->push(rd);
+
+		// provide data to push data server:
+		if (pushDataList) {
+			pushDataList->add(pushIds[chIdx], rd.time_ms(), rd.value());
+			print(log_finest, "added to uuid %s", "push", ch->uuid());
+		}
+		// and to the local shared memory ring:
+		if (shmRing) {
+			shmRing->add(ch.get(), rd.time_ms(), rd.value());
+		}
+#ifdef ENABLE_MQTT
+		// update mqtt values as well:
+		if (mqttClient) {
+			if (mqttClient->batch())
+				mqttBatch.emplace_back(ch, rd);
+			else
+				mqttClient->publish(ch, rd);
+		}
+#endif
+	};
+
 	print(log_debug, "Number of readers: %d", mtr->name(), details->max_readings);
 	print(log_debug, "Config.local: %d", mtr->name(), options.local());
 
@@ -116,41 +185,67 @@ void *reading_thread(void *arg) {
 							n = 0;
 						}
 
+				period_readings += n;
+
 				/* insert readings into channel queues */
-				if (n > 0)
-					for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
+				if (n > 0 && chIndex.size()) {
+					for (size_t i = 0; i < n; i++) {
+						const StringIdentifier *rid =
+							dynamic_cast<const StringIdentifier *>(rds[i].identifier().get());
+						auto it = rid ? chIndex.find(rid->string()) : chIndex.end();
+						if (it != chIndex.end())
+							for (size_t chIdx : it->second)
+								deliver(chIdx, rds[i]);
+					}
+				} else if (n > 0 && !idCacheOff) {
+					for (size_t i = 0; i < n; i++) {
+						ReadingIdentifier::Ptr rid = rds[i].identifier();
+						auto it = idCache.find(rid.get());
+						if (it == idCache.end()) {
+							if (idCache.size() >= 256) {
+								print(log_debug, "identifiers aren't reused, no id cache",
+									  mtr->name());
+								idCacheOff = true;
+								idCache.clear();
+							}
+							std::vector<size_t> chIdxs;
+							size_t chIdx = 0;
+							for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end();
+								 ch++, chIdx++)
+								if (rid && *rid == *(*ch)->identifier().get())
+									chIdxs.push_back(chIdx);
+							if (!idCacheOff)
+								it = idCache.emplace(rid.get(), std::make_pair(rid, chIdxs)).first;
+							for (size_t chIdx : chIdxs)
+								deliver(chIdx, rds[i]);
+							continue;
+						}
+						for (size_t chIdx : it->second.second)
+							deliver(chIdx, rds[i]);
+					}
+				} else if (n > 0) {
+					size_t chIdx = 0;
+					for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end();
+						 ch++, chIdx++) {
 
 						// print(log_debug, "Check channel %s, n=%d", mtr->name(), ch->name(), n);
 
 						for (size_t i = 0; i < n; i++) {
 							if (*rds[i].identifier().get() == *(*ch)->identifier().get()) {
 								// print(log_debug, "found channel", mtr->name());
-								if ((*ch)->time_ms() < rds[i].time_ms()) {
-									(*ch)->last(&rds[i]);
-								}
-
-								print(log_info, "Adding reading to queue (value=%.2f ts=%lld)",
-									  (*ch)->name(), rds[i].value(), rds[i].time_ms());
-								(*ch)->push(rds[i]);
-
-								// provide data to push data server:
-								if (pushDataList) {
-									const std::string uuid = (*ch)->uuid();
-									pushDataList->add(uuid, rds[i].time_ms(), rds[i].value());
-									print(log_finest, "added to uuid %s", "push", uuid.c_str());
-								}
-#ifdef ENABLE_MQTT
-								// update mqtt values as well:
-								if (mqttClient) {
-									mqttClient->publish((*ch), rds[i]);
-								}
-#endif
+								deliver(chIdx, rds[i]);
 							}
 						}
 
 					} // channel loop
+				}
 			} while ((mtr->aggtime() > 0) && (time(NULL) < aggIntEnd)); /* default aggtime is -1 */
 
+#ifdef ENABLE_MQTT
+			if (mqttClient) // one message with all raw values of the period
+				mqttClient->flush(mtr->name(), mqttBatch);
+#endif
+
 			for (MeterMap::iterator ch = mapping->begin(); ch != mapping->end(); ch++) {
 
 				/* aggregate buffer values if aggmode != NONE */
@@ -162,7 +257,7 @@ void *reading_thread(void *arg) {
 				(*ch)->buffer()->clean();
 #ifdef LOCAL_SUPPORT
 				if (options.local()) {
-					shrink_localbuffer();          // remove old/outdated data in the local buffer
+					// old data is removed by the shrink thread
 					add_ch_to_localbuffer(*(*ch)); // add this ch data to the local buffer
 				}
 #endif
@@ -177,7 +272,10 @@ void *reading_thread(void *arg) {
 									// the lock()/unlock() should avoid it.
 							Reading &r = *it;
 							if (!r.deleted()) {
-								mqttClient->publish((*ch), r, true);
+								if (mqttClient->batch())
+									mqttBatch.emplace_back((*ch), r);
+								else
+									mqttClient->publish((*ch), r, true);
 							}
 						}
 					}
@@ -194,6 +292,16 @@ void *reading_thread(void *arg) {
 					//(*ch)->size(), (*ch)->dump().c_str());
 				}
 			}
+#ifdef ENABLE_MQTT
+			if (mqttClient) // one message with all aggregated values
+				mqttClient->flush(mtr->name(), mqttBatch, true);
+#endif
+#ifdef LOCAL_SUPPORT
+			if (options.local()) {
+				update_local_metrics(*mapping, period_readings); // new snapshot for /metrics
+			}
+#endif
+			period_readings = 0;
 		} while (true);
 	} catch (std::exception &e) {
 		std::stringstream oss;
@@ -225,6 +333,9 @@ void *logging_thread(void *arg) { // is started by Channel::start and stopped vi
 	} else if (0 == strcasecmp(ch->apiProtocol().c_str(), "influxdb")) {
 		api = vz::ApiIF::Ptr(new vz::api::InfluxDB(ch, ch->options()));
 		print(log_debug, "Using InfluxDB api", ch->name());
+	} else if (0 == strcasecmp(ch->apiProtocol().c_str(), "udp")) {
+		api = vz::ApiIF::Ptr(new vz::api::UdpLine(ch, ch->options()));
+		print(log_debug, "Using udp api", ch->name());
 	} else if (0 == strcasecmp(ch->apiProtocol().c_str(), "null")) {
 		api = vz::ApiIF::Ptr(new vz::api::Null(ch, ch->options()));
 		print(log_debug, "Using null api- meter data available via local httpd if enabled.",
@@ -47,6 +47,7 @@
 #include "CurlSessionProvider.hpp"
 #include "Obis.hpp"
 #include "PushData.hpp"
+#include "ShmRing.hpp"
 #include "threads.h"
 #include "vzlogger.h"
 #include <Config_Options.hpp>
@@ -474,7 +475,8 @@ int main(int argc, char *argv[]) {
 
 	print(log_alert, "log level is %d", "main", options.verbosity());
 
-	curlSessionProvider = new CurlSessionProvider();
+	curlSessionProvider = new CurlSessionProvider(options.curl_handles(), options.curl_idle(),
+												  options.curl_prewarm());
 
 	// Register vzlogger
 	if (options.doRegistration()) {
@@ -508,7 +510,7 @@ int main(int argc, char *argv[]) {
 	}
 
 	if (options.pushDataServer()) {
-		pushDataList = new PushDataList();
+		pushDataList = new PushDataList(options.push_window(), options.push_tuples());
 		int ret = pthread_create(&_pushdata_thread, NULL, push_data_thread,
 								 (void *)options.pushDataServer()); // todo error handling?
 		if (ret)
@@ -519,8 +521,21 @@ int main(int argc, char *argv[]) {
 		print(log_finest, "No pushDataServer defined.", "push");
 	}
 
+	std::vector<Channel::Ptr> channels;
+	for (MapContainer::iterator it = mappings.begin(); it != mappings.end(); it++)
+		for (MeterMap::iterator ch = it->begin(); ch != it->end(); ch++)
+			channels.push_back(*ch);
+
+	if (shmRing) {
+		if (!shmRing->open(channels)) {
+			delete shmRing;
+			shmRing = 0;
+		}
+	}
+
 #ifdef ENABLE_MQTT
 	if (mqttClient) {
+		mqttClient->init(channels);
 		int ret = pthread_create(&_mqtt_client_thread, NULL, mqtt_client_thread, (void *)0);
 		if (ret)
 			print(log_error, "Error %d creating mqtt_client_thread!", "mqtt", ret);
@@ -529,6 +544,13 @@ int main(int argc, char *argv[]) {
 	}
 #endif
 
+#ifdef LOCAL_SUPPORT
+	// the reader threads add to the local buffers without a lock, so they have to exist
+	// before the first meter starts
+	if (options.local())
+		init_local_index(mappings, options.local_threads() > 0);
+#endif /* LOCAL_SUPPORT */
+
 	print(log_debug, "===> Start meters", "");
 	try {
 		// open connection meters & start threads
@@ -549,9 +571,27 @@ int main(int argc, char *argv[]) {
 		// start webserver for local interface
 		if (options.local()) {
 			print(log_info, "Starting local interface HTTPd on port %i", "http", options.port());
-			httpd_handle =
-				MHD_start_daemon(MHD_USE_THREAD_PER_CONNECTION, options.port(), NULL, NULL,
-								 &handle_request, (void *)&mappings, MHD_OPTION_END);
+			start_local_housekeeping();
+			if (options.local_threads() > 0) {
+				// a few threads serving all connections with epoll (or poll/select). waiting
+				// comet and event stream connections are suspended.
+#if MHD_VERSION >= 0x00095300
+				unsigned int flags = MHD_USE_AUTO_INTERNAL_THREAD | MHD_ALLOW_SUSPEND_RESUME;
+#else
+				unsigned int flags = MHD_USE_SELECT_INTERNALLY | MHD_USE_SUSPEND_RESUME;
+#endif
+				httpd_handle = MHD_start_daemon(
+					flags, options.port(), NULL, NULL, &handle_request, (void *)&mappings,
+					MHD_OPTION_THREAD_POOL_SIZE, (unsigned int)options.local_threads(),
+					MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL, MHD_OPTION_END);
+			} else {
+				httpd_handle = MHD_start_daemon(
+					MHD_USE_THREAD_PER_CONNECTION, options.port(), NULL, NULL, &handle_request,
+					(void *)&mappings, MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL,
+					MHD_OPTION_END);
+			}
+			if (!httpd_handle)
+				print(log_alert, "Starting local interface HTTPd failed", "http");
 		}
 #endif /* LOCAL_SUPPORT */
 	} catch (std::exception &e) {
@@ -607,11 +647,13 @@ int main(int argc, char *argv[]) {
 
 #ifdef LOCAL_SUPPORT
 	/* stop webserver */
+	stop_local_waiters();
 	if (httpd_handle) {
 		print(log_finest, "Waiting for httpd to stop...", "");
 		MHD_stop_daemon(httpd_handle);
 		print(log_finest, "httpd stopped", "");
 	}
+	stop_local_housekeeping();
 #endif /* LOCAL_SUPPORT */
 
 	/* householding */
@@ -645,6 +687,12 @@ int main(int argc, char *argv[]) {
 	}
 #endif
 
+	if (shmRing) {
+		delete shmRing; // readers see the cleared magic
+		shmRing = 0;
+		print(log_finest, "deleted shmRing", "shm");
+	}
+
 	if (curlSessionProvider) {
 		print(log_finest, "Trying to delete curlSessionProvider...", "");
 		delete curlSessionProvider;
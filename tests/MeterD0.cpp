@@ -1,6 +1,10 @@
 #include "protocols/MeterD0.hpp"
 #include "Options.hpp"
 #include "gtest/gtest.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
 
 // this is a dirty hack. we should think about better ways/rules to link against the
 // test objects.
@@ -30,72 +34,142 @@ int writes(int fd, const char *str) {
 	return write(fd, str, len);
 }
 
+static std::string unhex(const char *hex) {
+	std::string toRet;
+	for (size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+		unsigned int c;
+		sscanf(&hex[i], "%2x", &c);
+		toRet += (char)c;
+	}
+	return toRet;
+}
+
+// the meter side of a D0 connection via "host". A pull mode read() drops all pending input
+// before it sends the request, so the answer has to be sent afterwards like a real meter does.
+class D0Peer {
+  public:
+	D0Peer() : _listen(socket(AF_INET, SOCK_STREAM, 0)), _fd(-1) {
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		bind(_listen, (struct sockaddr *)&addr, sizeof(addr));
+		listen(_listen, 1);
+		socklen_t len = sizeof(addr);
+		getsockname(_listen, (struct sockaddr *)&addr, &len);
+		_host = "127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+	}
+	~D0Peer() {
+		if (_fd >= 0)
+			shutdown(_fd, SHUT_RDWR);
+		request();
+		if (_fd >= 0)
+			::close(_fd);
+		::close(_listen);
+	}
+	const char *host() const { return _host.c_str(); }
+	// after MeterD0::open()
+	bool accept() {
+		_fd = ::accept(_listen, NULL, NULL);
+		struct timeval tv = {10, 0}; // don't hang if no request is sent
+		setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		return _fd >= 0;
+	}
+	// input not asked for, e.g. a late answer to an earlier request
+	void send(const std::string &data) {
+		EXPECT_EQ((ssize_t)data.size(), write(_fd, data.data(), data.size()));
+		usleep(10000); // let it arrive before the next read()
+	}
+	// in the background: wait for a request of len bytes, then send the answer
+	void answer(size_t len, const std::string &data) {
+		request();
+		_request.clear();
+		_thread = std::thread([this, len, data]() {
+			char buf[64];
+			while (_request.size() < len) {
+				ssize_t n = ::read(_fd, buf, std::min(sizeof(buf), len - _request.size()));
+				if (n <= 0)
+					return;
+				_request.append(buf, n);
+			}
+			if (write(_fd, data.data(), data.size()) != (ssize_t)data.size())
+				_request += "<answer failed>";
+		});
+	}
+	// the request received by answer()
+	std::string request() {
+		if (_thread.joinable())
+			_thread.join();
+		return _request;
+	}
+	// what the meter sent after the request
+	std::string pending() {
+		std::string toRet;
+		char buf[64];
+		ssize_t n;
+		while ((n = recv(_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+			toRet.append(buf, n);
+		return toRet;
+	}
+
+  private:
+	int _listen;
+	int _fd;
+	std::string _host;
+	std::thread _thread;
+	std::string _request;
+};
+
 TEST(MeterD0, basic_dump_fd) {
 
 	std::string dumpName("/tmp/dumpD0UnitTestxyz1234");
-	char tempfilename[L_tmpnam + 1];
-	ASSERT_NE(tmpnam(tempfilename), (char *)0);
-	ASSERT_NE(strlen(tempfilename), 0ul);
+	D0Peer peer;
 	std::list<Option> options;
-	options.push_back(Option("device", tempfilename));
+	options.push_back(Option("host", peer.host()));
 	options.push_back(Option("dump_file", dumpName.c_str()));
 	options.push_back(Option("pullseq", (char *)"4041424344"));
 	options.push_back(Option("ackseq", (char *)"063030300d0a"));
 	MeterD0 m(options);
-	ASSERT_STREQ(m.device(), tempfilename);
-	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
-	int fd = open(tempfilename, O_RDWR);
-	ASSERT_NE(strlen(tempfilename), 0ul);
-	ASSERT_NE(fd, -1);
+	ASSERT_STREQ(m.host(), peer.host());
 	ASSERT_EQ(SUCCESS, m.open());
+	ASSERT_TRUE(peer.accept());
 	std::vector<Reading> rds;
 	rds.resize(1);
-	// can't test for timeout here as the fdset... don't work for pipes. EXPECT_EQ(0, m.read(rds,
-	// 10)); // check for timeout
-	writes(fd, "/HAg5eHZ010C_EHZ1vA02\r\n");      // small (HA)g to set reaction time to 20ms
-	writes(fd, "1-0:1.8.0*255(000001.2963)\r\n"); // works only with \r\n error (see ack handling)
-	writes(fd, "!\n");
+	peer.answer(5, "/HAg5eHZ010C_EHZ1vA02\r\n"     // small (HA)g to set reaction time to 20ms
+				   "1-0:1.8.0*255(000001.2963)\r\n" // works only with \r\n error (see ack handling)
+				   "!\n");
 	EXPECT_EQ(1, m.read(rds, 1));
+	EXPECT_EQ("@ABCD", peer.request());
 
 	ASSERT_EQ(0, m.close());
-	EXPECT_EQ(0, close(fd));
-	EXPECT_EQ(0, unlink(tempfilename));
 	//	EXPECT_EQ(0, unlink(dumpName.c_str()));
 }
 
 TEST(MeterD0, basic_dump_fd_autoack) {
 
 	std::string dumpName("/tmp/dumpD0UnitTestxyz1234");
-	char tempfilename[L_tmpnam + 1];
-	ASSERT_NE(tmpnam(tempfilename), (char *)0);
+	D0Peer peer;
 	std::list<Option> options;
-	options.push_back(Option("device", tempfilename));
+	options.push_back(Option("host", peer.host()));
 	options.push_back(Option("dump_file", (char *)dumpName.c_str()));
 	options.push_back(Option("pullseq", (char *)"2F3F210D0A"));
 	options.push_back(Option("ackseq", (char *)"auto"));
 	options.push_back(Option("baudrate", 300));
 	MeterD0 m(options);
-	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
-	int fd = open(tempfilename, O_RDWR);
-	ASSERT_NE(fd, -1);
 	ASSERT_EQ(SUCCESS, m.open());
+	ASSERT_TRUE(peer.accept());
 	std::vector<Reading> rds;
 	rds.resize(1);
-	// can't test for timeout here as the fdset... don't work for pipes. EXPECT_EQ(0, m.read(rds,
-	// 10)); // check for timeout
-	writes(fd, "/HAg5eHZ010C_EHZ1vA02\r\n");      // small (HA)g to set reaction time to 20ms
-	writes(fd, "1-0:1.8.0*255(000001.2963)\r\n"); // works only with \r\n error (see ack handling)
-	writes(fd, "!");
+	peer.answer(5, "/HAg5eHZ010C_EHZ1vA02\r\n"     // small (HA)g to set reaction time to 20ms
+				   "1-0:1.8.0*255(000001.2963)\r\n" // works only with \r\n error (see ack handling)
+				   "!");
 	EXPECT_EQ(1, m.read(rds, 1));
 
-	// now read from fd and check for pullseq and proper ackseq:
-	char buf[100];
-	ssize_t len = read(fd, buf, sizeof(buf));
-	EXPECT_EQ((ssize_t)strlen("/?!\r\n\x06\x30\x35\x30\x0d\x0a"), len) << "buf=[" << buf << "]";
+	// check for pullseq and proper ackseq:
+	EXPECT_EQ("/?!\r\n", peer.request());
+	EXPECT_EQ("\x06\x30\x35\x30\x0d\x0a", peer.pending());
 
 	ASSERT_EQ(0, m.close());
-	EXPECT_EQ(0, close(fd));
-	EXPECT_EQ(0, unlink(tempfilename));
 	//	EXPECT_EQ(0, unlink(dumpName.c_str()));
 }
 
@@ -196,20 +270,16 @@ TEST(MeterD0, HagerEHZ_waitsync) {
 }
 
 TEST(MeterD0, LandisGyr_basic) {
-	char tempfilename[L_tmpnam + 1];
+	D0Peer peer;
 	char str_pullseq[12] = "2f3f210d0a";
-	ASSERT_NE(tmpnam(tempfilename), (char *)0);
 	std::list<Option> options;
-	options.push_back(Option("device", tempfilename));
+	options.push_back(Option("host", peer.host()));
 	options.push_back(Option("pullseq", str_pullseq));
 	MeterD0 m(options);
-	ASSERT_STREQ(m.device(), tempfilename) << "devicename not eq " << tempfilename;
-	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
-	int fd = open(tempfilename, O_RDWR);
-	ASSERT_NE(fd, -1);
 	ASSERT_EQ(SUCCESS, m.open());
+	ASSERT_TRUE(peer.accept());
 
-	// now we can simulate some input by simply writing into fd
+	// the peer answers the pull request
 	std::vector<Reading> rds;
 	rds.resize(10);
 
@@ -228,27 +298,21 @@ TEST(MeterD0, LandisGyr_basic) {
 	2.8.0(004329.6*kWh) <-- Summe Zählerstand Energieeinspeisung
 	!                   <-- Endesequenz
 	*/
-	// without splitting the MeterD0::read source/logic (or multithreading) we can't
-	// wait for the pullseq before we put the data. Thus we just put the data in the buffer
-	// and check afterwards whether a pullseq was send as well.
-
-	writes(fd, "/?!\r\n/LGZ52ZMD120APt.G03\r\n");
-	writes(fd, "F.F(00000000)\r\n"); // works only with \r\n error (see ack handling)
-	writes(fd, "0.0.0( 20000)\r\n");
-	writes(fd, "1.8.1(001846.0*kWh)\r\n");
-	writes(fd, "1.8.2(000000.0*kWh)\r\n");
-	writes(fd, "2.8.1(004329.6*kWh)\r\n");
-	writes(fd, "2.8.2(000000.0*kWh)\r\n");
-	writes(fd, "1.8.0(001846.0*kWh)\r\n");
-	writes(fd, "2.8.0(004329.6*kWh)\r\n");
-	writes(fd, "!");
+	peer.answer(5, "/?!\r\n/LGZ52ZMD120APt.G03\r\n"
+				   "F.F(00000000)\r\n" // works only with \r\n error (see ack handling)
+				   "0.0.0( 20000)\r\n"
+				   "1.8.1(001846.0*kWh)\r\n"
+				   "1.8.2(000000.0*kWh)\r\n"
+				   "2.8.1(004329.6*kWh)\r\n"
+				   "2.8.2(000000.0*kWh)\r\n"
+				   "1.8.0(001846.0*kWh)\r\n"
+				   "2.8.0(004329.6*kWh)\r\n"
+				   "!");
 
 	// now perform one read call
 	EXPECT_EQ(8, m.read(rds, 10));
-	// check whether pullseq is remaining in the fifo:
-	char buf[100];
-	ssize_t len = read(fd, buf, sizeof(buf));
-	ASSERT_EQ((ssize_t)strlen("/?!\r\n"), len) << "buf=[" << buf << "]";
+	// check whether the pullseq was sent:
+	ASSERT_EQ("/?!\r\n", peer.request());
 
 	// check obis data:
 	ReadingIdentifier *p = rds[2].identifier().get();
@@ -271,9 +335,6 @@ TEST(MeterD0, LandisGyr_basic) {
 	EXPECT_TRUE(Obis(0xff, 0xff, 2, 8, 1, 0xff) == (o->obis()));
 
 	EXPECT_EQ(0, m.close());
-
-	EXPECT_EQ(0, close(fd));
-	EXPECT_EQ(0, unlink(tempfilename));
 }
 
 int writes_hex(int fd, const char *str) {
@@ -293,20 +354,16 @@ int writes_hex(int fd, const char *str) {
 }
 
 TEST(MeterD0, ACE3000_basic) {
-	char tempfilename[L_tmpnam + 1];
+	D0Peer peer;
 	char str_pullseq[12] = "2f3f210d0a";
-	ASSERT_NE(tmpnam(tempfilename), (char *)0);
 	std::list<Option> options;
-	options.push_back(Option("device", tempfilename));
+	options.push_back(Option("host", peer.host()));
 	options.push_back(Option("pullseq", str_pullseq));
 	MeterD0 m(options);
-	ASSERT_STREQ(m.device(), tempfilename) << "devicename not eq " << tempfilename;
-	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
-	int fd = open(tempfilename, O_RDWR);
-	ASSERT_NE(fd, -1);
 	ASSERT_EQ(SUCCESS, m.open());
+	ASSERT_TRUE(peer.accept());
 
-	// now we can simulate some input by simply writing into fd
+	// the peer answers the pull request
 	std::vector<Reading> rds;
 	rds.resize(5);
 
@@ -321,26 +378,20 @@ TEST(MeterD0, ACE3000_basic) {
 	1.8.0(013925.5*)    <-- Summe Zählerstand Energielieferung
 	Y<0x02><0x02><0x01><0x00>!<0x0d><0x0a><0x03>F<0x7f>    <-- Endesequenz and garbage?
 	*/
-	// without splitting the MeterD0::read source/logic (or multithreading) we can't
-	// wait for the pullseq before we put the data. Thus we just put the data in the buffer
-	// and check afterwards whether a pullseq was send as well.
-
-	writes_hex(fd, "7f7f7f7f7f2f3f210d0a2f414345305c336b3236305630312e31390d0a");
-	writes_hex(fd, "02462e46283030290d0a432e31283131323631");
-	writes_hex(fd, "3230303533333232333533290d0a");
-	writes_hex(fd, "432e352e30283030290d0a");                       // C.5.0(00)
-	writes_hex(fd, "312e382e30283031333932352e352a29590202010021"); // 1.8.0(01392.5*) ... !
-	writes_hex(fd, "0d0a03467f"); // (newline and <ETX> <BCC =0x46> garbage...) TODO add BCC check
-								  // (according to DIN 66219 / IEC 1155, if STX/ETX there should be
-								  // BCC as well. BCC = xor all from STX (not incl.) to ETX (incl.))
+	peer.answer(5, unhex("7f7f7f7f7f2f3f210d0a2f414345305c336b3236305630312e31390d0a"
+						 "02462e46283030290d0a432e31283131323631"
+						 "3230303533333232333533290d0a"
+						 "432e352e30283030290d0a"                       // C.5.0(00)
+						 "312e382e30283031333932352e352a29590202010021" // 1.8.0(01392.5*) ... !
+						 // (newline and <ETX> <BCC =0x46> garbage...) TODO add BCC check
+						 // (according to DIN 66219 / IEC 1155, if STX/ETX there should be
+						 // BCC as well. BCC = xor all from STX (not incl.) to ETX (incl.))
+						 "0d0a03467f"));
 
 	// now perform one read call:
 	EXPECT_EQ(4, m.read(rds, 4));
-	// check whether garbage (after !) and pullseq is remaining in the fifo:
-	// will be ignored on next read call TODO add check
-	char buf[100];
-	ssize_t len = read(fd, buf, sizeof(buf));
-	ASSERT_EQ((ssize_t)strlen("\x0d\x0a\x03\x46\x7f/?!\r\n"), len) << "buf=[" << buf << "]";
+	// the garbage after ! is dropped with the next pull request. Check the one sent:
+	ASSERT_EQ("/?!\r\n", peer.request());
 
 	// check obis data:
 	ReadingIdentifier *p = rds[3].identifier().get();
@@ -363,9 +414,37 @@ TEST(MeterD0, ACE3000_basic) {
 	EXPECT_TRUE(Obis(0xff, 0xff, 97, 97, 0xff, 0xff) == (o->obis()));
 
 	EXPECT_EQ(0, m.close());
+}
 
-	EXPECT_EQ(0, close(fd));
-	EXPECT_EQ(0, unlink(tempfilename));
+static std::string eHZ_telegram(const char *value) {
+	return std::string("/HAG5eHZ010C_EHZ1vA02\r\n1-0:1.8.0*255(") + value + ")\r\n!\r\n";
+}
+
+TEST(MeterD0, pull_drops_stale_input) {
+	D0Peer peer;
+	std::list<Option> options;
+	options.push_back(Option("host", peer.host()));
+	options.push_back(Option("pullseq", (char *)"2f3f210d0a"));
+	MeterD0 m(options);
+	ASSERT_EQ(SUCCESS, m.open());
+	ASSERT_TRUE(peer.accept());
+	std::vector<Reading> rds;
+	rds.resize(10);
+
+	// a second telegram behind the answer is read with it into the read buffer
+	peer.answer(5, eHZ_telegram("000001.0000") + eHZ_telegram("000009.0000"));
+	ASSERT_EQ(1, m.read(rds, 10));
+	EXPECT_DOUBLE_EQ(1.0, rds[0].value());
+	EXPECT_EQ("/?!\r\n", peer.request());
+
+	// neither that nor input arriving between two requests is taken as the next answer
+	peer.send(eHZ_telegram("000008.0000"));
+	peer.answer(5, eHZ_telegram("000002.0000"));
+	ASSERT_EQ(1, m.read(rds, 10));
+	EXPECT_DOUBLE_EQ(2.0, rds[0].value());
+	EXPECT_EQ("/?!\r\n", peer.request());
+
+	EXPECT_EQ(0, m.close());
 }
 
 TEST(MeterD0, SLB_DC3_basic) {
@@ -404,6 +483,35 @@ baudrate=4, identification=\@DC341TMPBF2ZAK) [Dec 23 11:59:11][d0]   Sending ack
 	ASSERT_EQ(Obis("1.8.0*1"), Obis(255, 255, 1, 8, 0, 1));
 }
 
+static const char *LuG_E350_telegram[] = {
+	"2f4c475a345a4d4631303041432e4d32370a0a", //  /LGZ4ZMF100AC.M27
+	"02462e46283030290a0a302e30282020",       //    F.F(00)  0.0(
+	"2020202020203138343338363336290a",       //         18438636)
+	"0a432e312e3028313834333836333629",       //    C.1.0(18438636)
+	"0a0a432e312e31282020202020202020",       //     C.1.1(
+	"290a0a312e382e31283030303030302e",       //   )  1.8.1(000000.
+	"3030302a6b5768290a0a312e382e3228",       //   000*kWh)  1.8.2(
+	"3030303231392e3235312a6b5768290a",       //   000219.251*kWh)
+	"0a322e382e31283030303030302e3030",       //    2.8.1(000000.00
+	"302a6b5768290a0a322e382e32283030",       //   0*kWh)  2.8.2(00
+	"303030302e3030302a6b5768290a0a31",       //   0000.000*kWh)  1
+	"2e382e30283030303231392e3235322a",       //   .8.0(000219.252*
+	"6b5768290a0a322e382e302830303030",       //   kWh)  2.8.0(0000
+	"30302e3030302a6b5768290a0a31352e",       //   00.000*kWh)  15.
+	"382e30283030303231392e3235322a6b",       //   8.0(000219.252*k
+	"5768290a0a432e372e30283030303429",       //   Wh)  C.7.0(0004)
+	"0a0a33322e37283233332a56290a0a35",       //     32.7(233*V)  5
+	"322e37283233332a56290a0a37322e37",       //   2.7(233*V)  72.7
+	"283233342a56290a0a33312e37283030",       //   (234*V)  31.7(00
+	"322e33302a41290a0a35312e37283030",       //   2.30*A)  51.7(00
+	"322e33322a41290a0a37312e37283030",       //   2.32*A)  71.7(00
+	"322e39372a41290a0a31362e37283030",       //   2.97*A)  16.7(00
+	"312e36362a6b57290a0a38322e382e31",       //   1.66*kW)  82.8.1
+	"2830303030290a0a38322e382e322830",       //   (0000)  82.8.2(0
+	"303030290a0a302e322e30284d323729",       //   000)  0.2.0(M27)
+	"0a0a432e352e302831343230290a0a21",       //     C.5.0(1420)  !
+};
+
 TEST(MeterD0, LuG_E350) {
 	char tempfilename[L_tmpnam + 1];
 	ASSERT_NE(tmpnam(tempfilename), (char *)0);
@@ -425,32 +533,8 @@ TEST(MeterD0, LuG_E350) {
 	// wait for the pullseq before we put the data. Thus we just put the data in the buffer
 	// and check afterwards whether a pullseq was send as well.
 
-	writes_hex(fd, "2f4c475a345a4d4631303041432e4d32370a0a"); //  /LGZ4ZMF100AC.M27
-	writes_hex(fd, "02462e46283030290a0a302e30282020");       //    F.F(00)  0.0(
-	writes_hex(fd, "2020202020203138343338363336290a");       //         18438636)
-	writes_hex(fd, "0a432e312e3028313834333836333629");       //    C.1.0(18438636)
-	writes_hex(fd, "0a0a432e312e31282020202020202020");       //     C.1.1(
-	writes_hex(fd, "290a0a312e382e31283030303030302e");       //   )  1.8.1(000000.
-	writes_hex(fd, "3030302a6b5768290a0a312e382e3228");       //   000*kWh)  1.8.2(
-	writes_hex(fd, "3030303231392e3235312a6b5768290a");       //   000219.251*kWh)
-	writes_hex(fd, "0a322e382e31283030303030302e3030");       //    2.8.1(000000.00
-	writes_hex(fd, "302a6b5768290a0a322e382e32283030");       //   0*kWh)  2.8.2(00
-	writes_hex(fd, "303030302e3030302a6b5768290a0a31");       //   0000.000*kWh)  1
-	writes_hex(fd, "2e382e30283030303231392e3235322a");       //   .8.0(000219.252*
-	writes_hex(fd, "6b5768290a0a322e382e302830303030");       //   kWh)  2.8.0(0000
-	writes_hex(fd, "30302e3030302a6b5768290a0a31352e");       //   00.000*kWh)  15.
-	writes_hex(fd, "382e30283030303231392e3235322a6b");       //   8.0(000219.252*k
-	writes_hex(fd, "5768290a0a432e372e30283030303429");       //   Wh)  C.7.0(0004)
-	writes_hex(fd, "0a0a33322e37283233332a56290a0a35");       //     32.7(233*V)  5
-	writes_hex(fd, "322e37283233332a56290a0a37322e37");       //   2.7(233*V)  72.7
-	writes_hex(fd, "283233342a56290a0a33312e37283030");       //   (234*V)  31.7(00
-	writes_hex(fd, "322e33302a41290a0a35312e37283030");       //   2.30*A)  51.7(00
-	writes_hex(fd, "322e33322a41290a0a37312e37283030");       //   2.32*A)  71.7(00
-	writes_hex(fd, "322e39372a41290a0a31362e37283030");       //   2.97*A)  16.7(00
-	writes_hex(fd, "312e36362a6b57290a0a38322e382e31");       //   1.66*kW)  82.8.1
-	writes_hex(fd, "2830303030290a0a38322e382e322830");       //   (0000)  82.8.2(0
-	writes_hex(fd, "303030290a0a302e322e30284d323729");       //   000)  0.2.0(M27)
-	writes_hex(fd, "0a0a432e352e302831343230290a0a21");       //     C.5.0(1420)  !
+	for (const char *hex : LuG_E350_telegram)
+		writes_hex(fd, hex);
 
 	// now perform one read call:
 	EXPECT_EQ(23, m.read(rds, 23));
@@ -468,3 +552,81 @@ TEST(MeterD0, LuG_E350) {
 	EXPECT_EQ(0, close(fd));
 	EXPECT_EQ(0, unlink(tempfilename));
 }
+
+TEST(MeterD0, obis_cache) {
+	char tempfilename[L_tmpnam + 1];
+	ASSERT_NE(tmpnam(tempfilename), (char *)0);
+	std::list<Option> options;
+	options.push_back(Option("device", tempfilename));
+	MeterD0 m(options);
+	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
+	int fd = open(tempfilename, O_RDWR);
+	ASSERT_NE(fd, -1);
+	ASSERT_EQ(SUCCESS, m.open());
+
+	std::vector<Reading> rds;
+	rds.resize(10);
+	for (int i = 0; i < 2; i++) {
+		writes(fd, "/HAG5eHZ010C_EHZ1vA02\r\n");
+		writes(fd, "1-0:1.8.0*255(000001.2963)\r\n");
+		writes(fd, "1-0:2.8.0*255(000002.0000)\r\n");
+		writes(fd, "!\n");
+	}
+	ASSERT_EQ(2, m.read(rds, 10));
+	const ReadingIdentifier *first = rds[0].identifier().get();
+	ASSERT_EQ(2, m.read(rds, 10));
+	EXPECT_EQ(first, rds[0].identifier().get()); // parsed once, shared
+	EXPECT_NE(first, rds[1].identifier().get());
+	EXPECT_DOUBLE_EQ(2.0, rds[1].value());
+	ObisIdentifier *o = dynamic_cast<ObisIdentifier *>(rds[1].identifier().get());
+	ASSERT_NE((ObisIdentifier *)0, o);
+	EXPECT_TRUE(Obis(1, 0, 2, 8, 0, 255) == (o->obis()));
+
+	EXPECT_EQ(0, m.close());
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ(0, unlink(tempfilename));
+}
+
+// replays a recorded telegram many times and reports how long parsing takes. The writer thread
+// fills the fifo as fast as possible, so this measures the input path and the state machine.
+TEST(MeterD0, benchmark_replay) {
+	const int TELEGRAMS = 2000;
+	char tempfilename[L_tmpnam + 1];
+	ASSERT_NE(tmpnam(tempfilename), (char *)0);
+	std::list<Option> options;
+	options.push_back(Option("device", tempfilename));
+	MeterD0 m(options);
+	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
+	int fd = open(tempfilename, O_RDWR);
+	ASSERT_NE(fd, -1);
+	ASSERT_EQ(SUCCESS, m.open());
+
+	std::string telegram;
+	for (const char *hex : LuG_E350_telegram)
+		telegram += unhex(hex);
+	std::thread writer([&]() {
+		for (int i = 0; i < TELEGRAMS; i++)
+			if (write(fd, telegram.data(), telegram.size()) != (ssize_t)telegram.size())
+				break;
+	});
+
+	std::vector<Reading> rds;
+	rds.resize(25);
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int good = 0;
+	for (int i = 0; i < TELEGRAMS; i++)
+		if (m.read(rds, 23) == 23)
+			good++;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	writer.join();
+	EXPECT_EQ(TELEGRAMS, good);
+
+	const double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+	fprintf(stdout, "  %d telegrams (%zu bytes each) in %.1f ms, %.1f us per telegram\n",
+			TELEGRAMS, telegram.size(), ms, ms * 1e3 / TELEGRAMS);
+
+	EXPECT_EQ(0, m.close());
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ(0, unlink(tempfilename));
+}
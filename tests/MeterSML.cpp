@@ -1,6 +1,7 @@
 #include <cmath>
 #include <fcntl.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "gtest/gtest.h"
 #include <Options.hpp>
@@ -161,3 +162,53 @@ TEST(MeterSML, EMH_basic) {
 	EXPECT_EQ(0, close(fd));
 	EXPECT_EQ(0, unlink(tempfilename));
 }
+
+TEST(MeterSML, EMH_burst) {
+	char tempfilename[L_tmpnam + 1];
+	ASSERT_NE(tmpnam(tempfilename), (char *)0);
+	std::list<Option> options;
+	options.push_back(Option("device", tempfilename));
+	MeterSML m(options);
+	ASSERT_EQ(0, mkfifo(tempfilename, S_IRUSR | S_IWUSR));
+	int fd = open(tempfilename, O_RDWR);
+	ASSERT_NE(-1, fd);
+	ASSERT_NE(-1, m.open());
+
+	std::vector<Reading> rds;
+	rds.resize(10);
+
+	// a gateway sends two frames at once and the beginning of a third one
+	const char *frame =
+		"1B1B1B1B010101017607003600001AFA6200620072630101760101070036044808FE093032323830383136"
+		"01016331ED007607003600001AFB62006200726307017701093032323830383136017262016504487D8976"
+		"77078181C78203FF0101010104454D480177070100000000FF010101010930323238303831360177070100"
+		"010801FF63018001621E52FF560008D1CF1B0177070100010802FF63018001621E52FF560000004E9C0177"
+		"0700006001FFFF010101010B303030323238303831360177070100010700FF0101621B52FF550000007001"
+		"010163D201007607003600001AFC6200620072630201710163077A00001B1B1B1B1A019D37";
+	writes_hex(fd, frame);
+	writes_hex(fd, frame);
+	writes_hex(fd, "1B1B1B1B01010101760700");
+
+	EXPECT_EQ(6, m.read(rds, 10));
+	EXPECT_EQ(2012.4, rds[4].value());
+	EXPECT_EQ(rds[0].time_ms(), rds[2].time_ms()); // local time, the same within a frame
+	EXPECT_EQ(rds[3].time_ms(), rds[5].time_ms());
+	EXPECT_EQ(rds[0].identifier().get(), rds[3].identifier().get()); // shared identifier
+
+	// the rest of the third frame completes it
+	writes_hex(fd, std::string(frame).substr(22).c_str());
+	EXPECT_EQ(3, m.read(rds, 10));
+	EXPECT_EQ(2012.4, rds[1].value());
+
+	// a frame that doesn't fit completely any more stays buffered for the next read
+	writes_hex(fd, frame);
+	writes_hex(fd, frame);
+	EXPECT_EQ(3, m.read(rds, 4));
+	EXPECT_EQ(3, m.read(rds, 10));
+	EXPECT_EQ(2012.4, rds[1].value());
+	EXPECT_LE(fabs(11.2 - rds[2].value()), 0.1);
+
+	EXPECT_EQ(0, m.close());
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ(0, unlink(tempfilename));
+}
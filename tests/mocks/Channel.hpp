@@ -18,6 +18,7 @@ class Channel {
 	MOCK_METHOD0(join, void());
 	MOCK_METHOD0(cancel, void());
 	MOCK_METHOD0(name, const char *());
+	MOCK_CONST_METHOD0(index, int());
 	MOCK_METHOD0(options, std::list<Option> &());
 	MOCK_METHOD0(apiProtocol, const std::string());
 	MOCK_METHOD0(buffer, Buffer::Ptr());
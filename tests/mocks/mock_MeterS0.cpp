@@ -28,6 +28,31 @@ class mock_S0hwif : public MeterS0::HWIF {
   protected:
 };
 
+// HWIF with timestamped edge events like HWIF_GPIOCDEV
+class mock_S0hwif_events : public mock_S0hwif {
+  public:
+	MOCK_METHOD2(waitForImpulses, int(struct timespec *, int));
+	MOCK_CONST_METHOD0(has_timestamps, bool());
+	MOCK_CONST_METHOD0(is_debounced, bool());
+};
+
+// a batch of impulses 0, 5, 100 and 200 ms after the call, then timeouts once done is set
+static int impulse_batch(bool &done, struct timespec *ts, int max) {
+	static const unsigned long ms[] = {0, 5, 100, 200};
+	struct timespec now;
+	if (done || max < 4) {
+		usleep(10000);
+		return 0;
+	}
+	done = true;
+	clock_gettime(CLOCK_REALTIME, &now);
+	for (int i = 0; i < 4; i++) {
+		ts[i] = now;
+		timespec_add_ms(ts[i], ms[i]);
+	}
+	return 4;
+}
+
 TEST(mock_MeterS0, timespec_add_ms) {
 	struct timespec a;
 	a.tv_sec = 1;
@@ -176,6 +201,31 @@ TEST(mock_MeterS0, basic_blocking_send_zero_2reads) {
 	m.close(); // this might be called and should not cause problems
 }
 
+TEST(mock_MeterS0, events_software_debounce) {
+	bool done = false; // per run, outlives m and its counter thread
+	mock_S0hwif_events *hwif = new mock_S0hwif_events();
+	std::list<Option> opt;
+	opt.push_back(Option("send_zero", true));
+
+	EXPECT_CALL(*hwif, _open()).Times(1).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, _close()).Times(1).WillOnce(Return(true));
+	EXPECT_CALL(*hwif, is_blocking()).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, status()).WillRepeatedly(Return(0));
+	EXPECT_CALL(*hwif, has_timestamps()).WillRepeatedly(Return(true));
+	EXPECT_CALL(*hwif, is_debounced()).WillRepeatedly(Return(false));
+	EXPECT_CALL(*hwif, waitForImpulse(_)).Times(0);
+	EXPECT_CALL(*hwif, waitForImpulses(_, _))
+		.WillRepeatedly(Invoke([&done](struct timespec *ts, int max) {
+			return impulse_batch(done, ts, max);
+		}));
+	MeterS0 m(opt, hwif);
+	ASSERT_EQ(SUCCESS, m.open());
+	std::vector<Reading> rds(4);
+	ASSERT_EQ(m.read(rds, 4), 2); // no Powers for first impulse
+	EXPECT_EQ(3, rds[0].value()); // the edge 5ms after the first one is a bounce
+	m.close();
+}
+
 /* time out -> endless waiting for first impulse
 TEST(mock_MeterS0, basic_non_blocking_read_no_send_zero)
 {
@@ -0,0 +1,211 @@
+#include "Cbor.hpp"
+#include "gtest/gtest.h"
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+// reference decoder for the subset of CBOR written by CborWriter:
+// unsigned/negative integers, text strings, arrays, maps, float32 and float64
+struct CborValue {
+	enum Type { INT, TEXT, ARRAY, MAP, FLOAT32, FLOAT64 } type;
+	int64_t i;
+	double d;
+	std::string s;
+	std::vector<CborValue> items;              // array
+	std::map<std::string, CborValue> entries; // map, only text keys
+
+	const CborValue &operator[](const char *key) const { return entries.at(key); }
+	const CborValue &operator[](int idx) const { return items.at(idx); }
+};
+
+class CborReader {
+  public:
+	CborReader(const std::string &in) : _in(in), _pos(0) {}
+	bool done() const { return _pos == _in.size(); }
+
+	CborValue read() {
+		CborValue v;
+		uint8_t ib = byte();
+		uint8_t major = ib >> 5, info = ib & 0x1f;
+		if (major == 7) {
+			if (info == 26) {
+				uint32_t bits = (uint32_t)be(4);
+				float f;
+				memcpy(&f, &bits, sizeof(f));
+				v.type = CborValue::FLOAT32;
+				v.d = f;
+			} else if (info == 27) {
+				uint64_t bits = be(8);
+				v.type = CborValue::FLOAT64;
+				memcpy(&v.d, &bits, sizeof(v.d));
+			} else
+				throw std::runtime_error("unsupported simple value");
+			return v;
+		}
+		uint64_t arg = info < 24 ? info : be(1 << (info - 24));
+		switch (major) {
+		case 0:
+			v.type = CborValue::INT;
+			v.i = (int64_t)arg;
+			break;
+		case 1:
+			v.type = CborValue::INT;
+			v.i = -1 - (int64_t)arg;
+			break;
+		case 3:
+			v.type = CborValue::TEXT;
+			if (_pos + arg > _in.size())
+				throw std::runtime_error("truncated");
+			v.s = _in.substr(_pos, arg);
+			_pos += arg;
+			break;
+		case 4:
+			v.type = CborValue::ARRAY;
+			for (uint64_t n = 0; n < arg; n++)
+				v.items.push_back(read());
+			break;
+		case 5:
+			v.type = CborValue::MAP;
+			for (uint64_t n = 0; n < arg; n++) {
+				CborValue key = read();
+				if (key.type != CborValue::TEXT)
+					throw std::runtime_error("non text key");
+				v.entries[key.s] = read();
+			}
+			break;
+		default:
+			throw std::runtime_error("unsupported major type");
+		}
+		return v;
+	}
+
+  private:
+	uint8_t byte() {
+		if (_pos >= _in.size())
+			throw std::runtime_error("truncated");
+		return (uint8_t)_in[_pos++];
+	}
+	uint64_t be(int bytes) {
+		uint64_t v = 0;
+		while (bytes--)
+			v = (v << 8) | byte();
+		return v;
+	}
+
+	const std::string &_in;
+	size_t _pos;
+};
+
+static CborValue decode(const std::string &data) {
+	CborReader r(data);
+	CborValue v = r.read();
+	EXPECT_TRUE(r.done());
+	return v;
+}
+
+TEST(Cbor, integer_encoding) {
+	struct {
+		int64_t v;
+		size_t len;
+	} cases[] = {{0, 1},      {23, 1},           {24, 2},           {255, 2},
+				 {256, 3},    {65535, 3},        {65536, 5},        {4294967295LL, 5},
+				 {-1, 1},     {-24, 1},          {-25, 2},          {-256, 2},
+				 {-257, 3},   {4294967296LL, 9}, {INT64_MAX, 9},    {INT64_MIN, 9}};
+	for (auto &c : cases) {
+		std::string out;
+		CborWriter w(out);
+		w.integer(c.v);
+		EXPECT_EQ(c.len, out.size());
+		CborValue v = decode(out);
+		EXPECT_EQ(CborValue::INT, v.type);
+		EXPECT_EQ(c.v, v.i);
+	}
+	std::string out;
+	CborWriter w(out);
+	w.integer(500);
+	EXPECT_EQ(std::string("\x19\x01\xf4", 3), out); // RFC 8949 appendix A
+}
+
+TEST(Cbor, float_selection) {
+	std::string out;
+	CborWriter w(out);
+	w.number(1.5); // exact as float32
+	EXPECT_EQ(std::string("\xfa\x3f\xc0\x00\x00", 5), out);
+
+	out.clear();
+	w.number(1.1); // not exact, keeps full precision
+	EXPECT_EQ(9u, out.size());
+	CborValue v = decode(out);
+	EXPECT_EQ(CborValue::FLOAT64, v.type);
+	EXPECT_EQ(1.1, v.d);
+
+	out.clear();
+	w.number(NAN);
+	v = decode(out);
+	EXPECT_EQ(CborValue::FLOAT32, v.type);
+	EXPECT_TRUE(std::isnan(v.d));
+
+	out.clear();
+	CborWriter w32(out, true);
+	w32.number(1.1); // forced float32
+	v = decode(out);
+	EXPECT_EQ(CborValue::FLOAT32, v.type);
+	EXPECT_FLOAT_EQ(1.1f, (float)v.d);
+}
+
+TEST(Cbor, strings_and_containers) {
+	std::string out;
+	CborWriter w(out);
+	std::string longName(300, 'x');
+	w.map(2);
+	w.string("name");
+	w.string(longName);
+	w.string("list");
+	w.array(3);
+	w.integer(1);
+	w.string("", 0);
+	w.number(-2.0);
+	CborValue v = decode(out);
+	ASSERT_EQ(CborValue::MAP, v.type);
+	EXPECT_EQ(longName, v["name"].s);
+	ASSERT_EQ(3u, v["list"].items.size());
+	EXPECT_EQ(1, v["list"][0].i);
+	EXPECT_EQ("", v["list"][1].s);
+	EXPECT_EQ(-2.0, v["list"][2].d);
+}
+
+TEST(Cbor, tuples_as_deltas) {
+	std::vector<std::pair<int64_t, double>> tuples;
+	tuples.push_back(std::make_pair(1700000000000LL, 1.0));
+	tuples.push_back(std::make_pair(1700000001000LL, 2.25));
+	tuples.push_back(std::make_pair(1700000000500LL, 0.1)); // out of order gives negative delta
+
+	std::string out;
+	CborWriter w(out);
+	w.map(2);
+	w.tuples(tuples.begin(), tuples.end(), tuples.size());
+	CborValue v = decode(out);
+	const CborValue &t = v["t"];
+	const CborValue &val = v["v"];
+	ASSERT_EQ(3u, t.items.size());
+	ASSERT_EQ(3u, val.items.size());
+	EXPECT_EQ(1700000000000LL, t[0].i);
+	EXPECT_EQ(1000, t[1].i);
+	EXPECT_EQ(-500, t[2].i);
+	int64_t time = 0;
+	for (size_t i = 0; i < tuples.size(); i++) {
+		time += t[i].i;
+		EXPECT_EQ(tuples[i].first, time);
+		EXPECT_EQ(tuples[i].second, val[i].d);
+	}
+
+	out.clear();
+	CborWriter empty(out);
+	empty.map(2);
+	empty.tuples(tuples.begin(), tuples.begin(), 0);
+	v = decode(out);
+	EXPECT_EQ(0u, v["t"].items.size());
+	EXPECT_EQ(0u, v["v"].items.size());
+}
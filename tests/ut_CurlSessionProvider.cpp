@@ -1,6 +1,9 @@
 #include "gtest/gtest.h"
 
 #include "CurlSessionProvider.hpp"
+#include <atomic>
+#include <thread>
+#include <unistd.h>
 
 TEST(CurlSessionProvider, init) {
 	ASSERT_EQ(0, curlSessionProvider);
@@ -32,6 +35,68 @@ TEST(CurlSessionProvider, single1) {
 
 	delete curlSessionProvider;
 	curlSessionProvider = 0;
+}
+
+TEST(CurlSessionProvider, pool) {
+	curlSessionProvider = new CurlSessionProvider(2, 120, false);
+
+	CURL *eh1 = curlSessionProvider->get_easy_session("1");
+	CURL *eh2 = curlSessionProvider->get_easy_session("1");
+	ASSERT_TRUE(0 != eh1);
+	ASSERT_TRUE(0 != eh2);
+	ASSERT_TRUE(eh1 != eh2);
+	// pool exhausted:
+	ASSERT_EQ(0, curlSessionProvider->get_easy_session("1", 1));
+	// other keys have their own pool:
+	CURL *eh3 = curlSessionProvider->get_easy_session("2");
+	ASSERT_TRUE(0 != eh3);
+	curlSessionProvider->return_session("2", eh3);
+
+	CURL *eh = eh1;
+	curlSessionProvider->return_session("1", eh1);
+	ASSERT_TRUE(curlSessionProvider->inUse("1"));
+	CURL *eh4 = curlSessionProvider->get_easy_session("1", 1);
+	ASSERT_EQ(eh, eh4); // the idle handle is reused
+	curlSessionProvider->return_session("1", eh4);
+	curlSessionProvider->return_session("1", eh2);
+	ASSERT_FALSE(curlSessionProvider->inUse("1"));
+
+	delete curlSessionProvider;
+	curlSessionProvider = 0;
+}
+
+TEST(CurlSessionProvider, blocking) {
+	curlSessionProvider = new CurlSessionProvider(1, 120, false);
+
+	CURL *eh = curlSessionProvider->get_easy_session("1");
+	ASSERT_TRUE(0 != eh);
+	std::atomic<bool> got(false);
+	std::thread t([&got]() {
+		CURL *eh2 = curlSessionProvider->get_easy_session("1");
+		got = true;
+		curlSessionProvider->return_session("1", eh2);
+	});
+	usleep(200000);
+	EXPECT_FALSE(got); // no ASSERT with t still joinable
+	curlSessionProvider->return_session("1", eh);
+	t.join();
+	ASSERT_TRUE(got);
+	ASSERT_FALSE(curlSessionProvider->inUse("1"));
+
+	delete curlSessionProvider;
+	curlSessionProvider = 0;
+}
 
-	// TODO create that that's spanws a thread and tests blocking on a shared session
+TEST(CurlSessionProvider, prewarm_unreachable) {
+	curlSessionProvider = new CurlSessionProvider(1, 120, true);
+
+	// nothing listens there. the prewarm fails silently and the session is usable afterwards
+	curlSessionProvider->prewarm("1", "http://127.0.0.1:45432/");
+	curlSessionProvider->prewarm("1", "http://127.0.0.1:45432/"); // ignored
+	CURL *eh = curlSessionProvider->get_easy_session("1", 5);
+	ASSERT_TRUE(0 != eh);
+	curlSessionProvider->return_session("1", eh);
+
+	delete curlSessionProvider;
+	curlSessionProvider = 0;
 }
@@ -0,0 +1,169 @@
+#include <LocalBuffer.hpp>
+#include <climits>
+#include <cstring>
+
+#include "gtest/gtest.h"
+
+static std::vector<ChannelData> all(const LocalBuffer &l, size_t limit = 0) {
+	std::vector<ChannelData> out;
+	l.range(INT64_MIN, INT64_MAX, limit, out);
+	return out;
+}
+
+TEST(LocalBuffer, fixed_capacity) {
+	LocalBuffer l(3, true);
+	for (int i = 1; i <= 5; i++)
+		l.add(i * 1000, i);
+	EXPECT_EQ(3u, l.size());
+	EXPECT_EQ(3u, l.capacity());
+	std::vector<ChannelData> out = all(l);
+	ASSERT_EQ(3u, out.size());
+	EXPECT_EQ(3000, out[0]._t);
+	EXPECT_EQ(5000, out[2]._t);
+	EXPECT_DOUBLE_EQ(5, out[2]._v);
+}
+
+TEST(LocalBuffer, grow_and_expire) {
+	LocalBuffer l(2, false);
+	for (int i = 1; i <= 10; i++)
+		l.add(i * 1000, i);
+	EXPECT_EQ(10u, l.size());
+	EXPECT_GE(l.capacity(), 10u);
+
+	l.expire(7000);
+	std::vector<ChannelData> out = all(l);
+	ASSERT_EQ(4u, out.size());
+	EXPECT_EQ(7000, out[0]._t);
+
+	l.add(11000, 11); // wraps around
+	l.expire(20000);
+	EXPECT_EQ(0u, l.size());
+	EXPECT_EQ(0u, all(l).size());
+}
+
+TEST(LocalBuffer, out_of_order) {
+	LocalBuffer l(4, true);
+	l.add(1000, 1);
+	l.add(3000, 3);
+	l.add(2000, 2);
+	l.add(4000, 4);
+	l.add(500, 0); // drops the oldest, then is the oldest itself
+	std::vector<ChannelData> out = all(l);
+	ASSERT_EQ(4u, out.size());
+	EXPECT_EQ(500, out[0]._t);
+	EXPECT_EQ(2000, out[1]._t);
+	EXPECT_EQ(3000, out[2]._t);
+	EXPECT_EQ(4000, out[3]._t);
+}
+
+TEST(LocalBuffer, range) {
+	LocalBuffer l(100, true);
+	for (int i = 0; i < 100; i++)
+		l.add(i * 1000, i);
+
+	std::vector<ChannelData> out;
+	EXPECT_EQ(11u, l.range(10000, 20000, 0, out));
+	EXPECT_EQ(10000, out.front()._t);
+	EXPECT_EQ(20000, out.back()._t);
+
+	out.clear();
+	EXPECT_EQ(10u, l.range(10500, 20500, 0, out));
+	EXPECT_EQ(11000, out.front()._t);
+
+	out.clear();
+	EXPECT_EQ(3u, l.range(10000, 20000, 3, out)); // the newest ones
+	EXPECT_EQ(18000, out.front()._t);
+	EXPECT_EQ(20000, out.back()._t);
+
+	out.clear();
+	EXPECT_EQ(0u, l.range(200000, INT64_MAX, 0, out));
+	EXPECT_EQ(0u, l.range(5000, 4000, 0, out));
+	EXPECT_EQ(1u, all(l, 1).size());
+}
+
+static std::vector<ChannelData> saw(int n) {
+	std::vector<ChannelData> in;
+	for (int i = 0; i < n; i++)
+		in.push_back(ChannelData(i * 1000, i % 10));
+	return in;
+}
+
+TEST(LocalBuffer, downsample_small) {
+	std::vector<ChannelData> in = saw(5), out;
+	downsample(in, 10, DOWNSAMPLE_LTTB, out);
+	EXPECT_EQ(5u, out.size());
+	out.clear();
+	downsample(in, 0, DOWNSAMPLE_AVG, out);
+	EXPECT_EQ(5u, out.size());
+}
+
+TEST(LocalBuffer, downsample_lttb) {
+	std::vector<ChannelData> in = saw(1000), out;
+	in[500]._v = 100; // a spike is kept
+	downsample(in, 50, DOWNSAMPLE_LTTB, out);
+	ASSERT_EQ(50u, out.size());
+	EXPECT_EQ(0, out.front()._t);
+	EXPECT_EQ(999000, out.back()._t);
+	bool spike = false;
+	for (size_t i = 0; i < out.size(); i++) {
+		if (i)
+			EXPECT_LT(out[i - 1]._t, out[i]._t);
+		spike |= out[i]._v == 100;
+	}
+	EXPECT_TRUE(spike);
+}
+
+TEST(LocalBuffer, downsample_minmax) {
+	std::vector<ChannelData> in = saw(100), out;
+	downsample(in, 20, DOWNSAMPLE_MINMAX, out);
+	ASSERT_EQ(20u, out.size()); // 10 buckets of 10 tuples
+	EXPECT_DOUBLE_EQ(0, out[0]._v);
+	EXPECT_DOUBLE_EQ(9, out[1]._v);
+	EXPECT_EQ(90000, out[18]._t);
+	EXPECT_EQ(99000, out[19]._t);
+}
+
+TEST(LocalBuffer, downsample_avg) {
+	std::vector<ChannelData> in = saw(100), out;
+	downsample(in, 10, DOWNSAMPLE_AVG, out);
+	ASSERT_EQ(10u, out.size());
+	EXPECT_EQ(4500, out[0]._t);
+	EXPECT_DOUBLE_EQ(4.5, out[0]._v);
+	EXPECT_EQ(94500, out[9]._t);
+}
+
+TEST(LocalBuffer, version) {
+	LocalBuffer l(10, false);
+	const uint64_t v0 = l.version();
+	l.add(1000, 1);
+	const uint64_t v1 = l.version();
+	EXPECT_NE(v0, v1);
+	EXPECT_EQ(0u, l.expire(500));
+	EXPECT_EQ(v1, l.version());
+	EXPECT_EQ(1u, l.expire(2000));
+	EXPECT_NE(v1, l.version());
+}
+
+TEST(LocalBuffer, columns) {
+	LocalBuffer l(10, true);
+	for (int i = 0; i < 10; i++)
+		l.add(i * 1000, i / 2.0);
+	EXPECT_EQ(5u, l.count(5000, INT64_MAX, 0));
+	EXPECT_EQ(2u, l.count(5000, INT64_MAX, 2));
+
+	char buf[16 * 4];
+	memset(buf, 0, sizeof(buf));
+	ASSERT_EQ(3u, l.columns(5000, 7000, 0, buf, 4));
+	int64_t t[3];
+	double v[3];
+	memcpy(t, buf, sizeof(t)); // the tests run on little endian hosts
+	memcpy(v, buf + sizeof(t), sizeof(v));
+	EXPECT_EQ(5000, t[0]);
+	EXPECT_EQ(7000, t[2]);
+	EXPECT_DOUBLE_EQ(2.5, v[0]);
+	EXPECT_DOUBLE_EQ(3.5, v[2]);
+
+	ASSERT_EQ(2u, l.columns(5000, 7000, 0, buf, 2)); // the newest ones
+	memcpy(t, buf, 16);
+	EXPECT_EQ(6000, t[0]);
+}
@@ -0,0 +1,135 @@
+#include "gtest/gtest.h"
+#include <json-c/json.h>
+
+#include "Options.hpp"
+#include "protocols/MeterMQTT.hpp"
+
+// feeds messages directly, no broker needed
+class MeterMQTTTest : public MeterMQTT {
+  public:
+	MeterMQTTTest(std::list<Option> options) : MeterMQTT(options) {}
+	size_t handle(const char *topic, const char *payload) {
+		return MeterMQTT::handle(topic, payload, strlen(payload));
+	}
+};
+
+static std::string identifier(Reading &r) {
+	StringIdentifier *s = dynamic_cast<StringIdentifier *>(r.identifier().get());
+	return s ? s->string() : std::string("<none>");
+}
+
+static std::list<Option> mqtt_options(const char *map = 0) {
+	std::list<Option> options;
+	options.push_back(Option("topic", "sensors/#"));
+	if (map) {
+		struct json_object *jso = json_tokener_parse(map);
+		options.push_back(Option("map", jso));
+		json_object_put(jso);
+	}
+	return options;
+}
+
+TEST(MeterMQTT, options) {
+	std::list<Option> none;
+	EXPECT_THROW(MeterMQTT m(none), vz::VZException);
+
+	std::list<Option> options;
+	struct json_object *topics = json_tokener_parse("[\"a/+\", \"b/#\"]");
+	options.push_back(Option("topic", topics));
+	json_object_put(topics);
+	MeterMQTT m(options);
+	ASSERT_EQ(2u, m.topics().size());
+	EXPECT_EQ("b/#", m.topics()[1]);
+	EXPECT_FALSE(m.allowInterval());
+}
+
+TEST(MeterMQTT, unmapped_topics) {
+	MeterMQTTTest m(mqtt_options());
+	std::vector<Reading> rds(10);
+
+	EXPECT_EQ(1u, m.handle("sensors/kitchen/temp", " 21.5\n"));
+	EXPECT_EQ(3u, m.handle("sensors/plug", "{\"ENERGY\":{\"Power\":12,\"Total\":1.5},\"on\":true,"
+											"\"name\":\"plug\"}"));
+	EXPECT_EQ(0u, m.handle("sensors/x", "ON"));
+	EXPECT_EQ(0u, m.handle("sensors/x", "{\"broken\":"));
+	EXPECT_EQ(0u, m.handle("sensors/x", ""));
+
+	ASSERT_EQ(4, m.read(rds, 10));
+	EXPECT_EQ("sensors/kitchen/temp", identifier(rds[0]));
+	EXPECT_DOUBLE_EQ(21.5, rds[0].value());
+	EXPECT_EQ("sensors/plug/ENERGY/Power", identifier(rds[1]));
+	EXPECT_DOUBLE_EQ(12, rds[1].value());
+	EXPECT_EQ("sensors/plug/ENERGY/Total", identifier(rds[2]));
+	EXPECT_EQ("sensors/plug/on", identifier(rds[3]));
+	EXPECT_DOUBLE_EQ(1, rds[3].value());
+}
+
+TEST(MeterMQTT, mapped_topics) {
+	MeterMQTTTest m(mqtt_options("{\"sensors/kitchen/temp\": \"kitchen\","
+								 " \"sensors/plug\": {\"ENERGY/Power\": \"p\", \"on\": \"s\"}}"));
+	std::vector<Reading> rds(10);
+
+	EXPECT_EQ(1u, m.handle("sensors/kitchen/temp", "-3"));
+	EXPECT_EQ(2u, m.handle("sensors/plug", "{\"ENERGY\":{\"Power\":12,\"Total\":1.5},\"on\":0}"));
+	EXPECT_EQ(0u, m.handle("sensors/plug", "12")); // only the listed fields
+	ASSERT_EQ(3, m.read(rds, 10));
+	EXPECT_EQ("kitchen", identifier(rds[0]));
+	EXPECT_DOUBLE_EQ(-3, rds[0].value());
+	EXPECT_EQ("p", identifier(rds[1]));
+	EXPECT_EQ("s", identifier(rds[2]));
+
+	std::list<Option> options = mqtt_options("{\"sensors/a\": \"a\"}");
+	options.push_back(Option("unmapped", false));
+	MeterMQTTTest strict(options);
+	EXPECT_EQ(0u, strict.handle("sensors/b", "1"));
+	EXPECT_EQ(1u, strict.handle("sensors/a", "1"));
+}
+
+TEST(MeterMQTT, timestamp_field) {
+	std::list<Option> options = mqtt_options();
+	options.push_back(Option("timeField", "ts"));
+	MeterMQTTTest m(options);
+	std::vector<Reading> rds(10);
+
+	EXPECT_EQ(1u, m.handle("sensors/a", "{\"ts\":1700000000,\"v\":1}"));
+	EXPECT_EQ(1u, m.handle("sensors/a", "{\"ts\":1700000000250,\"v\":2}"));
+	ASSERT_EQ(2, m.read(rds, 10));
+	EXPECT_EQ("sensors/a/v", identifier(rds[0]));
+	EXPECT_EQ(1700000000000LL, rds[0].time_ms());
+	EXPECT_EQ(1700000000250LL, rds[1].time_ms());
+}
+
+TEST(MeterMQTT, queue_limit) {
+	std::list<Option> options = mqtt_options();
+	options.push_back(Option("queueSize", 3));
+	MeterMQTTTest m(options);
+	std::vector<Reading> rds(10);
+
+	for (int i = 0; i < 5; i++)
+		m.handle("sensors/a", std::to_string(i).c_str());
+	EXPECT_EQ(2u, m.dropped());
+	ASSERT_EQ(2, m.read(rds, 2)); // oldest are dropped
+	EXPECT_DOUBLE_EQ(2, rds[0].value());
+	EXPECT_DOUBLE_EQ(3, rds[1].value());
+	ASSERT_EQ(1, m.read(rds, 10));
+	EXPECT_DOUBLE_EQ(4, rds[0].value());
+}
+
+TEST(MeterMQTT, identifier_cache) {
+	MeterMQTTTest m(mqtt_options());
+	std::vector<Reading> rds(2);
+
+	// readings of a topic share the interned identifier
+	m.handle("sensors/a", "1");
+	m.handle("sensors/a", "2");
+	ASSERT_EQ(2, m.read(rds, 2));
+	EXPECT_EQ(rds[0].identifier().get(), rds[1].identifier().get());
+
+	// beyond the cache limit identifiers are created per reading
+	for (int i = 0; i < 2000; i++) {
+		std::string topic = "sensors/" + std::to_string(i);
+		ASSERT_EQ(1u, m.handle(topic.c_str(), "1"));
+		ASSERT_EQ(1, m.read(rds, 1));
+		EXPECT_EQ(topic, identifier(rds[0]));
+	}
+}
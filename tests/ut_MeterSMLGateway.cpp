@@ -0,0 +1,151 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+#include <json-c/json.h>
+
+#include "Options.hpp"
+#include "protocols/MeterSMLGateway.hpp"
+
+// from the EMH test in MeterSML.cpp
+static const char *emh =
+	"1B1B1B1B010101017607003600001AFA6200620072630101760101070036044808FE093032323830383136"
+	"01016331ED007607003600001AFB62006200726307017701093032323830383136017262016504487D8976"
+	"77078181C78203FF0101010104454D480177070100000000FF010101010930323238303831360177070100"
+	"010801FF63018001621E52FF560008D1CF1B0177070100010802FF63018001621E52FF560000004E9C0177"
+	"0700006001FFFF010101010B303030323238303831360177070100010700FF0101621B52FF550000007001"
+	"010163D201007607003600001AFC6200620072630201710163077A00001B1B1B1B1A019D37";
+
+static std::string unhex(const char *hex) {
+	std::string s;
+	for (; hex[0] && hex[1]; hex += 2)
+		s += (char)strtol(std::string(hex, 2).c_str(), NULL, 16);
+	return s;
+}
+
+static std::string identifier(Reading &r) {
+	StringIdentifier *s = dynamic_cast<StringIdentifier *>(r.identifier().get());
+	return s ? s->string() : std::string("<none>");
+}
+
+// a listening socket on a free port of 127.0.0.1
+static int listener(int &port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(sa);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sa, len) < 0 || listen(fd, 1) < 0 ||
+		getsockname(fd, (struct sockaddr *)&sa, &len) < 0)
+		return -1;
+	port = ntohs(sa.sin_port);
+	return fd;
+}
+
+static std::list<Option> gateway_options(const std::string &sources) {
+	std::list<Option> options;
+	struct json_object *jso = json_tokener_parse(sources.c_str());
+	options.push_back(Option("sources", jso));
+	json_object_put(jso);
+	options.push_back(Option("reconnect_delay", 10));
+	return options;
+}
+
+TEST(MeterSMLGateway, options) {
+	std::list<Option> none;
+	EXPECT_THROW(MeterSMLGateway m(none), vz::VZException);
+	EXPECT_THROW(MeterSMLGateway m(gateway_options("[]")), vz::VZException);
+	EXPECT_THROW(MeterSMLGateway m(gateway_options("[\"nohost\"]")), vz::VZException);
+	EXPECT_THROW(MeterSMLGateway m(gateway_options("[{\"id\": \"a/b\", \"host\": \"h:1\"}]")),
+				 vz::VZException);
+	EXPECT_THROW(MeterSMLGateway m(gateway_options("[{\"id\": \"a\"}]")), vz::VZException);
+	EXPECT_THROW(MeterSMLGateway m(gateway_options("[1]")), vz::VZException);
+
+	MeterSMLGateway m(gateway_options("[\"10.0.0.1:8888\", {\"id\": \"b\", \"host\": \"h:1\"}]"));
+	ASSERT_EQ(2u, m.sources());
+	EXPECT_EQ("10.0.0.1:8888", m.source(0));
+	EXPECT_EQ("b", m.source(1));
+	EXPECT_FALSE(m.allowInterval());
+}
+
+TEST(MeterSMLGateway, identifier) {
+	ReadingIdentifier::Ptr rid = reading_id_parse(meter_protocol_smlgateway, "flat1/1-0:1.8.1");
+	StringIdentifier *s = dynamic_cast<StringIdentifier *>(rid.get());
+	ASSERT_TRUE(s != NULL);
+	EXPECT_EQ("flat1/1-0:1.8.1*255", s->string());
+	EXPECT_THROW(reading_id_parse(meter_protocol_smlgateway, "1-0:1.8.1"), vz::VZException);
+}
+
+TEST(MeterSMLGateway, sources) {
+	int port_a, port_b;
+	int la = listener(port_a);
+	int lb = listener(port_b);
+	ASSERT_NE(-1, la);
+	ASSERT_NE(-1, lb);
+
+	char sources[128];
+	snprintf(sources, sizeof(sources),
+			 "[{\"id\": \"a\", \"host\": \"127.0.0.1:%d\"}, {\"id\": \"b\", \"host\": "
+			 "\"127.0.0.1:%d\"}]",
+			 port_a, port_b);
+	MeterSMLGateway m(gateway_options(sources));
+	ASSERT_EQ(0, m.open());
+
+	std::vector<Reading> rds;
+	rds.resize(10);
+	const std::string frame = unhex(emh);
+
+	// the connections are made by read(), the frames are queued in the sockets until then
+	std::thread reader([&]() { EXPECT_EQ(3, m.read(rds, rds.size())); });
+	int a = accept(la, NULL, NULL);
+	int b = accept(lb, NULL, NULL);
+	EXPECT_NE(-1, a); // no ASSERT with reader still joinable
+	EXPECT_NE(-1, b);
+	EXPECT_EQ((ssize_t)frame.size(), write(a, frame.data(), frame.size()));
+	reader.join();
+	ASSERT_NE(-1, a);
+	ASSERT_NE(-1, b);
+	EXPECT_EQ("a/1-0:1.8.1*255", identifier(rds[0]));
+	EXPECT_NEAR(14796777.1, rds[0].value(), 0.1);
+	EXPECT_EQ("a/1-0:1.7.0*255", identifier(rds[2]));
+	EXPECT_NEAR(11.2, rds[2].value(), 0.1);
+
+	// a frame split over two writes, only 2 readings fit and the
+	// rest of that frame is dropped, the next frame is returned next time
+	ASSERT_EQ((ssize_t)100, write(b, frame.data(), 100));
+	ASSERT_EQ((ssize_t)frame.size() - 100, write(b, frame.data() + 100, frame.size() - 100));
+	ASSERT_EQ((ssize_t)frame.size(), write(b, frame.data(), frame.size()));
+	EXPECT_EQ(2, m.read(rds, 2));
+	EXPECT_EQ("b/1-0:1.8.1*255", identifier(rds[0]));
+	EXPECT_EQ(3, m.read(rds, rds.size()));
+	EXPECT_EQ("b/1-0:1.8.1*255", identifier(rds[0]));
+
+	// a frame that doesn't fit completely after the first one is kept
+	ASSERT_EQ((ssize_t)frame.size(), write(b, frame.data(), frame.size()));
+	ASSERT_EQ((ssize_t)frame.size(), write(b, frame.data(), frame.size()));
+	EXPECT_EQ(3, m.read(rds, 4));
+	EXPECT_EQ(3, m.read(rds, rds.size()));
+	EXPECT_EQ("b/1-0:1.7.0*255", identifier(rds[2]));
+
+	// a source that closes the connection is reconnected
+	::close(a);
+	std::thread reconnect([&]() { EXPECT_EQ(3, m.read(rds, rds.size())); });
+	a = accept(la, NULL, NULL);
+	EXPECT_NE(-1, a);
+	EXPECT_EQ((ssize_t)frame.size(), write(a, frame.data(), frame.size()));
+	reconnect.join();
+	EXPECT_EQ("a/1-0:1.8.1*255", identifier(rds[0]));
+	EXPECT_TRUE(m.connected(0));
+	EXPECT_TRUE(m.connected(1));
+
+	EXPECT_EQ(0, m.close());
+	::close(a);
+	::close(b);
+	::close(la);
+	::close(lb);
+}
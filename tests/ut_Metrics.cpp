@@ -0,0 +1,78 @@
+#include <Metrics.hpp>
+
+#include "gtest/gtest.h"
+
+static bool has(const std::string &text, const std::string &line) {
+	return text.find(line + "\n") != std::string::npos;
+}
+
+TEST(Metrics, label_escaping) {
+	EXPECT_EQ("plain", metrics_label("plain"));
+	EXPECT_EQ("a\\\\b\\\"c\\nd", metrics_label("a\\b\"c\nd"));
+	EXPECT_EQ("", metrics_label(""));
+}
+
+TEST(Metrics, render) {
+	std::map<std::string, MetricsChannel> channels;
+	std::map<std::string, MetricsMeter> meters;
+
+	MetricsChannel &a = channels["aaaa"];
+	a._meter = "heat \"pump\"";
+	a._protocol = "sml";
+	a._identifier = "1-0:1.8.0*255";
+	a._t = 1700000000123;
+	a._v = 1234.5;
+	a._tuples = 3;
+	a._valid = true;
+
+	MetricsChannel &b = channels["bbbb"]; // no value yet, only counted
+	b._meter = "c:\\meter";
+	b._protocol = "d0";
+
+	MetricsMeter &m = meters["heat \"pump\""];
+	m._protocol = "sml";
+	m._readings = 42;
+	m._periods = 7;
+
+	std::string text = metrics_render(channels, meters);
+
+	EXPECT_TRUE(has(text, "# HELP vzlogger_channel_value Last value of the channel."));
+	EXPECT_TRUE(has(text, "# TYPE vzlogger_channel_value gauge"));
+	EXPECT_TRUE(has(text, "vzlogger_channel_value{uuid=\"aaaa\",meter=\"heat \\\"pump\\\"\","
+						  "protocol=\"sml\",identifier=\"1-0:1.8.0*255\"} 1234.5"));
+	EXPECT_EQ(std::string::npos, text.find("vzlogger_channel_value{uuid=\"bbbb\""));
+
+	EXPECT_TRUE(has(text, "# TYPE vzlogger_channel_timestamp_seconds gauge"));
+	EXPECT_TRUE(has(text, "vzlogger_channel_timestamp_seconds{uuid=\"aaaa\"} 1700000000.123"));
+	EXPECT_EQ(std::string::npos, text.find("vzlogger_channel_timestamp_seconds{uuid=\"bbbb\""));
+
+	EXPECT_TRUE(has(text, "# TYPE vzlogger_channel_tuples_total counter"));
+	EXPECT_TRUE(has(text, "vzlogger_channel_tuples_total{uuid=\"aaaa\"} 3"));
+	EXPECT_TRUE(has(text, "vzlogger_channel_tuples_total{uuid=\"bbbb\"} 0"));
+
+	EXPECT_TRUE(has(text, "# TYPE vzlogger_meter_readings_total counter"));
+	EXPECT_TRUE(has(text, "vzlogger_meter_readings_total{meter=\"heat \\\"pump\\\"\","
+						  "protocol=\"sml\"} 42"));
+	EXPECT_TRUE(has(text, "# TYPE vzlogger_meter_periods_total counter"));
+	EXPECT_TRUE(has(text, "vzlogger_meter_periods_total{meter=\"heat \\\"pump\\\"\"} 7"));
+
+	// every line is a comment or a sample, no raw newline from a label
+	size_t pos = 0;
+	while (pos < text.size()) {
+		size_t end = text.find('\n', pos);
+		ASSERT_NE(std::string::npos, end);
+		std::string line = text.substr(pos, end - pos);
+		EXPECT_TRUE(line.compare(0, 9, "vzlogger_") == 0 || line.compare(0, 2, "# ") == 0)
+			<< line;
+		pos = end + 1;
+	}
+}
+
+TEST(Metrics, render_empty) {
+	std::map<std::string, MetricsChannel> channels;
+	std::map<std::string, MetricsMeter> meters;
+	std::string text = metrics_render(channels, meters);
+	EXPECT_TRUE(has(text, "# TYPE vzlogger_channel_value gauge"));
+	EXPECT_TRUE(has(text, "# TYPE vzlogger_meter_periods_total counter"));
+	EXPECT_EQ(std::string::npos, text.find("{"));
+}
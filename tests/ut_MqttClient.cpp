@@ -0,0 +1,106 @@
+#include "gtest/gtest.h"
+#include <json-c/json.h>
+
+#include "Options.hpp"
+#include "mqtt.hpp"
+
+// inspects the outbound queue, the broker is never reached
+class MqttClientTest : public MqttClient {
+  public:
+	MqttClientTest(struct json_object *option) : MqttClient(option) {}
+	~MqttClientTest() { _enabled = false; } // no mqtt_client_thread to stop
+	// payloads of the queued messages with this topic
+	std::vector<std::string> payloads(const std::string &topic) {
+		std::vector<std::string> toRet;
+		std::lock_guard<std::mutex> lock(_queueMutex);
+		for (auto &m : _queue)
+			if (m._topic == topic)
+				toRet.push_back(m._payload);
+		return toRet;
+	}
+	size_t depth() {
+		std::lock_guard<std::mutex> lock(_queueMutex);
+		return _queue.size();
+	}
+};
+
+static MqttClientTest *client(const char *config) {
+	struct json_object *jso = json_tokener_parse(config);
+	MqttClientTest *c = new MqttClientTest(jso);
+	json_object_put(jso);
+	return c;
+}
+
+static Channel::Ptr channel(const char *topic, const char *aggmode = "none") {
+	std::list<Option> options;
+	options.push_back(Option("mqtt_topic", (char *)topic));
+	options.push_back(Option("aggmode", (char *)aggmode));
+	ReadingIdentifier::Ptr pRid(new StringIdentifier(topic));
+	return Channel::Ptr(new Channel(options, "null", "", pRid));
+}
+
+static Reading reading(int64_t time_ms, double value) {
+	ReadingIdentifier::Ptr pRid;
+	Reading r(value, {time_ms / 1000, (time_ms % 1000) * 1000}, pRid);
+	return r;
+}
+
+TEST(MqttClient, batch_grouping) {
+	std::unique_ptr<MqttClientTest> c(client("{\"enabled\": true, \"host\": \"127.0.0.1\", "
+											 "\"port\": 1, \"topic\": \"vz\", \"batch\": true, "
+											 "\"batchTopic\": \"meters/%m\"}"));
+	ASSERT_TRUE(c->batch());
+	Channel::Ptr a = channel("a"), b = channel("b");
+	c->init({a, b});
+
+	MqttClient::Batch batch;
+	batch.emplace_back(b, reading(1000, 1));
+	batch.emplace_back(a, reading(1000, 2));
+	batch.emplace_back(b, reading(2500, 3));
+	c->flush("heat", batch);
+	EXPECT_TRUE(batch.empty());
+
+	// one message per meter, channels in order of their first value, tuples in order
+	std::vector<std::string> p = c->payloads("vz/meters/heat/raw");
+	ASSERT_EQ(1u, p.size());
+	EXPECT_EQ("{\"meter\":\"heat\",\"values\":{\"b\":[[1000,1.0],[2500,3.0]],\"a\":[[1000,2.0]]}}",
+			  p[0]);
+	EXPECT_TRUE(c->payloads("vz/meters/heat/agg").empty());
+	EXPECT_TRUE(c->payloads("vz/b/raw").empty()); // no per channel messages
+}
+
+TEST(MqttClient, batch_flush) {
+	std::unique_ptr<MqttClientTest> c(client("{\"enabled\": true, \"host\": \"127.0.0.1\", "
+											 "\"port\": 1, \"topic\": \"vz\", \"batch\": true}"));
+	Channel::Ptr a = channel("a"), s = channel("s", "avg");
+	c->init({a, s});
+
+	// nothing is sent while values are collected or when the period had none
+	MqttClient::Batch batch;
+	c->flush("m", batch);
+	size_t depth = c->depth();
+	batch.emplace_back(a, reading(1000, 1));
+	batch.emplace_back(s, reading(1000, 5));
+	EXPECT_EQ(depth, c->depth());
+
+	// raw flush at the end of the period: s is aggregated and only sent as such
+	c->flush("m", batch);
+	EXPECT_TRUE(batch.empty());
+	std::vector<std::string> p = c->payloads("vz/m/raw");
+	ASSERT_EQ(1u, p.size());
+	EXPECT_EQ("{\"meter\":\"m\",\"values\":{\"a\":[[1000,1.0]]}}", p[0]);
+
+	// aggregated flush after the buffers were aggregated: only channels with an aggmode
+	batch.emplace_back(a, reading(2000, 1));
+	batch.emplace_back(s, reading(2000, 6));
+	c->flush("m", batch, true);
+	EXPECT_TRUE(batch.empty());
+	p = c->payloads("vz/m/agg");
+	ASSERT_EQ(1u, p.size());
+	EXPECT_EQ("{\"meter\":\"m\",\"values\":{\"s\":[[2000,6.0]]}}", p[0]);
+
+	// each period gives a new message
+	batch.emplace_back(a, reading(3000, 7));
+	c->flush("m", batch);
+	EXPECT_EQ(2u, c->payloads("vz/m/raw").size());
+}
@@ -1,5 +1,8 @@
 #include "PushData.hpp"
 #include "gtest/gtest.h"
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 // dirty hack until we find a better solution:
 #include "../src/PushData.cpp"
@@ -64,13 +67,119 @@ TEST(PushData, PDL_basic_waitForData4) {
 	delete dm;
 }
 
+TEST(PushData, PDL_intern) {
+	PushDataList pdl;
+	uint32_t a = pdl.intern("a");
+	uint32_t b = pdl.intern("b");
+	ASSERT_NE(a, b);
+	ASSERT_EQ(a, pdl.intern("a"));
+	pdl.add(b, 1, 1.0);
+	pdl.add("a", 2, 2.0);
+	PushDataList::DataMap *dm = pdl.waitForData();
+	ASSERT_TRUE(0 != dm);
+	ASSERT_EQ(2ul, dm->size());
+	ASSERT_EQ(1.0, dm->operator[]("b").front().second);
+	delete dm;
+}
+
+TEST(PushData, PDL_order) {
+	PushDataList pdl(0);
+	for (int i = 0; i < 10; i++)
+		pdl.add("0", i, i);
+	PushDataList::DataMap *dm = pdl.waitForData();
+	ASSERT_TRUE(0 != dm);
+	PushDataList::DataQueue &q = dm->operator[]("0");
+	ASSERT_EQ(10ul, q.size());
+	for (int i = 0; i < 10; i++, q.pop())
+		ASSERT_EQ(i, q.front().first);
+	delete dm;
+}
+
+TEST(PushData, PDL_coalesce_window) {
+	PushDataList pdl(300, 1000);
+	pdl.add("0", 1, 1.0);
+	std::thread producer([&pdl]() {
+		usleep(100000);
+		pdl.add("0", 2, 2.0); // within the window
+	});
+	PushDataList::DataMap *dm = pdl.waitForData();
+	producer.join();
+	ASSERT_TRUE(0 != dm);
+	ASSERT_EQ(2ul, dm->operator[]("0").size());
+	delete dm;
+}
+
+TEST(PushData, PDL_coalesce_max_tuples) {
+	PushDataList pdl(10000, 3); // the window would be longer than the 5s timeout
+	time_t start = time(NULL);
+	for (int i = 0; i < 3; i++)
+		pdl.add("0", i, i);
+	PushDataList::DataMap *dm = pdl.waitForData();
+	ASSERT_TRUE(0 != dm);
+	ASSERT_EQ(3ul, dm->operator[]("0").size());
+	ASSERT_LT(time(NULL) - start, 3);
+	delete dm;
+}
+
+TEST(PushData, PDL_multiple_producers) {
+	PushDataList pdl(10, 500);
+	const int threads = 4, n = 20000;
+	std::vector<std::thread> producers;
+	for (int t = 0; t < threads; t++)
+		producers.push_back(std::thread([&pdl, t]() {
+			uint32_t id = pdl.intern(std::to_string(t));
+			for (int i = 0; i < n; i++)
+				pdl.add(id, i, t);
+		}));
+
+	std::vector<int64_t> next(threads, 0); // per producer the order has to be kept
+	size_t received = 0;
+	bool ordered = true;
+	// no ASSERT until the producers are joined
+	while (received < (size_t)threads * n) {
+		PushDataList::DataMap *dm = pdl.waitForData();
+		EXPECT_TRUE(0 != dm);
+		if (!dm)
+			break;
+		for (auto &e : *dm) {
+			int t = std::stoi(e.first);
+			for (; !e.second.empty(); e.second.pop(), received++) {
+				ordered = ordered && next[t]++ == e.second.front().first &&
+						  t == e.second.front().second;
+			}
+		}
+		delete dm;
+	}
+	for (auto &p : producers)
+		p.join();
+	EXPECT_TRUE(ordered);
+	ASSERT_EQ((size_t)threads * n, received);
+}
+
 // todo if we'd provide a timeout to waitForData we could test here the case with empty data
 
 class PushDataServerTest {
   public:
 	PushDataServerTest(PushDataServer &pds) : _pds(pds) {};
 	std::string generateJson(PushDataList::DataMap &dataMap) { return _pds.generateJson(dataMap); }
+	std::string generateCbor(PushDataList::DataMap &dataMap, bool float32) {
+		return _pds.generateCbor(dataMap, float32);
+	}
 	size_t size() { return _pds._middlewareList.size(); };
+	unsigned long failed(size_t i) {
+		std::lock_guard<std::mutex> lock(_pds._middlewareList[i]->_mutex);
+		return _pds._middlewareList[i]->_failed;
+	}
+	unsigned long sent(size_t i) {
+		std::lock_guard<std::mutex> lock(_pds._middlewareList[i]->_mutex);
+		return _pds._middlewareList[i]->_sent;
+	}
+	// waits max. timeout_ms for a failed request to target i
+	bool waitFailed(size_t i, int timeout_ms) {
+		for (int t = 0; t < timeout_ms && !failed(i); t += 10)
+			usleep(10000);
+		return failed(i) > 0;
+	}
 	PushDataServer &_pds;
 };
 
@@ -89,12 +198,42 @@ TEST(PushData, PDS_constructor) {
 	// \"0\", \"tuples\": [ [ 1, 1.100000 ] ] } ] }", str);
 }
 
+TEST(PushData, PDS_generate_cbor) {
+	PushDataServer pds(0);
+	PushDataServerTest pt(pds);
+
+	PushDataList pdl;
+	pdl.add("0", 1000, 1.5);
+	pdl.add("0", 1250, 2.0);
+	PushDataList::DataMap *dm = pdl.waitForData();
+	ASSERT_TRUE(0 != dm);
+	// {"data": [{"uuid": "0", "t": [1000, 250], "v": [1.5, 2.0]}]}
+	const char expected[] = "\xa1\x64"
+							"data"
+							"\x81\xa3\x64"
+							"uuid"
+							"\x61"
+							"0"
+							"\x61"
+							"t"
+							"\x82\x19\x03\xe8\x18\xfa\x61"
+							"v"
+							"\x82\xfa\x3f\xc0\x00\x00\xfa\x40\x00\x00\x00";
+	std::string cbor = pt.generateCbor(*dm, false);
+	ASSERT_EQ(std::string(expected, sizeof(expected) - 1), cbor);
+	ASSERT_EQ(cbor, pt.generateCbor(*dm, true)); // both values are exact as float32
+	// the json encoding still sees all data
+	std::string json = pt.generateJson(*dm);
+	ASSERT_TRUE(json.find("1250") != std::string::npos);
+	delete dm;
+}
+
 TEST(PushData, PDS_fail_middleware) {
 	ASSERT_EQ(0, curlSessionProvider);
 	curlSessionProvider = new CurlSessionProvider();
 
-	struct json_object *jso =
-		json_tokener_parse("[{\"url\": \"http://127.0.0.1:45431/unit_test/push.json\"}]");
+	struct json_object *jso = json_tokener_parse(
+		"[{\"url\": \"http://127.0.0.1:45431/unit_test/push.json\", \"retries\": 0}]");
 	PushDataServer pds(jso);
 	json_object_put(jso);
 	PushDataServerTest pt(pds);
@@ -102,9 +241,68 @@ TEST(PushData, PDS_fail_middleware) {
 	PushDataList pdl;
 	pdl.add("0", 1, 1.1);
 	pushDataList = &pdl;
-	ASSERT_FALSE(pds.waitAndSendOnceToAll()); // we assume that localhost:45431/unit_test/push.json
-											  // can't be connected to
+	ASSERT_TRUE(pds.waitAndSendOnceToAll()); // only queued, delivery is done by the target thread
+	// we assume that localhost:45431/unit_test/push.json can't be connected to
+	ASSERT_TRUE(pt.waitFailed(0, 10000));
+	EXPECT_EQ(0ul, pt.sent(0));
+	pds.stop();
+	pushDataList = 0;
+
+	delete curlSessionProvider;
+	curlSessionProvider = 0;
+}
+
+TEST(PushData, PDS_invalid_target_options) {
+	struct json_object *jso =
+		json_tokener_parse("[{\"url\": \"http://127.0.0.1:45431/\", \"timeout\": 0}]");
+	ASSERT_THROW(PushDataServer pds(jso), vz::VZException);
+	json_object_put(jso);
+}
+
+TEST(PushData, PDS_slow_target_doesnt_block) {
+	ASSERT_EQ(0, curlSessionProvider);
+	curlSessionProvider = new CurlSessionProvider();
+
+	// a listening socket that never answers acts as the hanging middleware:
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ASSERT_EQ(0, bind(fd, (struct sockaddr *)&addr, sizeof(addr)));
+	ASSERT_EQ(0, listen(fd, 4));
+	socklen_t len = sizeof(addr);
+	getsockname(fd, (struct sockaddr *)&addr, &len);
+
+	std::string cfg = "[{\"url\": \"http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) +
+					  "/\", \"timeout\": 60}, {\"url\": \"http://127.0.0.1:45431/\", "
+					  "\"retries\": 0}]";
+	struct json_object *jso = json_tokener_parse(cfg.c_str());
+	PushDataServer *pds = new PushDataServer(jso);
+	json_object_put(jso);
+	PushDataServerTest pt(*pds);
+	ASSERT_EQ(2ul, pt.size());
+
+	PushDataList pdl;
+	pushDataList = &pdl;
+	pdl.add("0", 1, 1.1);
+	ASSERT_TRUE(pds->waitAndSendOnceToAll());
+	pdl.add("0", 2, 2.2);
+	ASSERT_TRUE(pds->waitAndSendOnceToAll());
+
+	// the unreachable target fails twice while the first one still waits for an answer:
+	for (int t = 0; t < 10000 && pt.failed(1) < 2; t += 10)
+		usleep(10000);
+	EXPECT_EQ(2ul, pt.failed(1));
+	EXPECT_EQ(0ul, pt.failed(0));
+	EXPECT_EQ(0ul, pt.sent(0));
+
+	// stop aborts the hanging request
+	time_t start = time(NULL);
+	delete pds;
+	EXPECT_LT(time(NULL) - start, 5);
 	pushDataList = 0;
+	close(fd);
 
 	delete curlSessionProvider;
 	curlSessionProvider = 0;
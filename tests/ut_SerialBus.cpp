@@ -0,0 +1,97 @@
+#include <SerialBus.hpp>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(SerialBus, shared_by_device) {
+	SerialBus::Ptr a = SerialBus::get("/dev/ttyUSB_test0");
+	SerialBus::Ptr b = SerialBus::get("/dev/ttyUSB_test0");
+	SerialBus::Ptr c = SerialBus::get("/dev/ttyUSB_test1");
+	EXPECT_EQ(a.get(), b.get());
+	EXPECT_NE(a.get(), c.get());
+	EXPECT_EQ("/dev/ttyUSB_test1", c->device());
+}
+
+TEST(SerialBus, request_order) {
+	SerialBus bus("/dev/ttyUSB_order");
+	std::mutex m;
+	std::vector<int> order;
+	bool overlap = false;
+	int active = 0;
+
+	bus.acquire("first");
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 4; i++) {
+		threads.push_back(std::thread([&, i]() {
+			bus.acquire("m" + std::to_string(i));
+			{
+				std::lock_guard<std::mutex> lock(m);
+				overlap |= ++active > 1;
+				order.push_back(i);
+			}
+			usleep(1000);
+			{
+				std::lock_guard<std::mutex> lock(m);
+				active--;
+			}
+			bus.release();
+		}));
+		usleep(20000); // let it queue up
+	}
+	bus.release();
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	EXPECT_FALSE(overlap);
+	ASSERT_EQ(4u, order.size());
+	for (int i = 0; i < 4; i++)
+		EXPECT_EQ(i, order[i]);
+}
+
+TEST(SerialBus, stats) {
+	SerialBus bus("/dev/ttyUSB_stats");
+	for (int i = 0; i < 3; i++) {
+		bus.acquire("meter");
+		usleep(10000);
+		bus.release();
+	}
+	bus.acquire("meter");
+	bus.release(false); // not counted
+
+	SerialBus::Stats s = bus.stats("meter");
+	EXPECT_EQ(3u, s._polls);
+	EXPECT_GE(s._pollMs, 30.0);
+	EXPECT_GE(s._maxPollMs, 10.0);
+	EXPECT_LE(s._maxPollMs, s._pollMs);
+	EXPECT_EQ(0u, bus.stats("other")._polls);
+}
+
+static void *wait_for_bus(void *arg) {
+	static_cast<SerialBus *>(arg)->acquire("cancelled");
+	return NULL;
+}
+
+TEST(SerialBus, cancelled_waiter) {
+	SerialBus bus("/dev/ttyUSB_cancel");
+	bus.acquire("owner");
+
+	pthread_t t;
+	pthread_create(&t, NULL, wait_for_bus, &bus);
+	usleep(20000);
+	pthread_cancel(t);
+	pthread_join(t, NULL);
+
+	// the cancelled thread must not block the queue
+	std::thread next([&bus]() {
+		bus.acquire("next");
+		bus.release();
+	});
+	usleep(20000);
+	bus.release();
+	next.join();
+	EXPECT_EQ(1u, bus.stats("next")._polls);
+}
@@ -0,0 +1,164 @@
+#include <chrono>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include <Channel.hpp>
+#include <ShmRing.hpp>
+#include <json-c/json.h>
+#include <vzlogger_shm.h>
+
+#include "gtest/gtest.h"
+
+static std::string shm_name() { return "/vzlogger_ut_" + std::to_string(getpid()); }
+
+static ShmRing *shm_ring(int capacity) {
+	std::string cfg = "{\"enabled\": true, \"name\": \"" + shm_name() +
+					  "\", \"capacity\": " + std::to_string(capacity) + "}";
+	struct json_object *jso = json_tokener_parse(cfg.c_str());
+	ShmRing *ring = new ShmRing(jso);
+	json_object_put(jso);
+	return ring;
+}
+
+static std::vector<Channel::Ptr> shm_channels(int n) {
+	std::vector<Channel::Ptr> channels;
+	std::list<Option> options;
+	ReadingIdentifier::Ptr pRid;
+	for (int i = 0; i < n; i++)
+		channels.push_back(Channel::Ptr(
+			new Channel(options, std::string("null"), "uuid-" + std::to_string(i), pRid)));
+	return channels;
+}
+
+// map the ring like a local consumer does. writable only to corrupt records in a test
+static struct vz_shm_header *shm_map(size_t &size, bool writable = false) {
+	int fd = shm_open(shm_name().c_str(), writable ? O_RDWR : O_RDONLY, 0);
+	if (fd < 0)
+		return 0;
+	struct stat st;
+	fstat(fd, &st);
+	size = st.st_size;
+	void *p = mmap(0, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	return p == MAP_FAILED ? 0 : static_cast<struct vz_shm_header *>(p);
+}
+
+TEST(ShmRing, not_enabled) {
+	ShmRing ring(NULL);
+	EXPECT_FALSE(ring.isConfigured());
+	EXPECT_FALSE(ring.open(shm_channels(1)));
+}
+
+TEST(ShmRing, layout) {
+	ShmRing *ring = shm_ring(5);
+	ASSERT_TRUE(ring->isConfigured());
+	std::vector<Channel::Ptr> channels = shm_channels(2);
+	ASSERT_TRUE(ring->open(channels));
+
+	size_t size;
+	const struct vz_shm_header *h = shm_map(size);
+	ASSERT_TRUE(h != 0);
+	EXPECT_TRUE(vz_shm_valid(h));
+	EXPECT_EQ(64u, sizeof(struct vz_shm_header));
+	EXPECT_EQ(32u, sizeof(struct vz_shm_record));
+	EXPECT_EQ(8u, h->capacity); // rounded up to a power of two
+	EXPECT_EQ(2u, h->channels);
+	EXPECT_EQ(0u, h->ring_offset % 64);
+	EXPECT_EQ(size, h->ring_offset + h->capacity * sizeof(struct vz_shm_record));
+	EXPECT_STREQ("uuid-0", vz_shm_channels(h)[0].uuid);
+	EXPECT_STREQ("uuid-1", vz_shm_channels(h)[1].uuid);
+	EXPECT_STREQ(channels[1]->name(), vz_shm_channels(h)[1].name);
+	EXPECT_EQ(0u, vz_shm_head(h));
+
+	delete ring;
+	EXPECT_FALSE(vz_shm_valid(h)); // stale mapping is detectable
+	munmap((void *)h, size);
+	EXPECT_EQ(-1, shm_open(shm_name().c_str(), O_RDONLY, 0));
+}
+
+TEST(ShmRing, read_and_overwrite) {
+	ShmRing *ring = shm_ring(4);
+	std::vector<Channel::Ptr> channels = shm_channels(2);
+	ASSERT_TRUE(ring->open(channels));
+	size_t size;
+	const struct vz_shm_header *h = shm_map(size);
+	ASSERT_TRUE(h != 0);
+
+	struct vz_shm_record r;
+	EXPECT_EQ(1, vz_shm_read(h, 0, &r));
+	ring->add(channels[1].get(), 1000, 1.5);
+	ring->add(channels[0].get(), 2000, -2.5);
+	ring->add(0, 3000, 3); // unknown channels are ignored
+	EXPECT_EQ(2u, vz_shm_head(h));
+
+	ASSERT_EQ(0, vz_shm_read(h, 0, &r));
+	EXPECT_EQ(1u, r.channel);
+	EXPECT_EQ(1000, r.time_ms);
+	EXPECT_DOUBLE_EQ(1.5, r.value);
+	EXPECT_EQ(0u, r.seq & 1);
+	ASSERT_EQ(0, vz_shm_read(h, 1, &r));
+	EXPECT_EQ(0u, r.channel);
+	EXPECT_DOUBLE_EQ(-2.5, r.value);
+
+	for (int i = 2; i < 10; i++)
+		ring->add(channels[0].get(), i * 1000, i);
+	EXPECT_EQ(10u, vz_shm_head(h));
+	EXPECT_EQ(-1, vz_shm_read(h, 0, &r)); // slot reused by pos 8
+	EXPECT_EQ(-1, vz_shm_read(h, 5, &r));
+	for (uint64_t pos = 6; pos < 10; pos++) {
+		ASSERT_EQ(0, vz_shm_read(h, pos, &r));
+		EXPECT_EQ(pos, r.pos);
+		EXPECT_DOUBLE_EQ((double)pos, r.value);
+	}
+	EXPECT_EQ(1, vz_shm_read(h, 10, &r));
+
+	munmap((void *)h, size);
+	delete ring;
+}
+
+TEST(ShmRing, wait_wakes_reader) {
+	ShmRing *ring = shm_ring(16);
+	std::vector<Channel::Ptr> channels = shm_channels(1);
+	ASSERT_TRUE(ring->open(channels));
+	size_t size;
+	struct vz_shm_header *h = shm_map(size); // read-only is enough to wait
+	ASSERT_TRUE(h != 0);
+
+	uint32_t f = vz_shm_futex(h);
+	std::thread writer([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		ring->add(channels[0].get(), 1000, 42);
+	});
+	auto start = std::chrono::steady_clock::now();
+	while (vz_shm_head(h) == 0)
+		vz_shm_wait(h, f, 5000);
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	writer.join();
+	EXPECT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(), 4000);
+
+	munmap((void *)h, size);
+	delete ring;
+}
+
+TEST(ShmRing, read_gives_up_on_inconsistent_record) {
+	ShmRing *ring = shm_ring(4);
+	std::vector<Channel::Ptr> channels = shm_channels(1);
+	ASSERT_TRUE(ring->open(channels));
+	size_t size;
+	struct vz_shm_header *h = shm_map(size, true);
+	ASSERT_TRUE(h != 0);
+
+	ring->add(channels[0].get(), 1000, 1);
+	struct vz_shm_record *r = (struct vz_shm_record *)vz_shm_ring(h);
+	r->seq++; // as if the writer died while writing the record
+	struct vz_shm_record out;
+	EXPECT_EQ(-2, vz_shm_read(h, 0, &out));
+	r->seq++;
+	EXPECT_EQ(0, vz_shm_read(h, 0, &out));
+
+	munmap((void *)h, size);
+	delete ring;
+}
@@ -0,0 +1,188 @@
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include <protocols/SmlDecoder.hpp>
+
+static std::string unhex(const char *hex) {
+	std::string s;
+	for (; hex[0] && hex[1]; hex += 2)
+		s += (char)strtol(std::string(hex, 2).c_str(), NULL, 16);
+	return s;
+}
+
+// a frame around body as a meter would send it: escaped, padded and with checksum
+static std::string frame(const std::string &body) {
+	const std::string esc("\x1b\x1b\x1b\x1b", 4);
+	std::string padded = body;
+	const size_t padding = (4 - body.size() % 4) % 4;
+	padded.append(padding, '\0');
+
+	std::string f = esc + std::string("\x01\x01\x01\x01", 4);
+	for (size_t i = 0; i < padded.size(); i += 4) {
+		if (padded.compare(i, 4, esc) == 0)
+			f += esc;
+		f += padded.substr(i, 4);
+	}
+	f += esc + '\x1a' + (char)padding;
+	const uint16_t crc = SmlDecoder::crc16((const unsigned char *)f.data(), f.size());
+	f += (char)(crc & 0xff);
+	f += (char)(crc >> 8);
+	return f;
+}
+
+// from the EMH test in MeterSML.cpp
+static const char *emh =
+	"1B1B1B1B010101017607003600001AFA6200620072630101760101070036044808FE093032323830383136"
+	"01016331ED007607003600001AFB62006200726307017701093032323830383136017262016504487D8976"
+	"77078181C78203FF0101010104454D480177070100000000FF010101010930323238303831360177070100"
+	"010801FF63018001621E52FF560008D1CF1B0177070100010802FF63018001621E52FF560000004E9C0177"
+	"0700006001FFFF010101010B303030323238303831360177070100010700FF0101621B52FF550000007001"
+	"010163D201007607003600001AFC6200620072630201710163077A00001B1B1B1B1A019D37";
+
+class Collect : public SmlDecoder::Visitor {
+  public:
+	Collect(size_t max = 100) : _max(max) {}
+	bool entry(const SmlDecoder::Entry &e) {
+		_entries.push_back(e);
+		return _entries.size() < _max;
+	}
+	size_t _max;
+	std::vector<SmlDecoder::Entry> _entries;
+};
+
+TEST(SmlDecoder, emh_frame) {
+	std::string buf = unhex(emh);
+	size_t used, len;
+	const unsigned char *body;
+	ASSERT_EQ(SmlDecoder::FRAME,
+			  SmlDecoder::frame((unsigned char *)&buf[0], buf.size(), used, body, len));
+	EXPECT_EQ(buf.size(), used);
+	EXPECT_EQ(buf.size() - 16 - 1, len); // one byte padding
+
+	Collect c;
+	ASSERT_TRUE(SmlDecoder::parse(body, len, c));
+	ASSERT_EQ(6u, c._entries.size());
+
+	const SmlDecoder::Entry &e = c._entries[2];
+	ASSERT_EQ(6u, e._objNameLen);
+	EXPECT_EQ(0, memcmp(e._objName, "\x01\x00\x01\x08\x01\xff", 6));
+	EXPECT_EQ(SmlDecoder::Entry::VALUE_NUMBER, e._valueType);
+	EXPECT_EQ(147967771.0, e._number);
+	EXPECT_TRUE(e._hasUnit);
+	EXPECT_EQ(0x1e, e._unit);
+	EXPECT_TRUE(e._hasScaler);
+	EXPECT_EQ(-1, e._scaler);
+	EXPECT_FALSE(e._hasTime);
+
+	EXPECT_EQ(SmlDecoder::Entry::VALUE_OCTETS, c._entries[0]._valueType);
+	EXPECT_EQ(3u, c._entries[0]._octetsLen);
+	EXPECT_EQ(112.0, c._entries[5]._number);
+	EXPECT_FALSE(c._entries[5]._hasTime);
+
+	Collect first(2); // the visitor stops early
+	EXPECT_TRUE(SmlDecoder::parse(body, len, first));
+	EXPECT_EQ(2u, first._entries.size());
+}
+
+TEST(SmlDecoder, entries) {
+	std::string buf = unhex(emh);
+	size_t used, len;
+	const unsigned char *body;
+	ASSERT_EQ(SmlDecoder::FRAME,
+			  SmlDecoder::frame((unsigned char *)&buf[0], buf.size(), used, body, len));
+	EXPECT_EQ(6u, SmlDecoder::entries(body, len));
+	EXPECT_LE(6u, SmlDecoder::max_entries(len));
+	EXPECT_EQ(0u, SmlDecoder::entries(body, 0));
+}
+
+TEST(SmlDecoder, entry_types) {
+	std::string msg = unhex("76020162006200"
+							"72630701"
+							"7701010101"
+							"71"
+							"77070100100700FF01"
+							"726201650000006462" // valTime secIndex 100
+							"1B5200"             // unit, scaler
+							"53FF38"             // -200
+							"01"
+							"0101"
+							"631234"
+							"00");
+	std::string buf = "garbage" + frame(msg);
+	size_t used, len;
+	const unsigned char *body;
+	ASSERT_EQ(SmlDecoder::FRAME,
+			  SmlDecoder::frame((unsigned char *)&buf[0], buf.size(), used, body, len));
+	EXPECT_EQ(buf.size(), used);
+
+	Collect c;
+	ASSERT_TRUE(SmlDecoder::parse(body, len, c));
+	ASSERT_EQ(1u, c._entries.size());
+	EXPECT_EQ(-200.0, c._entries[0]._number);
+	EXPECT_TRUE(c._entries[0]._hasTime);
+	EXPECT_EQ(100u, c._entries[0]._time);
+	EXPECT_EQ(0, c._entries[0]._scaler);
+
+	EXPECT_FALSE(SmlDecoder::parse(body, len - 4, c)); // truncated
+}
+
+TEST(SmlDecoder, frames_in_stream) {
+	const std::string one = unhex(emh);
+	std::string buf = "\x1b\x1b" + one + one + one.substr(0, 100);
+	unsigned char *p = (unsigned char *)&buf[0];
+	size_t used, len, pos = 0;
+	const unsigned char *body;
+
+	ASSERT_EQ(SmlDecoder::FRAME, SmlDecoder::frame(p, buf.size(), used, body, len));
+	EXPECT_EQ(2 + one.size(), used);
+	pos += used;
+	ASSERT_EQ(SmlDecoder::FRAME, SmlDecoder::frame(p + pos, buf.size() - pos, used, body, len));
+	EXPECT_EQ(one.size(), used);
+	pos += used;
+	EXPECT_EQ(SmlDecoder::NONE, SmlDecoder::frame(p + pos, buf.size() - pos, used, body, len));
+	EXPECT_EQ(0u, used); // the incomplete frame is kept
+
+	std::string noise(100, 'x');
+	EXPECT_EQ(SmlDecoder::NONE, SmlDecoder::frame((unsigned char *)&noise[0], noise.size(), used,
+												  body, len));
+	EXPECT_EQ(93u, used);
+}
+
+TEST(SmlDecoder, bad_frames) {
+	std::string buf = unhex(emh);
+	buf[buf.size() - 1] ^= 1;
+	size_t used, len;
+	const unsigned char *body;
+	EXPECT_EQ(SmlDecoder::BAD_FRAME,
+			  SmlDecoder::frame((unsigned char *)&buf[0], buf.size(), used, body, len));
+	EXPECT_EQ(buf.size(), used);
+
+	// a frame cut off by the next one
+	const std::string one = unhex(emh);
+	buf = one.substr(0, 40) + one;
+	EXPECT_EQ(SmlDecoder::BAD_FRAME,
+			  SmlDecoder::frame((unsigned char *)&buf[0], buf.size(), used, body, len));
+	EXPECT_EQ(40u, used);
+}
+
+TEST(SmlDecoder, escape_sequences) {
+	const std::string data("\x1b\x1b\x1b\x1b\x01\x02\x03\x04\x1b\x1b\x1b\x1b\x05", 13);
+	std::string buf = frame(data);
+	EXPECT_EQ(8u + 24u + 8u, buf.size());
+	size_t used, len;
+	const unsigned char *body;
+	ASSERT_EQ(SmlDecoder::FRAME,
+			  SmlDecoder::frame((unsigned char *)&buf[0], buf.size(), used, body, len));
+	ASSERT_EQ(data.size(), len);
+	EXPECT_EQ(0, memcmp(data.data(), body, len));
+}
+
+TEST(SmlDecoder, scale) {
+	EXPECT_EQ(pow(10, -1), SmlDecoder::scale(-1));
+	EXPECT_EQ(1.0, SmlDecoder::scale(0));
+	EXPECT_EQ(1000.0, SmlDecoder::scale(3));
+	EXPECT_EQ(pow(10, -128), SmlDecoder::scale(-128));
+}
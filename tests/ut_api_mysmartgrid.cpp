@@ -0,0 +1,214 @@
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include <Channel.hpp>
+#include <Config_Options.hpp>
+#include <api/MySmartGrid.hpp>
+
+#include "gtest/gtest.h"
+
+extern Config_Options options;
+
+// minimal http server on loopback. Answers each request with the next queued status code
+// (200 if none) and records the request bodies.
+class MsgMiddleware {
+  public:
+	MsgMiddleware() : _fd(socket(AF_INET, SOCK_STREAM, 0)) {
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		bind(_fd, (struct sockaddr *)&addr, sizeof(addr));
+		listen(_fd, 4);
+		socklen_t len = sizeof(addr);
+		getsockname(_fd, (struct sockaddr *)&addr, &len);
+		_url = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+		_thread = std::thread(&MsgMiddleware::run, this);
+	}
+	~MsgMiddleware() {
+		shutdown(_fd, SHUT_RDWR);
+		_thread.join();
+		close(_fd);
+	}
+	const std::string &url() const { return _url; }
+	void reply(int code) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_codes.push_back(code);
+	}
+	// path and body of the requests so far
+	std::vector<std::pair<std::string, std::string>> requests() {
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::vector<std::pair<std::string, std::string>> toRet;
+		toRet.swap(_requests);
+		return toRet;
+	}
+
+  private:
+	void run() {
+		int c;
+		while ((c = accept(_fd, NULL, NULL)) >= 0) {
+			std::string req;
+			char buf[4096];
+			size_t body = std::string::npos, length = 0;
+			ssize_t n;
+			while ((n = read(c, buf, sizeof(buf))) > 0) {
+				req.append(buf, n);
+				if (body == std::string::npos &&
+					(body = req.find("\r\n\r\n")) != std::string::npos) {
+					body += 4;
+					size_t cl = req.find("Content-Length: ");
+					if (cl != std::string::npos && cl < body)
+						length = strtoul(req.c_str() + cl + 16, NULL, 10);
+				}
+				if (body != std::string::npos && req.size() >= body + length)
+					break;
+			}
+			int code = 200;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (!_codes.empty()) {
+					code = _codes.front();
+					_codes.pop_front();
+				}
+				size_t path = req.find(' ') + 1;
+				_requests.push_back(std::make_pair(req.substr(path, req.find(' ', path) - path),
+												   body != std::string::npos ? req.substr(body)
+																			 : ""));
+			}
+			std::string resp = "HTTP/1.1 " + std::to_string(code) +
+							   " X\r\nContent-Length: 2\r\nConnection: close\r\n\r\n{}";
+			(void)write(c, resp.data(), resp.size());
+			close(c);
+		}
+	}
+
+	int _fd;
+	std::string _url;
+	std::thread _thread;
+	std::mutex _mutex; // protects the following members
+	std::deque<int> _codes;
+	std::vector<std::pair<std::string, std::string>> _requests;
+};
+
+static Channel::Ptr msg_channel(const char *uuid) {
+	std::list<Option> options;
+	ReadingIdentifier::Ptr pRid;
+	return Channel::Ptr(new Channel(options, "mysmartgrid", uuid, pRid));
+}
+
+static std::list<Option> msg_options(const std::string &middleware, const char *type,
+									 bool batch) {
+	std::list<Option> options;
+	options.push_back(Option("middleware", middleware));
+	options.push_back(Option("secretKey", "secret"));
+	options.push_back(Option("device", "dev-1"));
+	options.push_back(Option("type", type));
+	options.push_back(Option("interval", 0)); // never skip a send()
+	options.push_back(Option("batch", batch));
+	return options;
+}
+
+static void push(Channel::Ptr ch, time_t t, double value) {
+	ReadingIdentifier::Ptr pRid;
+	struct timeval tv = {t, 0};
+	Reading r(value, tv, pRid);
+	ch->push(r);
+}
+
+// value of key in the json object body as plain json, "<none>" if missing
+static std::string member(const std::string &body, const char *key) {
+	struct json_object *jso = json_tokener_parse(body.c_str()), *value;
+	std::string toRet = "<none>";
+	if (jso && json_object_object_get_ex(jso, key, &value))
+		toRet = json_object_to_json_string_ext(value, JSON_C_TO_STRING_PLAIN);
+	json_object_put(jso);
+	return toRet;
+}
+
+TEST(api_MySmartGrid, sensor_resends_after_failure) {
+	options.retry_pause(0);
+	MsgMiddleware mw;
+	Channel::Ptr ch = msg_channel("sensor-1");
+	vz::api::MySmartGrid msg(ch, msg_options(mw.url(), "sensor", false));
+
+	// the first value is the counter base, the measurements are relative to it
+	push(ch, 100, 10);
+	push(ch, 200, 12);
+	push(ch, 300, 15);
+	msg.send();
+	std::vector<std::pair<std::string, std::string>> r = mw.requests();
+	ASSERT_EQ(1u, r.size());
+	EXPECT_EQ("/sensor/sensor1", r[0].first);
+	EXPECT_EQ("[[200,2],[300,5]]", member(r[0].second, "measurements"));
+
+	// a failed request doesn't count as sent, so its values are sent again
+	push(ch, 400, 16);
+	mw.reply(500);
+	msg.send();
+	msg.send();
+	r = mw.requests();
+	ASSERT_EQ(2u, r.size());
+	EXPECT_EQ("[[400,6]]", member(r[0].second, "measurements"));
+	EXPECT_EQ("[[400,6]]", member(r[1].second, "measurements"));
+
+	// after a 200 only newer values are sent
+	push(ch, 500, 20);
+	msg.send();
+	r = mw.requests();
+	ASSERT_EQ(1u, r.size());
+	EXPECT_EQ("[[500,10]]", member(r[0].second, "measurements"));
+}
+
+TEST(api_MySmartGrid, batch) {
+	options.retry_pause(0);
+	MsgMiddleware mw;
+	Channel::Ptr dev = msg_channel("dev-1"), s1 = msg_channel("s-1"), s2 = msg_channel("s-2");
+	vz::api::MySmartGrid mdev(dev, msg_options(mw.url(), "device", true));
+	vz::api::MySmartGrid m1(s1, msg_options(mw.url(), "sensor", true));
+	vz::api::MySmartGrid m2(s2, msg_options(mw.url(), "sensor", true));
+
+	// registration once, then one request with the heartbeat and all sensors with values
+	push(s1, 100, 10);
+	push(s1, 200, 12);
+	push(s2, 100, 1); // counter base only, nothing to send yet
+	push(dev, 100, 1);
+	mdev.send();
+	std::vector<std::pair<std::string, std::string>> r = mw.requests();
+	ASSERT_EQ(2u, r.size());
+	EXPECT_EQ("/device/dev1", r[0].first);
+	EXPECT_EQ("\"secret\"", member(r[0].second, "key"));
+	EXPECT_EQ("/device/dev1", r[1].first);
+	EXPECT_EQ("\"1.0.0\"", member(r[1].second, "version"));
+	EXPECT_EQ("{\"s1\":[[200,2]]}", member(r[1].second, "measurements"));
+	EXPECT_EQ(0u, dev->buffer()->size()); // the device values are dropped
+
+	push(s1, 300, 13);
+	push(s2, 200, 3);
+	m1.send();
+	r = mw.requests();
+	ASSERT_EQ(1u, r.size());
+	EXPECT_EQ("{\"s1\":[[300,3]],\"s2\":[[200,2]]}", member(r[0].second, "measurements"));
+
+	// a failed batch doesn't count as sent for any sensor, whoever sends it
+	push(s2, 300, 4);
+	mw.reply(500);
+	mdev.send();
+	m1.send();
+	r = mw.requests();
+	ASSERT_EQ(2u, r.size());
+	EXPECT_EQ("{\"s2\":[[300,3]]}", member(r[0].second, "measurements"));
+	EXPECT_EQ("{\"s2\":[[300,3]]}", member(r[1].second, "measurements"));
+
+	// after a 200 there is nothing left, the heartbeat is sent anyhow
+	mdev.send();
+	r = mw.requests();
+	ASSERT_EQ(1u, r.size());
+	EXPECT_EQ("{}", member(r[0].second, "measurements"));
+}
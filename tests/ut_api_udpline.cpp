@@ -0,0 +1,173 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <Buffer.hpp>
+#include <Channel.hpp>
+#include <Config_Options.hpp>
+#include <api/UdpLine.hpp>
+
+#include "gtest/gtest.h"
+
+// local udp listener on 127.0.0.1 standing in for the server
+class UdpListener {
+  public:
+	UdpListener() : _port(0) {
+		_fd = socket(AF_INET, SOCK_DGRAM, 0);
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		bind(_fd, (struct sockaddr *)&addr, sizeof(addr));
+		socklen_t len = sizeof(addr);
+		getsockname(_fd, (struct sockaddr *)&addr, &len);
+		_port = ntohs(addr.sin_port);
+	}
+	~UdpListener() { close(_fd); }
+	int port() const { return _port; }
+	// returns false if no datagram arrives within timeout_ms
+	bool recv(std::string &datagram, int timeout_ms = 1000) {
+		struct pollfd pfd = {_fd, POLLIN, 0};
+		if (poll(&pfd, 1, timeout_ms) != 1)
+			return false;
+		char buf[65536];
+		ssize_t n = ::recv(_fd, buf, sizeof(buf), 0);
+		if (n < 0)
+			return false;
+		datagram.assign(buf, n);
+		return true;
+	}
+
+  private:
+	int _fd;
+	int _port;
+};
+
+static Channel::Ptr udp_channel(std::list<Option> &options) {
+	ReadingIdentifier::Ptr pRid;
+	return Channel::Ptr(
+		new Channel(options, std::string("udp_api"), std::string("udp-uuid"), pRid));
+}
+
+static void udp_push(Channel::Ptr ch, double value, int64_t ms) {
+	struct timeval tv;
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000;
+	ReadingIdentifier::Ptr pRid;
+	ch->push(Reading(value, tv, pRid));
+}
+
+TEST(api_UdpLine, requires_host) {
+	std::list<Option> options;
+	Channel::Ptr ch = udp_channel(options);
+	ASSERT_THROW(vz::api::UdpLine u(ch, options), vz::VZException);
+}
+
+TEST(api_UdpLine, invalid_format) {
+	std::list<Option> options;
+	options.push_back(Option("host", (char *)"127.0.0.1"));
+	options.push_back(Option("format", (char *)"bla"));
+	Channel::Ptr ch = udp_channel(options);
+	ASSERT_THROW(vz::api::UdpLine u(ch, options), vz::VZException);
+}
+
+TEST(api_UdpLine, influxdb) {
+	UdpListener srv;
+	std::list<Option> options;
+	options.push_back(Option("host", (char *)"127.0.0.1"));
+	options.push_back(Option("port", srv.port()));
+	options.push_back(Option("tags", (char *)"site=home"));
+	Channel::Ptr ch = udp_channel(options);
+	vz::api::UdpLine u(ch, options);
+
+	udp_push(ch, 1.5, 1700000000123LL);
+	udp_push(ch, 2.0, 1700000001123LL);
+	u.send();
+
+	std::string d;
+	ASSERT_TRUE(srv.recv(d));
+	EXPECT_EQ("vzlogger,uuid=udp-uuid,site=home value=1.500000 1700000000123000000\n"
+			  "vzlogger,uuid=udp-uuid,site=home value=2.000000 1700000001123000000\n",
+			  d);
+	EXPECT_EQ(0u, ch->buffer()->size()); // fire and forget
+	EXPECT_FALSE(srv.recv(d, 50));
+}
+
+TEST(api_UdpLine, graphite_statsd) {
+	UdpListener srv;
+	std::list<Option> options;
+	options.push_back(Option("host", (char *)"127.0.0.1"));
+	options.push_back(Option("port", srv.port()));
+	options.push_back(Option("format", (char *)"graphite"));
+	options.push_back(Option("measurement_name", (char *)"house"));
+	Channel::Ptr ch = udp_channel(options);
+	vz::api::UdpLine g(ch, options);
+
+	udp_push(ch, 42, 1700000000999LL);
+	g.send();
+	std::string d;
+	ASSERT_TRUE(srv.recv(d));
+	EXPECT_EQ("house.udp-uuid 42.000000 1700000000\n", d);
+
+	options.pop_front();
+	options.pop_front();
+	options.pop_front();
+	options.push_back(Option("host", (char *)"127.0.0.1"));
+	options.push_back(Option("port", srv.port()));
+	options.push_back(Option("format", (char *)"statsd"));
+	vz::api::UdpLine s(ch, options);
+	udp_push(ch, -3, 1700000002000LL);
+	s.send();
+	ASSERT_TRUE(srv.recv(d));
+	EXPECT_EQ("house.udp-uuid:0|g\nhouse.udp-uuid:-3.000000|g\n", d);
+}
+
+TEST(api_UdpLine, mtu_packing) {
+	UdpListener srv;
+	std::list<Option> options;
+	options.push_back(Option("host", (char *)"127.0.0.1"));
+	options.push_back(Option("port", srv.port()));
+	options.push_back(Option("send_uuid", false));
+	options.push_back(Option("mtu", 128));
+	Channel::Ptr ch = udp_channel(options);
+	vz::api::UdpLine u(ch, options);
+
+	// each line is 44 bytes, so two lines fit into one datagram
+	const std::string line("vzlogger value=1.000000 1700000000000000000\n");
+	for (int i = 0; i < 5; i++)
+		udp_push(ch, 1, 1700000000000LL + i * 1000);
+	u.send();
+
+	size_t lines = 0;
+	int datagrams = 0;
+	std::string d;
+	while (srv.recv(d, 100)) {
+		EXPECT_LE(d.size(), 128u);
+		EXPECT_EQ(0u, d.size() % line.size());
+		lines += d.size() / line.size();
+		datagrams++;
+	}
+	EXPECT_EQ(5u, lines);
+	EXPECT_EQ(3, datagrams);
+}
+
+TEST(api_UdpLine, line_exceeding_mtu) {
+	UdpListener srv;
+	std::list<Option> options;
+	options.push_back(Option("host", (char *)"127.0.0.1"));
+	options.push_back(Option("port", srv.port()));
+	options.push_back(Option("send_uuid", false));
+	options.push_back(Option("mtu", 64));
+	options.push_back(Option("tags", (char *)"location=somewhere_with_a_very_long_name"));
+	Channel::Ptr ch = udp_channel(options);
+	vz::api::UdpLine u(ch, options);
+
+	// 84 bytes, the line is dropped instead of sending an oversized datagram
+	udp_push(ch, 1, 1700000000000LL);
+	u.send();
+	std::string d;
+	EXPECT_FALSE(srv.recv(d, 100));
+}